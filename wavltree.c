@@ -30,31 +30,219 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 
-#ifdef __WAVL_TEST__
-#include <stdio.h>
-#define WAVL_DEBUG_OUT(_s, ...) \
-    do { fprintf(stdout,                            \
-        "DEBUG: " _s " (" __FILE__ ":%d @ %s)\n",   \
-        ##__VA_ARGS__, __LINE__, __FUNCTION__);     \
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifdef WAVL_TRACE
+#include "wavltree_trace.h"
+#define WAVL_TRACE_EVENT(_op, _tree, _node, _rp_before, _rp_after) \
+    wavl_trace_emit((_op), (_tree), (_node), (_rp_before), (_rp_after))
+#else
+#define WAVL_TRACE_EVENT(...)
+#endif
+
+#ifdef WAVL_TREE_STATS
+#define WAVL_STAT_ADD(_tree, _field, _n) \
+    do { (_tree)->stats._field += (_n); } while (0)
+#define WAVL_STAT_MAX(_tree, _field, _v) \
+    do {                                                \
+        if ((_tree)->stats._field < (uint64_t)(_v)) {   \
+            (_tree)->stats._field = (uint64_t)(_v);     \
+        }                                               \
     } while (0)
 #else
-#define WAVL_DEBUG_OUT(...)
+#define WAVL_STAT_ADD(_tree, ...) do { (void)(_tree); } while (0)
+#define WAVL_STAT_MAX(_tree, ...) do { (void)(_tree); } while (0)
 #endif
 
+#define WAVL_STAT_INC(_tree, _field) WAVL_STAT_ADD(_tree, _field, 1)
+
 wavl_result_t wavl_tree_init(struct wavl_tree *tree,
                              wavl_node_to_node_compare_func_t node_cmp,
                              wavl_key_to_node_compare_func_t key_cmp)
+{
+    return wavl_tree_init_flags(tree, node_cmp, key_cmp, 0);
+}
+
+wavl_result_t wavl_tree_init_flags(struct wavl_tree *tree,
+                                   wavl_node_to_node_compare_func_t node_cmp,
+                                   wavl_key_to_node_compare_func_t key_cmp,
+                                   uint32_t flags)
 {
     wavl_result_t ret = WAVL_ERR_OK;
 
     WAVL_ASSERT_ARG(NULL != tree);
     WAVL_ASSERT_ARG(NULL != node_cmp);
     WAVL_ASSERT_ARG(NULL != key_cmp);
+    WAVL_ASSERT_ARG(0 == (flags & ~WAVL_TREE_FLAG_MULTI));
 
     tree->root = NULL;
+    tree->leftmost = tree->rightmost = NULL;
     tree->node_cmp = node_cmp;
     tree->key_cmp = key_cmp;
+    tree->node_bytes = NULL;
+    tree->flags = flags;
+    tree->cache = NULL;
+    tree->cache_mask = 0;
+    tree->cache_key_hash = NULL;
+    tree->cache_node_hash = NULL;
+    tree->staged_first = NULL;
+    tree->staged_last = NULL;
+    tree->nr_pending = 0;
+    tree->on_dupe = NULL;
+    tree->on_dupe_arg = NULL;
+
+#ifdef WAVL_TREE_STATS
+    tree->stats = (struct wavl_tree_stats){ 0 };
+#endif
+
+    return ret;
+}
+
+wavl_result_t wavl_tree_get_stats(struct wavl_tree *tree,
+                                  struct wavl_tree_stats *pstats)
+{
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != pstats);
+
+#ifdef WAVL_TREE_STATS
+    *pstats = tree->stats;
+    return WAVL_ERR_OK;
+#else
+    *pstats = (struct wavl_tree_stats){ 0 };
+    return WAVL_ERR_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * Fibonacci hashing multiplier: 2^64 divided by the golden ratio. Spreads the bits of a weak
+ * hash before a cache set is picked from it.
+ */
+#define WAVL_TREE_CACHE_MIX             0x9e3779b97f4a7c15ull
+
+/**
+ * Get the lookup cache set a hash maps to.
+ */
+static inline
+struct wavl_tree_cache_slot *__wavl_tree_cache_set(struct wavl_tree *tree,
+                                                   uint64_t hash)
+{
+    size_t set = (size_t)((hash * WAVL_TREE_CACHE_MIX) >> 32) & tree->cache_mask;
+
+    return &tree->cache[set * WAVL_TREE_CACHE_WAYS];
+}
+
+/**
+ * Put a node in the last slot of its lookup cache set, replacing the least recently used.
+ * It only moves to the front on a hit, so a burst of keys looked up once does not push out
+ * the keys that are looked up all the time.
+ */
+static inline
+void __wavl_tree_cache_fill(struct wavl_tree *tree,
+                            uint64_t hash,
+                            struct wavl_tree_node *node)
+{
+    struct wavl_tree_cache_slot *set = __wavl_tree_cache_set(tree, hash);
+
+    set[WAVL_TREE_CACHE_WAYS - 1].hash = hash;
+    set[WAVL_TREE_CACHE_WAYS - 1].node = node;
+}
+
+/**
+ * Drop a node from a lookup cache set, if it is there.
+ *
+ * \return true if the node was in the set.
+ */
+static inline
+bool __wavl_tree_cache_drop(struct wavl_tree_cache_slot *set,
+                            struct wavl_tree_node *node)
+{
+    for (size_t way = 0; way < WAVL_TREE_CACHE_WAYS; way++) {
+        if (node != set[way].node) {
+            continue;
+        }
+
+        for (; way + 1 < WAVL_TREE_CACHE_WAYS; way++) {
+            set[way] = set[way + 1];
+        }
+
+        set[WAVL_TREE_CACHE_WAYS - 1].node = NULL;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Drop a node from the lookup cache, if it is there.
+ */
+static inline
+void __wavl_tree_cache_forget(struct wavl_tree *tree,
+                              struct wavl_tree_node *node)
+{
+    if (NULL != tree->cache) {
+        __wavl_tree_cache_drop(__wavl_tree_cache_set(tree, tree->cache_node_hash(node)), node);
+    }
+}
+
+/**
+ * Empty the lookup cache.
+ */
+static inline
+void __wavl_tree_cache_flush(struct wavl_tree *tree)
+{
+    if (NULL != tree->cache) {
+        memset(tree->cache, 0, (tree->cache_mask + 1) * WAVL_TREE_CACHE_WAYS * sizeof(*tree->cache));
+    }
+}
+
+wavl_result_t wavl_tree_set_cache(struct wavl_tree *tree,
+                                  wavl_key_hash_func_t key_hash,
+                                  wavl_node_hash_func_t node_hash,
+                                  struct wavl_tree_cache_slot *slots,
+                                  size_t nr_slots)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+
+    if (NULL == slots) {
+        tree->cache = NULL;
+        tree->cache_mask = 0;
+        tree->cache_key_hash = NULL;
+        tree->cache_node_hash = NULL;
+        goto done;
+    }
+
+    WAVL_ASSERT_ARG(NULL != key_hash);
+    WAVL_ASSERT_ARG(NULL != node_hash);
+    WAVL_ASSERT_ARG(WAVL_TREE_CACHE_WAYS <= nr_slots && 0 == (nr_slots & (nr_slots - 1)));
+
+    tree->cache = slots;
+    tree->cache_mask = nr_slots / WAVL_TREE_CACHE_WAYS - 1;
+    tree->cache_key_hash = key_hash;
+    tree->cache_node_hash = node_hash;
+
+    __wavl_tree_cache_flush(tree);
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_tree_cache_forget(struct wavl_tree *tree,
+                                     struct wavl_tree_node *node)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != node);
+
+    __wavl_tree_cache_forget(tree, node);
 
     return ret;
 }
@@ -63,10 +251,14 @@ wavl_result_t wavl_tree_init(struct wavl_tree *tree,
  * Promote the given node's rank.
  */
 static inline
-void __wavl_tree_node_promote(struct wavl_tree_node *n)
+void __wavl_tree_node_promote(struct wavl_tree *tree, struct wavl_tree_node *n)
 {
+    WAVL_ASSERT(NULL != tree);
     WAVL_ASSERT(NULL != n);
 
+    WAVL_STAT_ADD(tree, promotions, 1);
+    WAVL_TRACE_EVENT(WAVL_TRACE_OP_PROMOTE, tree, n, n->rp, !n->rp);
+
     n->rp = !n->rp;
 }
 
@@ -74,19 +266,29 @@ void __wavl_tree_node_promote(struct wavl_tree_node *n)
  * Promote the given node's rank, twice.
  */
 static inline
-void __wavl_tree_node_double_promote(struct wavl_tree_node *n)
+void __wavl_tree_node_double_promote(struct wavl_tree *tree, struct wavl_tree_node *n)
 {
+    WAVL_ASSERT(NULL != tree);
     WAVL_ASSERT(NULL != n);
+
+    (void)n;
+
+    WAVL_STAT_ADD(tree, promotions, 2);
+    WAVL_TRACE_EVENT(WAVL_TRACE_OP_DOUBLE_PROMOTE, tree, n, n->rp, n->rp);
 }
 
 /**
  * Demote the given node's rank.
  */
 static inline
-void __wavl_tree_node_demote(struct wavl_tree_node *n)
+void __wavl_tree_node_demote(struct wavl_tree *tree, struct wavl_tree_node *n)
 {
+    WAVL_ASSERT(NULL != tree);
     WAVL_ASSERT(NULL != n);
 
+    WAVL_STAT_ADD(tree, demotions, 1);
+    WAVL_TRACE_EVENT(WAVL_TRACE_OP_DEMOTE, tree, n, n->rp, !n->rp);
+
     n->rp = !n->rp;
 }
 
@@ -94,9 +296,15 @@ void __wavl_tree_node_demote(struct wavl_tree_node *n)
  * Demote the given node's rank, twice.
  */
 static inline
-void __wavl_tree_node_double_demote(struct wavl_tree_node *n)
+void __wavl_tree_node_double_demote(struct wavl_tree *tree, struct wavl_tree_node *n)
 {
+    WAVL_ASSERT(NULL != tree);
     WAVL_ASSERT(NULL != n);
+
+    (void)n;
+
+    WAVL_STAT_ADD(tree, demotions, 2);
+    WAVL_TRACE_EVENT(WAVL_TRACE_OP_DOUBLE_DEMOTE, tree, n, n->rp, n->rp);
 }
 
 /**
@@ -142,11 +350,12 @@ void _wavl_tree_double_rotate_right_at(struct wavl_tree *tree,
                           *z = NULL,
                           *p_z = NULL;
 
-    WAVL_DEBUG_OUT("--> Double rotate right Tree %p node %p", tree, y);
-
     WAVL_ASSERT(NULL != tree);
     WAVL_ASSERT(NULL != y);
 
+    WAVL_STAT_INC(tree, double_rotations);
+    WAVL_TRACE_EVENT(WAVL_TRACE_OP_DOUBLE_ROTATE_RIGHT, tree, y, y->rp, y->rp);
+
     x = y->parent;
     WAVL_ASSERT(NULL != x);
     z = x->parent;
@@ -209,6 +418,9 @@ void _wavl_tree_rotate_right_at(struct wavl_tree *tree,
     WAVL_ASSERT(NULL != tree);
     WAVL_ASSERT(NULL != x);
 
+    WAVL_STAT_INC(tree, single_rotations);
+    WAVL_TRACE_EVENT(WAVL_TRACE_OP_ROTATE_RIGHT, tree, x, x->rp, x->rp);
+
     z = x->parent;
     y = x->right;
     p_z = z->parent;
@@ -250,11 +462,12 @@ void _wavl_tree_double_rotate_left_at(struct wavl_tree *tree,
                           *z = NULL,
                           *p_z = NULL;
 
-    WAVL_DEBUG_OUT("--> Double rotate left (tree %p node %p)", tree, y);
-
     WAVL_ASSERT(NULL != tree);
     WAVL_ASSERT(NULL != y);
 
+    WAVL_STAT_INC(tree, double_rotations);
+    WAVL_TRACE_EVENT(WAVL_TRACE_OP_DOUBLE_ROTATE_LEFT, tree, y, y->rp, y->rp);
+
     x = y->parent;
     WAVL_ASSERT(NULL != x);
     z = x->parent;
@@ -311,6 +524,9 @@ void _wavl_tree_rotate_left_at(struct wavl_tree *tree,
     WAVL_ASSERT(NULL != tree);
     WAVL_ASSERT(NULL != x);
 
+    WAVL_STAT_INC(tree, single_rotations);
+    WAVL_TRACE_EVENT(WAVL_TRACE_OP_ROTATE_LEFT, tree, x, x->rp, x->rp);
+
     z = x->parent;
     y = x->left;
     p_z = z->parent;
@@ -371,7 +587,7 @@ void _wavl_tree_insert_rebalance(struct wavl_tree *tree,
 
     do {
         /* Promote the current parent */
-        __wavl_tree_node_promote(p_x);
+        __wavl_tree_node_promote(tree, p_x);
 
         x = p_x;
         p_x = x->parent;
@@ -409,15 +625,15 @@ void _wavl_tree_insert_rebalance(struct wavl_tree *tree,
             /* If y is NULL or y is 2 distance (parities are equal), do a single rotation */
             _wavl_tree_rotate_right_at(tree, x);
             if (NULL != z) {
-                __wavl_tree_node_demote(z);
+                __wavl_tree_node_demote(tree, z);
             }
         } else {
             /* Perform a double right rotation to restore rank rule */
             _wavl_tree_double_rotate_right_at(tree, y);
-            __wavl_tree_node_promote(y);
-            __wavl_tree_node_demote(x);
+            __wavl_tree_node_promote(tree, y);
+            __wavl_tree_node_demote(tree, x);
             if (NULL != z) {
-                __wavl_tree_node_demote(z);
+                __wavl_tree_node_demote(tree, z);
             }
         }
     } else {
@@ -427,15 +643,15 @@ void _wavl_tree_insert_rebalance(struct wavl_tree *tree,
             /* Perform a single rotation */
             _wavl_tree_rotate_left_at(tree, x);
             if (NULL != z) {
-                __wavl_tree_node_demote(z);
+                __wavl_tree_node_demote(tree, z);
             }
         } else {
             /* Perform a double-left rotation to restore the rank rule */
             _wavl_tree_double_rotate_left_at(tree, y);
-            __wavl_tree_node_promote(y);
-            __wavl_tree_node_demote(x);
+            __wavl_tree_node_promote(tree, y);
+            __wavl_tree_node_demote(tree, x);
             if (NULL != z) {
-                __wavl_tree_node_demote(z);
+                __wavl_tree_node_demote(tree, z);
             }
         }
     }
@@ -443,75 +659,180 @@ void _wavl_tree_insert_rebalance(struct wavl_tree *tree,
 }
 
 
+/**
+ * Stitch a new node into the tree as the child of parent, on the side given by dir, and
+ * rebalance. If parent is NULL, the node becomes the root of the (empty) tree.
+ *
+ * \param tree The tree
+ * \param parent The node to become the parent of the new node
+ * \param dir Negative to insert as the left child of parent, positive for the right child
+ * \param node The node to insert
+ */
+static
+void _wavl_tree_insert_at(struct wavl_tree *tree,
+                          struct wavl_tree_node *parent,
+                          int dir,
+                          struct wavl_tree_node *node)
+{
+    bool was_leaf = false;
+
+    WAVL_ASSERT(NULL != tree);
+    WAVL_ASSERT(NULL != node);
+
+    node->left = node->right = NULL;
+    node->parent = parent;
+
+    /* Set initial rank parity (freshly inserted nodes are 0-children) */
+    node->rp = false;
+    node->pending = false;
+
+    /* Check if this is an empty tree */
+    if (NULL == parent) {
+        /* Put the node in as the root */
+        tree->root = tree->leftmost = tree->rightmost = node;
+        return;
+    }
+
+    /* A new left child of the minimum (or right child of the maximum) replaces it */
+    if (dir < 0 && parent == tree->leftmost) {
+        tree->leftmost = node;
+    } else if (dir > 0 && parent == tree->rightmost) {
+        tree->rightmost = node;
+    }
+
+    was_leaf = __wavl_tree_node_is_leaf(parent);
+
+    /* Stitch in the node */
+    if (dir < 0) {
+        WAVL_ASSERT(NULL == parent->left);
+        parent->left = node;
+    } else {
+        WAVL_ASSERT(NULL == parent->right);
+        parent->right = node;
+    }
+
+    /* Rebalance after insertion */
+    if (true == was_leaf) {
+        /* We just made a leaf into a unary node, we need to rebalance now */
+        _wavl_tree_insert_rebalance(tree, node);
+    }
+}
+
+/**
+ * Stage a node in a tree in relaxed-balance mode, by appending it to the list of staged
+ * items. The list is threaded through the left (previous) and right (next) links.
+ */
+static inline
+void __wavl_tree_stage(struct wavl_tree *tree,
+                       struct wavl_tree_node *node)
+{
+    node->left = tree->staged_last;
+    node->right = NULL;
+    node->parent = NULL;
+    node->rp = false;
+    node->pending = true;
+
+    if (NULL != tree->staged_last) {
+        tree->staged_last->right = node;
+    } else {
+        tree->staged_first = node;
+    }
+
+    tree->staged_last = node;
+    tree->nr_pending++;
+}
+
+/**
+ * Take a node off the list of staged items.
+ */
+static inline
+void __wavl_tree_unstage(struct wavl_tree *tree,
+                         struct wavl_tree_node *node)
+{
+    if (NULL != node->left) {
+        node->left->right = node->right;
+    } else {
+        tree->staged_first = node->right;
+    }
+
+    if (NULL != node->right) {
+        node->right->left = node->left;
+    } else {
+        tree->staged_last = node->left;
+    }
+
+    node->left = node->right = NULL;
+    node->pending = false;
+    tree->nr_pending--;
+}
+
+/**
+ * Move every item staged in relaxed-balance mode into the tree. Queries call this first, so
+ * that they see the staged items; it costs one test when nothing is staged.
+ */
+static inline
+wavl_result_t __wavl_tree_settle(struct wavl_tree *tree)
+{
+    return 0 == tree->nr_pending ? WAVL_ERR_OK : wavl_tree_rebalance_step(tree, SIZE_MAX);
+}
+
 wavl_result_t wavl_tree_insert(struct wavl_tree *tree,
                                void *key,
                                struct wavl_tree_node *node)
 {
     wavl_result_t ret = WAVL_ERR_OK;
 
-    struct wavl_tree_node *parent = NULL;
+    struct wavl_tree_node *parent = NULL,
+                          *cur = NULL;
 
-    bool was_leaf = false;
+    int dir = -1;
+
+    size_t path_len __attribute__((unused)) = 0;
 
     WAVL_ASSERT_ARG(NULL != tree);
     WAVL_ASSERT_ARG(NULL != node);
 
-    node->left = node-> right = NULL;
-
-    /* Set initial rank parity (freshly inserted nodes are 0-children) */
-    node->rp = false;
-
-    /* Check if this is an empty tree */
-    if (NULL == tree->root) {
-        /* Put the node in as the root */
-        tree->root = node;
+    if (NULL != tree->on_dupe) {
+        /* Relaxed mode: only stage the node. The step that moves it in checks for a duplicate. */
+        __wavl_tree_stage(tree, node);
         goto done;
     }
 
     /* Hunt for a candidate leaf to insert this node in */
-    parent = tree->root;
+    cur = tree->root;
 
-    while (NULL != parent) {
-        int dir = -1;
+    while (NULL != cur) {
+        WAVL_STAT_INC(tree, compares);
+        path_len++;
 
-        if (WAVL_FAILED(ret = tree->key_cmp(tree, key, parent, &dir))) {
+        if (WAVL_FAILED(ret = tree->key_cmp(tree, key, cur, &dir))) {
             goto done;
         }
 
-        if (dir < 0) {
-            if (NULL == parent->left) {
-                was_leaf = parent->left == NULL && parent->right == NULL;
-                /* Stitch in the node and break */
-                parent->left = node;
-                node->parent = parent;
-                break;
-            } else {
-                parent = parent->left;
-            }
-        } else if (dir > 0) {
-            if (NULL == parent->right) {
-                was_leaf = parent->left == NULL && parent->right == NULL;
-                /* Stitch in the node and break */
-                parent->right = node;
-                node->parent = parent;
-                break;
-            } else {
-                parent = parent->right;
+        if (0 == dir) {
+            if (0 == (tree->flags & WAVL_TREE_FLAG_MULTI)) {
+                /* Leave the tree unchanged - this node is a duplicate */
+                ret = WAVL_ERR_TREE_DUPE;
+                goto done;
             }
-        } else {
-            /* Leave the tree unchanged - this node is a duplicate */
-            ret = WAVL_ERR_TREE_DUPE;
-            goto done;
+
+            /* Equal keys go after the existing ones, so they stay in insertion order */
+            dir = 1;
         }
-    }
 
-    /* Rebalance after insertion */
-    if (true == was_leaf) {
-        /* We just made a leaf into a unary node, we need to rebalance now */
-        _wavl_tree_insert_rebalance(tree, node);
+        parent = cur;
+        cur = dir < 0 ? cur->left : cur->right;
     }
 
+    WAVL_STAT_MAX(tree, max_path_len, path_len);
+
+    _wavl_tree_insert_at(tree, parent, dir, node);
+
 done:
+    if (WAVL_OK(ret)) {
+        WAVL_STAT_INC(tree, inserts);
+    }
+
     return ret;
 }
 
@@ -523,17 +844,64 @@ wavl_result_t wavl_tree_find(struct wavl_tree *tree,
 
     struct wavl_tree_node *next = NULL;
 
+    size_t path_len __attribute__((unused)) = 0;
+
+    uint64_t hash = 0;
+
     WAVL_ASSERT_ARG(NULL != tree);
     WAVL_ASSERT_ARG(NULL != key);
     WAVL_ASSERT_ARG(NULL != pfound);
 
     *pfound = NULL;
 
+    if (WAVL_FAILED(ret = __wavl_tree_settle(tree))) {
+        goto done;
+    }
+
+    if (NULL != tree->cache) {
+        struct wavl_tree_cache_slot *set = NULL;
+
+        hash = tree->cache_key_hash(key);
+        set = __wavl_tree_cache_set(tree, hash);
+
+        for (size_t way = 0; way < WAVL_TREE_CACHE_WAYS; way++) {
+            struct wavl_tree_cache_slot hit = set[way];
+            int dir = -1;
+
+            if (NULL == hit.node || hash != hit.hash) {
+                continue;
+            }
+
+            WAVL_STAT_INC(tree, compares);
+
+            if (WAVL_FAILED(ret = tree->key_cmp(tree, key, hit.node, &dir))) {
+                goto done;
+            }
+
+            if (0 == dir) {
+                /* Move the hit to the front of its set */
+                for (; way > 0; way--) {
+                    set[way] = set[way - 1];
+                }
+                set[0] = hit;
+
+                WAVL_STAT_INC(tree, cache_hits);
+                *pfound = hit.node;
+                goto done;
+            }
+        }
+
+        WAVL_STAT_INC(tree, cache_misses);
+    }
+
     next = tree->root;
 
     while (NULL != next) {
         int dir = -1;
 
+        WAVL_STAT_INC(tree, compares);
+        path_len++;
+
         if (WAVL_FAILED(ret = tree->key_cmp(tree, key, next, &dir))) {
             goto done;
         }
@@ -543,6 +911,10 @@ wavl_result_t wavl_tree_find(struct wavl_tree *tree,
         } else if (dir > 0) {
             next = next->right;
         } else {
+            if (NULL != tree->cache) {
+                __wavl_tree_cache_fill(tree, hash, next);
+            }
+
             *pfound = next;
             goto done;
         }
@@ -551,339 +923,2267 @@ wavl_result_t wavl_tree_find(struct wavl_tree *tree,
     ret = WAVL_ERR_TREE_NOT_FOUND;
 
 done:
+    WAVL_STAT_MAX(tree, max_path_len, path_len);
     return ret;
 }
 
 /**
- * Non-exported function to find the minimum of the subtree rooted at the specified node.
+ * Find the first (or last) node with a key equal to the given key.
+ *
+ * \param tree The tree
+ * \param key The key to search for
+ * \param last_dir -1 to find the first equal node, 1 to find the last
+ * \param pfound The node found, returned by reference. NULL if there is none.
+ *
+ * \return WAVL_ERR_OK, or the error returned by the key comparison function.
  */
 static
-struct wavl_tree_node *_wavl_tree_find_minimum_at(struct wavl_tree_node *node)
+wavl_result_t _wavl_tree_find_edge(struct wavl_tree *tree,
+                                   void *key,
+                                   int last_dir,
+                                   struct wavl_tree_node **pfound)
 {
-    struct wavl_tree_node *cur = node;
+    wavl_result_t ret = WAVL_ERR_OK;
 
-    while (NULL != cur->left) {
-        cur = cur->left;
+    struct wavl_tree_node *cur = tree->root;
+
+    size_t path_len __attribute__((unused)) = 0;
+
+    *pfound = NULL;
+
+    while (NULL != cur) {
+        int dir = -1;
+
+        WAVL_STAT_INC(tree, compares);
+        path_len++;
+
+        if (WAVL_FAILED(ret = tree->key_cmp(tree, key, cur, &dir))) {
+            goto done;
+        }
+
+        if (0 == dir) {
+            /* Keep going, looking for an equal node further toward the edge */
+            *pfound = cur;
+            dir = last_dir;
+        }
+
+        cur = dir < 0 ? cur->left : cur->right;
     }
 
-    return cur;
+done:
+    WAVL_STAT_MAX(tree, max_path_len, path_len);
+    return ret;
 }
 
-/**
- * Swap the new node in for the old node, effectively splicing in the new node.
- *
- * \param tree The tree
- * \param parent The parent of the old node/to be parent of new node
- * \param old The old node (to be removed)
- * \param new The new node (to be swapped in)
- */
-static
-void _wavl_tree_swap_in_node_at(struct wavl_tree *tree,
-                                struct wavl_tree_node *old,
-                                struct wavl_tree_node *new)
+wavl_result_t wavl_tree_equal_range(struct wavl_tree *tree,
+                                    void *key,
+                                    struct wavl_tree_node **pfirst,
+                                    struct wavl_tree_node **plast)
 {
-    struct wavl_tree_node *left = old->left,
-                          *right = old->right,
-                          *parent = old->parent;;
+    wavl_result_t ret = WAVL_ERR_OK;
 
-    new->parent = parent;
-    if (NULL != parent) {
-        /* Update the parent to point to the new node */
-        if (parent->left == old) {
-            parent->left = new;
-        } else {
-            parent->right = new;
-        }
-    } else {
-        /* The old node is at the root */
-        tree->root = new;
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != key);
+    WAVL_ASSERT_ARG(NULL != pfirst);
+    WAVL_ASSERT_ARG(NULL != plast);
+
+    *pfirst = NULL;
+    *plast = NULL;
+
+    if (WAVL_FAILED(ret = __wavl_tree_settle(tree))) {
+        goto done;
     }
 
-    new->right = right;
-    if (NULL != new->right) {
-        struct wavl_tree_node *right_new = new->right;
-        right_new->parent = new;
+    if (WAVL_FAILED(ret = _wavl_tree_find_edge(tree, key, -1, pfirst))) {
+        goto done;
     }
-    old->right = NULL;
 
-    new->left = left;
-    if (NULL != new->left) {
-        struct wavl_tree_node *left_new = new->left;
-        left_new->parent = new;
+    if (NULL == *pfirst) {
+        ret = WAVL_ERR_TREE_NOT_FOUND;
+        goto done;
     }
-    old->left = NULL;
 
-    /* Swap in the parity of the old node in to the new node */
-    new->rp = old->rp;
+    if (0 == (tree->flags & WAVL_TREE_FLAG_MULTI)) {
+        *plast = *pfirst;
+        goto done;
+    }
 
-    old->parent = NULL;
+    if (WAVL_FAILED(ret = _wavl_tree_find_edge(tree, key, 1, plast))) {
+        *pfirst = NULL;
+        goto done;
+    }
+
+done:
+    return ret;
 }
 
 /**
- * Rebalance the tree after removing the node, where p_x is the parent of the removed node,
- * and x is the node that was promoted or spliced in.
- *
- * Handle the specific case where a 2 child was removed, resulting in a 3-child.
+ * Climb from the finger to the lowest ancestor whose subtree contains the position of the
+ * key. Going up, an ancestor reached from its left child bounds the subtree from above, and
+ * one reached from its right child bounds it from below. The climb stops at the first bound
+ * on the side of the finger that the key is on, which the key does not pass.
  *
- * \param tree The tree we are updating
- * \param n The node that replaced the removed node.
- * \param p_n The parent of the removed node.
+ * \param tree The tree
+ * \param finger The node to start from
+ * \param key The key to search for
+ * \param eq_dir 0 to stop at a node with an equal key. Otherwise, the direction to treat an
+ *               equal key as (1 to find the position after all equal keys).
+ * \param pstart The node to descend from, returned by reference
+ * \param ppath_len Incremented for each node compared
  *
- * Note that the rank difference between n and p_n is 3 at entry to this function.
+ * \return WAVL_ERR_OK, or the error returned by the key comparison function.
  */
 static
-void _wavl_tree_delete_rebalance_3_child(struct wavl_tree *tree,
-                                         struct wavl_tree_node *n,
-                                         struct wavl_tree_node *p_n)
+wavl_result_t _wavl_tree_climb_from(struct wavl_tree *tree,
+                                    struct wavl_tree_node *finger,
+                                    void *key,
+                                    int eq_dir,
+                                    struct wavl_tree_node **pstart,
+                                    size_t *ppath_len)
 {
-    struct wavl_tree_node *x = NULL,
-                          *p_x = NULL,
-                          *y = NULL;
-    bool creates_3_node = false,
-         done = true;
-
-    WAVL_ASSERT(NULL != tree);
-    WAVL_ASSERT(NULL != p_n);
+    wavl_result_t ret = WAVL_ERR_OK;
 
-    WAVL_DEBUG_OUT("---> 3 Child rebalance: Tree %p, node %p parent %p", tree, n, p_n);
+    struct wavl_tree_node *cur = finger,
+                          *parent = NULL;
+    int dir = 0;
 
-    /* Start with rebalancing X */
-    x = n;
-    p_x = p_n;
+    WAVL_STAT_INC(tree, compares);
+    (*ppath_len)++;
 
-    /*
-     * By the conventions in the paper:
-     * - x is a 3-child of p_x
-     * - p_x is the parent that we might need in rebalancing
-     * - y is the sibling of x
-     */
+    if (WAVL_FAILED(ret = tree->key_cmp(tree, key, finger, &dir))) {
+        goto done;
+    }
 
-    do {
-        struct wavl_tree_node *p_p_x = p_x->parent;
-        y = p_x->left == x ? p_x->right : p_x->left;
+    if (0 == dir) {
+        if (0 == eq_dir) {
+            goto done;
+        }
 
-        /* Check if the next step will create a 3-node of P(x) */
-        creates_3_node = p_p_x != NULL &&
-            __wavl_tree_node_get_parity(p_x) == __wavl_tree_node_get_parity(p_p_x);
+        dir = eq_dir;
+    }
 
-        /* Figure out which demote case we have */
-        if (__wavl_tree_node_is_2_child(y, p_x)) {
-            /* y is a 2-child, x is a 3 child, simply demote the parent */
-            __wavl_tree_node_demote(p_x);
-        } else {
-            bool y_rank_parity = __wavl_tree_node_get_parity(y);
-            if (y_rank_parity == __wavl_tree_node_get_parity(y->left) &&
-                y_rank_parity == __wavl_tree_node_get_parity(y->right))
-            {
-                /* p_x is 3,1 Y (a 1-child) is 2, 2, so we can demote p_x and y */
-                __wavl_tree_node_demote(p_x);
-                __wavl_tree_node_demote(y);
-            } else {
-                done = false;
-                break;
-            }
-        }
+    while (NULL != (parent = cur->parent)) {
+        bool from_left = parent->left == cur;
 
-        /* Keep climbing the tree */
-        x = p_x;
-        p_x = p_p_x;
-    } while (NULL != p_x && true == creates_3_node);
+        if (from_left == (dir > 0)) {
+            int parent_dir = 0;
 
-    if (true == done) {
-        /* We're done, there should be no more violations of the WAVL constraint */
-        return;
-    }
+            WAVL_STAT_INC(tree, compares);
+            (*ppath_len)++;
 
-    /* Otherwise, perform rotations needed to restore balance */
-    struct wavl_tree_node *z = p_x;
-    if (x == p_x->left) {
-        struct wavl_tree_node *w = y->right;
-        if (__wavl_tree_node_get_parity(w) != __wavl_tree_node_get_parity(y)) {
-            /* w is a 1-child of y */
-            _wavl_tree_rotate_left_at(tree, y);
-            __wavl_tree_node_promote(y);
-            __wavl_tree_node_demote(z);
-            if (__wavl_tree_node_is_leaf(z)) {
-                __wavl_tree_node_demote(z);
+            if (WAVL_FAILED(ret = tree->key_cmp(tree, key, parent, &parent_dir))) {
+                goto done;
             }
-        } else {
-            struct wavl_tree_node *v = y->left;
-            /* w is a 2-child of y, thus v must be a 1-child */
-            WAVL_ASSERT(__wavl_tree_node_get_parity(y) != __wavl_tree_node_get_parity(v));
 
-            _wavl_tree_double_rotate_left_at(tree, v);
-            __wavl_tree_node_double_promote(v);
-            __wavl_tree_node_demote(y);
-            __wavl_tree_node_double_demote(z);
-        }
-    } else {
-        struct wavl_tree_node *w = y->left;
-        if (__wavl_tree_node_get_parity(w) != __wavl_tree_node_get_parity(y)) {
-            /* w is a 1-child of y */
-            _wavl_tree_rotate_right_at(tree, y);
-            __wavl_tree_node_promote(y);
-            __wavl_tree_node_demote(z);
-            if (__wavl_tree_node_is_leaf(z)) {
-                __wavl_tree_node_demote(z);
+            if (0 == parent_dir) {
+                if (0 == eq_dir) {
+                    cur = parent;
+                    break;
+                }
+
+                parent_dir = eq_dir;
             }
-        } else {
-            struct wavl_tree_node *v = y->right;
-            WAVL_ASSERT(__wavl_tree_node_get_parity(y) != __wavl_tree_node_get_parity(v));
 
-            _wavl_tree_double_rotate_right_at(tree, v);
-            __wavl_tree_node_double_promote(v);
-            __wavl_tree_node_demote(y);
-            __wavl_tree_node_double_demote(z);
+            if ((parent_dir < 0) == from_left) {
+                /* The key is between the finger and this bound */
+                break;
+            }
         }
+
+        cur = parent;
     }
+
+done:
+    *pstart = cur;
+    return ret;
 }
 
 /**
- * Deletion created a 2,2 leaf at leaf. Fix up the leaf, and figure out
- * where that leaves us.
+ * Search for the key in the subtree rooted at start.
+ *
+ * \param tree The tree
+ * \param start The root of the subtree to search
+ * \param key The key to search for
+ * \param eq_dir 0 to stop at a node with an equal key, otherwise the direction to go from it
+ * \param pparent The last node visited, returned by reference. NULL if start is NULL.
+ * \param pdir The result of the last comparison, returned by reference
+ * \param ppath_len Incremented for each node compared
+ * \param pret WAVL_ERR_OK, or the error returned by the key comparison function
+ *
+ * \return The node matching the key, or NULL if there is none (or on error).
  */
 static
-void _wavl_tree_delete_rebalance_2_2_leaf(struct wavl_tree *tree,
-                                          struct wavl_tree_node *leaf)
+struct wavl_tree_node *_wavl_tree_search_at(struct wavl_tree *tree,
+                                            struct wavl_tree_node *start,
+                                            void *key,
+                                            int eq_dir,
+                                            struct wavl_tree_node **pparent,
+                                            int *pdir,
+                                            size_t *ppath_len,
+                                            wavl_result_t *pret)
 {
-    struct wavl_tree_node *x = leaf;
+    struct wavl_tree_node *cur = start,
+                          *parent = NULL;
+    int dir = -1;
 
-    WAVL_ASSERT(NULL != tree);
-    WAVL_ASSERT(NULL != leaf);
+    *pret = WAVL_ERR_OK;
 
-    /* Check if x is a 2-child of P(x) */
-    if (__wavl_tree_node_get_parity(x->parent) == __wavl_tree_node_get_parity(x)) {
-        /* The leaf was a 2-child, so we will need to kick off the 3,1/1,3 rebalancing */
-        __wavl_tree_node_demote(x);
+    while (NULL != cur) {
+        WAVL_STAT_INC(tree, compares);
+        (*ppath_len)++;
 
-        /* p_x is now a 3-child, so we need to proceed with a normal 3-child rebalance */
-        _wavl_tree_delete_rebalance_3_child(tree, x, x->parent);
-    } else {
-        /* Just demote the leaf and carry on (leaf is now a 2-child) */
-        __wavl_tree_node_demote(x);
+        if (WAVL_FAILED(*pret = tree->key_cmp(tree, key, cur, &dir))) {
+            break;
+        }
+
+        if (0 == dir) {
+            if (0 == eq_dir) {
+                break;
+            }
+
+            dir = eq_dir;
+        }
+
+        parent = cur;
+        cur = dir < 0 ? cur->left : cur->right;
     }
-}
 
+    *pparent = parent;
+    *pdir = dir;
 
-/**
- * Remove the given node from the tree.
- *
- * While insertion and search are pretty straightforward, removal is a bit more work.
- *
- * We need to consider 3 cases during removal from a binary search tree
- * 1. Where the node has no children (just delete it) - a leaf node
- * 2. Where the node has one child subtree (left or right - promote the child) - unary node
- * 3. Where the node has two children - binary node
- *
- * For the third case, we need to find the appropriate replacement for the node we are
- * deleting, which is effectively the successor (next) node to the node we are deleting.
- * We promote the successor to current node's position. The successor is usually a unary
- * node or a leaf.
- *
- * When we splice in the replacement node in case 3, we need to track where we removed the
- * successor node from. The spliced in node takes on the exact same rank as the removed
- * node.
- *
- * Once we have a candidate node, we have to start rebalancing. To start the rebalancing
- * process off, we need to consider, if the node removed:
- *  * was a leaf, and 1-child of a unary node, we have a 2,2 leaf to fix
- *  * was a 2-child of a node
- */
-wavl_result_t wavl_tree_remove(struct wavl_tree *tree,
-                               struct wavl_tree_node *node)
+    return WAVL_OK(*pret) ? cur : NULL;
+}
+
+wavl_result_t wavl_tree_find_from(struct wavl_tree *tree,
+                                  struct wavl_tree_node *finger,
+                                  void *key,
+                                  struct wavl_tree_node **pfound)
 {
     wavl_result_t ret = WAVL_ERR_OK;
 
-    struct wavl_tree_node *y = NULL,
-                          *x = NULL,
-                          *p_y = NULL;
+    struct wavl_tree_node *start = NULL,
+                          *parent = NULL;
+    int dir = -1;
 
-    bool is_2_child = false;
+    size_t path_len __attribute__((unused)) = 0;
 
     WAVL_ASSERT_ARG(NULL != tree);
-    WAVL_ASSERT_ARG(NULL != node);
+    WAVL_ASSERT_ARG(NULL != key);
+    WAVL_ASSERT_ARG(NULL != pfound);
 
-    /* Figure out which node we need to splice in, replacing node */
-    if (NULL == node->left || NULL == node->right) {
-        y = node;
-    } else {
-        /* Find the minimum of the right subtree of the node to be deleted, to
-         * find the replacement for node. We'll need to fix up the tree at the
-         * original location of y.
-         */
-        y = _wavl_tree_find_minimum_at(node->right);
+    *pfound = NULL;
+
+    /* This also moves a staged finger into the tree, so that it can be climbed from */
+    if (WAVL_FAILED(ret = __wavl_tree_settle(tree))) {
+        goto done;
     }
 
-    /* Find the child of the node to splice we will move up */
-    if (NULL != y->left) {
-        x = y->left;
-    } else {
-        x = y->right;
+    if (NULL == finger) {
+        return wavl_tree_find(tree, key, pfound);
     }
 
-    /* Splice in the child of the node to be removed */
-    if (NULL != x) {
-        x->parent = y->parent;
+    if (WAVL_FAILED(ret = _wavl_tree_climb_from(tree, finger, key, 0, &start, &path_len))) {
+        goto done;
     }
 
-    p_y = y->parent;
-    if (NULL == p_y) {
-        /* We're deleting the root, so swap in the new candidate */
-        tree->root = x;
-    } else {
-        /* Check if y is a 2-child of its parent */
-        is_2_child = __wavl_tree_node_is_2_child(y, p_y);
+    *pfound = _wavl_tree_search_at(tree, start, key, 0, &parent, &dir, &path_len, &ret);
 
-        /* Ensure the right/left pointer of the parent of the node to
-         * be spliced out points to its new child
-         */
-        if (y == p_y->left) {
-            p_y->left = x;
-        } else {
-            WAVL_ASSERT(p_y->right == y);
-            p_y->right = x;
-        }
+    if (WAVL_OK(ret) && NULL == *pfound) {
+        ret = WAVL_ERR_TREE_NOT_FOUND;
     }
 
-    /*
-     * At this point, y is either a node to splice in to replace the node to be deleted, or is
-     * the deleted node itself. If y is a node to splice in, do so now.
-     */
-    if (y != node) {
-        _wavl_tree_swap_in_node_at(tree, node, y);
-        if (node == p_y) {
-            p_y = y;
-        }
-    }
+done:
+    WAVL_STAT_MAX(tree, max_path_len, path_len);
+    return ret;
+}
 
-    /*
-     * x is the new child we spliced in. p_y is its new parent. Fix up the tree so the wavl
-     * constraints are restored.
-     *
-     * We know we have to restore constraints if:
-     *  * y was a 2-child of p_y (note that x is NULL in this case)
-     *  * y was a leaf, 1-child of p_y; p_y is unary.
-     */
-    if (NULL != p_y) {
-        if (true == is_2_child) {
-            /* x is a 3-child of p_y, so we need to start handling that caase */
-            _wavl_tree_delete_rebalance_3_child(tree, x, p_y);
+wavl_result_t wavl_tree_insert_from(struct wavl_tree *tree,
+                                    struct wavl_tree_node *finger,
+                                    void *key,
+                                    struct wavl_tree_node *node)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
 
-        } else if (NULL == x && p_y->left == p_y->right) {
-            /* p_y is a 2,2 leaf, so we need to fix it up and figure out if this
-             * will result in p_y becoming a 3-child
-             */
-            _wavl_tree_delete_rebalance_2_2_leaf(tree, p_y);
-        }
+    struct wavl_tree_node *start = NULL,
+                          *parent = NULL;
+    int dir = -1,
+        eq_dir = 0;
+
+    size_t path_len __attribute__((unused)) = 0;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != node);
+
+    /* In relaxed mode, the node is only staged, so there is no place to search for */
+    if (NULL == finger || NULL != tree->on_dupe) {
+        return wavl_tree_insert(tree, key, node);
+    }
+
+    /* Equal keys go after the existing ones, as for wavl_tree_insert */
+    if (0 != (tree->flags & WAVL_TREE_FLAG_MULTI)) {
+        eq_dir = 1;
+    }
+
+    if (WAVL_FAILED(ret = _wavl_tree_climb_from(tree, finger, key, eq_dir, &start, &path_len))) {
+        goto done;
+    }
+
+    if (NULL != _wavl_tree_search_at(tree, start, key, eq_dir, &parent, &dir, &path_len, &ret)) {
+        ret = WAVL_ERR_TREE_DUPE;
+        goto done;
+    }
+
+    if (WAVL_FAILED(ret)) {
+        goto done;
+    }
+
+    WAVL_STAT_MAX(tree, max_path_len, path_len);
+
+    _wavl_tree_insert_at(tree, parent, dir, node);
+    WAVL_STAT_INC(tree, inserts);
+
+done:
+    return ret;
+}
+
+#ifdef WAVL_TREE_INLINE_KEY
+/**
+ * Compare an inline key prefix (and, on a tie, the full key) to a node.
+ */
+static inline
+wavl_result_t __wavl_tree_u64_compare(struct wavl_tree *tree,
+                                      uint64_t prefix,
+                                      void *key,
+                                      struct wavl_tree_node *node,
+                                      int *pdir)
+{
+    if (prefix != node->key) {
+        *pdir = prefix < node->key ? -1 : 1;
+        return WAVL_ERR_OK;
+    }
+
+    if (NULL == key) {
+        *pdir = 0;
+        return WAVL_ERR_OK;
+    }
+
+    WAVL_STAT_INC(tree, compares);
+
+    return tree->key_cmp(tree, key, node, pdir);
+}
+#endif /* defined(WAVL_TREE_INLINE_KEY) */
+
+wavl_result_t wavl_tree_insert_u64(struct wavl_tree *tree,
+                                   uint64_t prefix,
+                                   void *key,
+                                   struct wavl_tree_node *node)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != node);
+
+#ifdef WAVL_TREE_INLINE_KEY
+    struct wavl_tree_node *parent = NULL,
+                          *cur = tree->root;
+
+    int dir = -1;
+
+    size_t path_len __attribute__((unused)) = 0;
+
+    if (NULL != tree->on_dupe) {
+        /* Relaxed mode: stage the node, as wavl_tree_insert does */
+        node->key = prefix;
+        __wavl_tree_stage(tree, node);
+        WAVL_STAT_INC(tree, inserts);
+        goto done;
+    }
+
+    while (NULL != cur) {
+        path_len++;
+
+        if (WAVL_FAILED(ret = __wavl_tree_u64_compare(tree, prefix, key, cur, &dir))) {
+            goto done;
+        }
+
+        if (0 == dir) {
+            ret = WAVL_ERR_TREE_DUPE;
+            goto done;
+        }
+
+        parent = cur;
+        cur = dir < 0 ? cur->left : cur->right;
+    }
+
+    WAVL_STAT_MAX(tree, max_path_len, path_len);
+
+    node->key = prefix;
+    _wavl_tree_insert_at(tree, parent, dir, node);
+    WAVL_STAT_INC(tree, inserts);
+
+done:
+    return ret;
+#else
+    (void)prefix;
+    (void)key;
+    ret = WAVL_ERR_NOT_SUPPORTED;
+    return ret;
+#endif
+}
+
+wavl_result_t wavl_tree_find_u64(struct wavl_tree *tree,
+                                 uint64_t prefix,
+                                 void *key,
+                                 struct wavl_tree_node **pfound)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != pfound);
+
+    *pfound = NULL;
+
+#ifdef WAVL_TREE_INLINE_KEY
+    struct wavl_tree_node *cur = NULL;
+
+    size_t path_len __attribute__((unused)) = 0;
+
+    if (WAVL_FAILED(ret = __wavl_tree_settle(tree))) {
+        goto done;
+    }
+
+    cur = tree->root;
+
+    while (NULL != cur) {
+        int dir = -1;
+
+        path_len++;
+
+        if (WAVL_FAILED(ret = __wavl_tree_u64_compare(tree, prefix, key, cur, &dir))) {
+            goto done;
+        }
+
+        if (0 == dir) {
+            *pfound = cur;
+            goto done;
+        }
+
+        cur = dir < 0 ? cur->left : cur->right;
+    }
+
+    ret = WAVL_ERR_TREE_NOT_FOUND;
+
+done:
+    WAVL_STAT_MAX(tree, max_path_len, path_len);
+    return ret;
+#else
+    (void)prefix;
+    (void)key;
+    ret = WAVL_ERR_NOT_SUPPORTED;
+    return ret;
+#endif
+}
+
+/**
+ * Find the offset of the first byte that differs between a and b, or len if the first len
+ * bytes are the same.
+ */
+static inline
+size_t __wavl_bytes_mismatch(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    for (; i + 32 <= len; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i)),
+                vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        uint32_t neq = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+
+        if (0 != neq) {
+            return i + __builtin_ctz(neq);
+        }
+    }
+#endif
+
+#if defined(__SSE2__)
+    for (; i + 16 <= len; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i)),
+                vb = _mm_loadu_si128((const __m128i *)(b + i));
+        uint32_t neq = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xffff;
+
+        if (0 != neq) {
+            return i + __builtin_ctz(neq);
+        }
+    }
+#endif
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + 8 <= len; i += 8) {
+        uint64_t wa, wb;
+
+        memcpy(&wa, a + i, sizeof(wa));
+        memcpy(&wb, b + i, sizeof(wb));
+
+        if (wa != wb) {
+            return i + (__builtin_ctzll(wa ^ wb) >> 3);
+        }
+    }
+#endif
+
+    for (; i < len; i++) {
+        if (a[i] != b[i]) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+/**
+ * Compare two byte-string keys, given that their first skip bytes are known to be equal.
+ * Returns the length of the prefix the keys have in common by reference.
+ */
+static inline
+int __wavl_bytes_compare(const uint8_t *lhs, size_t lhs_len,
+                         const uint8_t *rhs, size_t rhs_len,
+                         size_t skip,
+                         size_t *pcommon)
+{
+    size_t len = lhs_len < rhs_len ? lhs_len : rhs_len,
+           i = 0;
+
+    WAVL_ASSERT(skip <= len);
+
+    i = skip;
+    if (i < len) {
+        i += __wavl_bytes_mismatch(lhs + i, rhs + i, len - i);
+    }
+
+    *pcommon = i;
+
+    if (i < len) {
+        return (int)lhs[i] - (int)rhs[i];
+    }
+
+    return lhs_len < rhs_len ? -1 : (lhs_len > rhs_len ? 1 : 0);
+}
+
+static
+wavl_result_t _wavl_tree_bytes_node_cmp(struct wavl_tree *tree,
+                                        struct wavl_tree_node *lhs,
+                                        struct wavl_tree_node *rhs,
+                                        int *pdir)
+{
+    struct wavl_bytes lhs_key = tree->node_bytes(lhs),
+                      rhs_key = tree->node_bytes(rhs);
+    size_t common = 0;
+
+    *pdir = __wavl_bytes_compare(lhs_key.ptr, lhs_key.len, rhs_key.ptr, rhs_key.len, 0, &common);
+
+    return WAVL_ERR_OK;
+}
+
+static
+wavl_result_t _wavl_tree_bytes_key_cmp(struct wavl_tree *tree,
+                                       void *key_lhs,
+                                       struct wavl_tree_node *rhs,
+                                       int *pdir)
+{
+    struct wavl_bytes *lhs_key = key_lhs,
+                      rhs_key = tree->node_bytes(rhs);
+    size_t common = 0;
+
+    WAVL_ASSERT(NULL != lhs_key);
+
+    *pdir = __wavl_bytes_compare(lhs_key->ptr, lhs_key->len, rhs_key.ptr, rhs_key.len, 0, &common);
+
+    return WAVL_ERR_OK;
+}
+
+wavl_result_t wavl_tree_init_bytes(struct wavl_tree *tree,
+                                   wavl_node_to_bytes_func_t node_bytes)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != node_bytes);
+
+    if (WAVL_FAILED(ret = wavl_tree_init(tree, _wavl_tree_bytes_node_cmp, _wavl_tree_bytes_key_cmp))) {
+        goto done;
+    }
+
+    tree->node_bytes = node_bytes;
+
+done:
+    return ret;
+}
+
+/**
+ * Search a byte-string keyed tree for the given key, skipping the prefix that is known to be
+ * shared with every node in the subtree being searched.
+ *
+ * Every node in a subtree lies between the nearest ancestors that the search went right and
+ * left at. If the key shares lo_common bytes with the former and hi_common bytes with the
+ * latter, then every node of the subtree shares at least the lesser of the two with the key.
+ *
+ * \param tree The tree
+ * \param key The key to search for
+ * \param len Length of the key
+ * \param pparent The last node visited, returned by reference
+ * \param pdir The result of the last comparison, returned by reference
+ *
+ * \return The node matching the key, or NULL if there is none.
+ */
+static inline
+struct wavl_tree_node *_wavl_tree_bytes_search(struct wavl_tree *tree,
+                                               const uint8_t *key,
+                                               size_t len,
+                                               struct wavl_tree_node **pparent,
+                                               int *pdir)
+{
+    struct wavl_tree_node *cur = tree->root,
+                          *parent = NULL;
+    size_t lo_common = 0,
+           hi_common = 0;
+    int dir = -1;
+
+    size_t path_len __attribute__((unused)) = 0;
+
+    while (NULL != cur) {
+        struct wavl_bytes cur_key = tree->node_bytes(cur);
+        size_t skip = lo_common < hi_common ? lo_common : hi_common,
+               common = 0;
+
+        WAVL_STAT_INC(tree, compares);
+        path_len++;
+
+        dir = __wavl_bytes_compare(key, len, cur_key.ptr, cur_key.len, skip, &common);
+
+        if (0 == dir) {
+            break;
+        }
+
+        parent = cur;
+
+        if (dir < 0) {
+            hi_common = common;
+            cur = cur->left;
+        } else {
+            lo_common = common;
+            cur = cur->right;
+        }
+    }
+
+    WAVL_STAT_MAX(tree, max_path_len, path_len);
+
+    *pparent = parent;
+    *pdir = dir;
+
+    return cur;
+}
+
+wavl_result_t wavl_tree_insert_bytes(struct wavl_tree *tree,
+                                     const void *key,
+                                     size_t len,
+                                     struct wavl_tree_node *node)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_tree_node *parent = NULL;
+    int dir = -1;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != tree->node_bytes);
+    WAVL_ASSERT_ARG(NULL != key || 0 == len);
+    WAVL_ASSERT_ARG(NULL != node);
+
+    if (NULL != tree->on_dupe) {
+        /* Relaxed mode: stage the node, as wavl_tree_insert does */
+        __wavl_tree_stage(tree, node);
+        WAVL_STAT_INC(tree, inserts);
+        goto done;
+    }
+
+    if (NULL != _wavl_tree_bytes_search(tree, key, len, &parent, &dir)) {
+        ret = WAVL_ERR_TREE_DUPE;
+        goto done;
+    }
+
+    _wavl_tree_insert_at(tree, parent, dir, node);
+    WAVL_STAT_INC(tree, inserts);
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_tree_find_bytes(struct wavl_tree *tree,
+                                   const void *key,
+                                   size_t len,
+                                   struct wavl_tree_node **pfound)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_tree_node *parent = NULL;
+    int dir = -1;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != tree->node_bytes);
+    WAVL_ASSERT_ARG(NULL != key || 0 == len);
+    WAVL_ASSERT_ARG(NULL != pfound);
+
+    *pfound = NULL;
+
+    if (WAVL_FAILED(ret = __wavl_tree_settle(tree))) {
+        goto done;
+    }
+
+    if (NULL == (*pfound = _wavl_tree_bytes_search(tree, key, len, &parent, &dir))) {
+        ret = WAVL_ERR_TREE_NOT_FOUND;
+    }
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_tree_find_batch(struct wavl_tree *tree,
+                                   void *const *keys,
+                                   size_t nr_keys,
+                                   struct wavl_tree_node **results)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    /* In-flight searches: the index of the key, and the node to compare against next */
+    size_t slot_key[WAVL_TREE_FIND_BATCH_WIDTH];
+    struct wavl_tree_node *slot_node[WAVL_TREE_FIND_BATCH_WIDTH];
+
+    size_t nr_active = 0,
+           next_key = 0;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != keys || 0 == nr_keys);
+    WAVL_ASSERT_ARG(NULL != results || 0 == nr_keys);
+
+    if (WAVL_FAILED(ret = __wavl_tree_settle(tree))) {
+        goto done;
+    }
+
+    if (NULL == tree->root) {
+        for (size_t i = 0; i < nr_keys; i++) {
+            results[i] = NULL;
+        }
+        goto done;
+    }
+
+    /* Fill the pipeline */
+    while (nr_active < WAVL_TREE_FIND_BATCH_WIDTH && next_key < nr_keys) {
+        slot_key[nr_active] = next_key++;
+        slot_node[nr_active] = tree->root;
+        nr_active++;
+    }
+
+    while (0 != nr_active) {
+        size_t i = 0;
+
+        while (i < nr_active) {
+            struct wavl_tree_node *cur = slot_node[i];
+            int dir = -1;
+
+            WAVL_STAT_INC(tree, compares);
+
+            if (WAVL_FAILED(ret = tree->key_cmp(tree, keys[slot_key[i]], cur, &dir))) {
+                goto done;
+            }
+
+            if (0 != dir) {
+                cur = dir < 0 ? cur->left : cur->right;
+
+                if (NULL != cur) {
+                    /* Take another step next time around, hopefully from cache */
+                    __builtin_prefetch(cur);
+                    slot_node[i++] = cur;
+                    continue;
+                }
+            }
+
+            /* This search is finished */
+            results[slot_key[i]] = cur;
+
+            if (next_key < nr_keys) {
+                /* Start the next search in this slot */
+                slot_key[i] = next_key++;
+                slot_node[i] = tree->root;
+                i++;
+            } else {
+                /* Compact the active searches */
+                nr_active--;
+                slot_key[i] = slot_key[nr_active];
+                slot_node[i] = slot_node[nr_active];
+            }
+        }
+    }
+
+done:
+    return ret;
+}
+
+/**
+ * Non-exported function to find the minimum of the subtree rooted at the specified node.
+ */
+static
+struct wavl_tree_node *_wavl_tree_find_minimum_at(struct wavl_tree_node *node)
+{
+    struct wavl_tree_node *cur = node;
+
+    while (NULL != cur->left) {
+        cur = cur->left;
+    }
+
+    return cur;
+}
+
+/**
+ * Non-exported function to find the maximum of the subtree rooted at the specified node.
+ */
+static
+struct wavl_tree_node *_wavl_tree_find_maximum_at(struct wavl_tree_node *node)
+{
+    struct wavl_tree_node *cur = node;
+
+    while (NULL != cur->right) {
+        cur = cur->right;
+    }
+
+    return cur;
+}
+
+/**
+ * Non-exported function to find the in-order successor of the given node, or NULL if
+ * the node is the last in the tree.
+ */
+static
+struct wavl_tree_node *_wavl_tree_node_next(struct wavl_tree_node *node)
+{
+    struct wavl_tree_node *cur = node;
+
+    if (NULL != cur->right) {
+        return _wavl_tree_find_minimum_at(cur->right);
+    }
+
+    /* Climb until we come up from a left subtree */
+    while (NULL != cur->parent && cur == cur->parent->right) {
+        cur = cur->parent;
+    }
+
+    return cur->parent;
+}
+
+/**
+ * Non-exported function to find the in-order predecessor of the given node, or NULL if
+ * the node is the first in the tree.
+ */
+static
+struct wavl_tree_node *_wavl_tree_node_prev(struct wavl_tree_node *node)
+{
+    struct wavl_tree_node *cur = node;
+
+    if (NULL != cur->left) {
+        return _wavl_tree_find_maximum_at(cur->left);
+    }
+
+    /* Climb until we come up from a right subtree */
+    while (NULL != cur->parent && cur == cur->parent->left) {
+        cur = cur->parent;
+    }
+
+    return cur->parent;
+}
+
+/**
+ * Swap the new node in for the old node, effectively splicing in the new node.
+ *
+ * \param tree The tree
+ * \param parent The parent of the old node/to be parent of new node
+ * \param old The old node (to be removed)
+ * \param new The new node (to be swapped in)
+ */
+static
+void _wavl_tree_swap_in_node_at(struct wavl_tree *tree,
+                                struct wavl_tree_node *old,
+                                struct wavl_tree_node *new)
+{
+    struct wavl_tree_node *left = old->left,
+                          *right = old->right,
+                          *parent = old->parent;;
+
+    new->parent = parent;
+    if (NULL != parent) {
+        /* Update the parent to point to the new node */
+        if (parent->left == old) {
+            parent->left = new;
+        } else {
+            parent->right = new;
+        }
+    } else {
+        /* The old node is at the root */
+        tree->root = new;
+    }
+
+    new->right = right;
+    if (NULL != new->right) {
+        struct wavl_tree_node *right_new = new->right;
+        right_new->parent = new;
+    }
+    old->right = NULL;
+
+    new->left = left;
+    if (NULL != new->left) {
+        struct wavl_tree_node *left_new = new->left;
+        left_new->parent = new;
+    }
+    old->left = NULL;
+
+    /* Swap in the parity of the old node in to the new node */
+    new->rp = old->rp;
+
+    old->parent = NULL;
+}
+
+/**
+ * Rebalance the tree after removing the node, where p_x is the parent of the removed node,
+ * and x is the node that was promoted or spliced in.
+ *
+ * Handle the specific case where a 2 child was removed, resulting in a 3-child.
+ *
+ * \param tree The tree we are updating
+ * \param n The node that replaced the removed node.
+ * \param p_n The parent of the removed node.
+ *
+ * Note that the rank difference between n and p_n is 3 at entry to this function.
+ */
+static
+void _wavl_tree_delete_rebalance_3_child(struct wavl_tree *tree,
+                                         struct wavl_tree_node *n,
+                                         struct wavl_tree_node *p_n)
+{
+    struct wavl_tree_node *x = NULL,
+                          *p_x = NULL,
+                          *y = NULL;
+    bool creates_3_node = false,
+         done = true;
+
+    WAVL_ASSERT(NULL != tree);
+    WAVL_ASSERT(NULL != p_n);
+
+    WAVL_TRACE_EVENT(WAVL_TRACE_OP_REBALANCE_3_CHILD, tree, p_n, p_n->rp, p_n->rp);
+
+    /* Start with rebalancing X */
+    x = n;
+    p_x = p_n;
+
+    /*
+     * By the conventions in the paper:
+     * - x is a 3-child of p_x
+     * - p_x is the parent that we might need in rebalancing
+     * - y is the sibling of x
+     */
+
+    do {
+        struct wavl_tree_node *p_p_x = p_x->parent;
+        y = p_x->left == x ? p_x->right : p_x->left;
+
+        /* Check if the next step will create a 3-node of P(x) */
+        creates_3_node = p_p_x != NULL &&
+            __wavl_tree_node_get_parity(p_x) == __wavl_tree_node_get_parity(p_p_x);
+
+        /* Figure out which demote case we have */
+        if (__wavl_tree_node_is_2_child(y, p_x)) {
+            /* y is a 2-child, x is a 3 child, simply demote the parent */
+            __wavl_tree_node_demote(tree, p_x);
+        } else {
+            bool y_rank_parity = __wavl_tree_node_get_parity(y);
+            if (y_rank_parity == __wavl_tree_node_get_parity(y->left) &&
+                y_rank_parity == __wavl_tree_node_get_parity(y->right))
+            {
+                /* p_x is 3,1 Y (a 1-child) is 2, 2, so we can demote p_x and y */
+                __wavl_tree_node_demote(tree, p_x);
+                __wavl_tree_node_demote(tree, y);
+            } else {
+                done = false;
+                break;
+            }
+        }
+
+        /* Keep climbing the tree */
+        x = p_x;
+        p_x = p_p_x;
+    } while (NULL != p_x && true == creates_3_node);
+
+    if (true == done) {
+        /* We're done, there should be no more violations of the WAVL constraint */
+        return;
+    }
+
+    /* Otherwise, perform rotations needed to restore balance */
+    struct wavl_tree_node *z = p_x;
+    if (x == p_x->left) {
+        struct wavl_tree_node *w = y->right;
+        if (__wavl_tree_node_get_parity(w) != __wavl_tree_node_get_parity(y)) {
+            /* w is a 1-child of y */
+            _wavl_tree_rotate_left_at(tree, y);
+            __wavl_tree_node_promote(tree, y);
+            __wavl_tree_node_demote(tree, z);
+            if (__wavl_tree_node_is_leaf(z)) {
+                __wavl_tree_node_demote(tree, z);
+            }
+        } else {
+            struct wavl_tree_node *v = y->left;
+            /* w is a 2-child of y, thus v must be a 1-child */
+            WAVL_ASSERT(__wavl_tree_node_get_parity(y) != __wavl_tree_node_get_parity(v));
+
+            _wavl_tree_double_rotate_left_at(tree, v);
+            __wavl_tree_node_double_promote(tree, v);
+            __wavl_tree_node_demote(tree, y);
+            __wavl_tree_node_double_demote(tree, z);
+        }
+    } else {
+        struct wavl_tree_node *w = y->left;
+        if (__wavl_tree_node_get_parity(w) != __wavl_tree_node_get_parity(y)) {
+            /* w is a 1-child of y */
+            _wavl_tree_rotate_right_at(tree, y);
+            __wavl_tree_node_promote(tree, y);
+            __wavl_tree_node_demote(tree, z);
+            if (__wavl_tree_node_is_leaf(z)) {
+                __wavl_tree_node_demote(tree, z);
+            }
+        } else {
+            struct wavl_tree_node *v = y->right;
+            WAVL_ASSERT(__wavl_tree_node_get_parity(y) != __wavl_tree_node_get_parity(v));
+
+            _wavl_tree_double_rotate_right_at(tree, v);
+            __wavl_tree_node_double_promote(tree, v);
+            __wavl_tree_node_demote(tree, y);
+            __wavl_tree_node_double_demote(tree, z);
+        }
+    }
+}
+
+/**
+ * Deletion created a 2,2 leaf at leaf. Fix up the leaf, and figure out
+ * where that leaves us.
+ */
+static
+void _wavl_tree_delete_rebalance_2_2_leaf(struct wavl_tree *tree,
+                                          struct wavl_tree_node *leaf)
+{
+    struct wavl_tree_node *x = leaf;
+
+    WAVL_ASSERT(NULL != tree);
+    WAVL_ASSERT(NULL != leaf);
+
+    /* Check if x is a 2-child of P(x). If x is the root, just demote it. */
+    if (NULL != x->parent &&
+            __wavl_tree_node_get_parity(x->parent) == __wavl_tree_node_get_parity(x))
+    {
+        /* The leaf was a 2-child, so we will need to kick off the 3,1/1,3 rebalancing */
+        __wavl_tree_node_demote(tree, x);
+
+        /* p_x is now a 3-child, so we need to proceed with a normal 3-child rebalance */
+        _wavl_tree_delete_rebalance_3_child(tree, x, x->parent);
+    } else {
+        /* Just demote the leaf and carry on (leaf is now a 2-child) */
+        __wavl_tree_node_demote(tree, x);
+    }
+}
+
+
+/**
+ * Remove the given node from the tree, and rebalance.
+ *
+ * While insertion and search are pretty straightforward, removal is a bit more work.
+ *
+ * We need to consider 3 cases during removal from a binary search tree
+ * 1. Where the node has no children (just delete it) - a leaf node
+ * 2. Where the node has one child subtree (left or right - promote the child) - unary node
+ * 3. Where the node has two children - binary node
+ *
+ * For the third case, we need to find the appropriate replacement for the node we are
+ * deleting, which is effectively the successor (next) node to the node we are deleting.
+ * We promote the successor to current node's position. The successor is usually a unary
+ * node or a leaf.
+ *
+ * When we splice in the replacement node in case 3, we need to track where we removed the
+ * successor node from. The spliced in node takes on the exact same rank as the removed
+ * node.
+ *
+ * Once we have a candidate node, we have to start rebalancing. To start the rebalancing
+ * process off, we need to consider, if the node removed:
+ *  * was a leaf, and 1-child of a unary node, we have a 2,2 leaf to fix
+ *  * was a 2-child of a node
+ *
+ * \param tree The tree
+ * \param node The node to remove
+ * \param succ The in-order successor of node. Only used (and required) if node has two
+ *             children, in which case it is the minimum of the right subtree.
+ */
+static
+void _wavl_tree_remove_at(struct wavl_tree *tree,
+                          struct wavl_tree_node *node,
+                          struct wavl_tree_node *succ)
+{
+    struct wavl_tree_node *y = NULL,
+                          *x = NULL,
+                          *p_y = NULL;
+
+    bool is_2_child = false;
+
+    __wavl_tree_cache_forget(tree, node);
+
+    /* The minimum has no left child, so its successor is the new minimum: the minimum of its
+     * right subtree, or its parent. Likewise for the maximum.
+     */
+    if (node == tree->leftmost) {
+        tree->leftmost = NULL != node->right ? _wavl_tree_find_minimum_at(node->right) : node->parent;
+    }
+
+    if (node == tree->rightmost) {
+        tree->rightmost = NULL != node->left ? _wavl_tree_find_maximum_at(node->left) : node->parent;
+    }
+
+    /* Figure out which node we need to splice in, replacing node */
+    if (NULL == node->left || NULL == node->right) {
+        y = node;
+    } else {
+        /* The successor is the replacement for node. We'll need to fix up the tree at
+         * the original location of y.
+         */
+        WAVL_ASSERT(NULL != succ);
+        WAVL_ASSERT(_wavl_tree_find_minimum_at(node->right) == succ);
+        y = succ;
+    }
+
+    /* Find the child of the node to splice we will move up */
+    if (NULL != y->left) {
+        x = y->left;
+    } else {
+        x = y->right;
+    }
+
+    /* Splice in the child of the node to be removed */
+    if (NULL != x) {
+        x->parent = y->parent;
+    }
+
+    p_y = y->parent;
+    if (NULL == p_y) {
+        /* We're deleting the root, so swap in the new candidate */
+        tree->root = x;
+    } else {
+        /* Check if y is a 2-child of its parent */
+        is_2_child = __wavl_tree_node_is_2_child(y, p_y);
+
+        /* Ensure the right/left pointer of the parent of the node to
+         * be spliced out points to its new child
+         */
+        if (y == p_y->left) {
+            p_y->left = x;
+        } else {
+            WAVL_ASSERT(p_y->right == y);
+            p_y->right = x;
+        }
+    }
+
+    /*
+     * At this point, y is either a node to splice in to replace the node to be deleted, or is
+     * the deleted node itself. If y is a node to splice in, do so now.
+     */
+    if (y != node) {
+        _wavl_tree_swap_in_node_at(tree, node, y);
+        if (node == p_y) {
+            p_y = y;
+        }
+    }
+
+    /*
+     * x is the new child we spliced in. p_y is its new parent. Fix up the tree so the wavl
+     * constraints are restored.
+     *
+     * We know we have to restore constraints if:
+     *  * y was a 2-child of p_y (note that x is NULL in this case)
+     *  * y was a leaf, 1-child of p_y; p_y is unary.
+     */
+    if (NULL != p_y) {
+        if (true == is_2_child) {
+            /* x is a 3-child of p_y, so we need to start handling that caase */
+            _wavl_tree_delete_rebalance_3_child(tree, x, p_y);
+
+        } else if (NULL == x && p_y->left == p_y->right) {
+            /* p_y is a 2,2 leaf, so we need to fix it up and figure out if this
+             * will result in p_y becoming a 3-child
+             */
+            _wavl_tree_delete_rebalance_2_2_leaf(tree, p_y);
+        }
 
         /* Ensure the parent is not a leaf, and that the parity isn't true */
         WAVL_ASSERT(!(__wavl_tree_node_is_leaf(p_y) && __wavl_tree_node_get_parity(p_y)));
     }
 
-    /* Clear the removed node's metadata out */
-    node->left = node->right = node->parent = NULL;
-    node->rp = false;
+    WAVL_STAT_INC(tree, removes);
+
+    /* Clear the removed node's metadata out */
+    node->left = node->right = node->parent = NULL;
+    node->rp = false;
+}
+
+/**
+ * Remove the minimum node from a non-empty tree. The minimum has no left child, and is the
+ * left child of its parent (if any), so it can be spliced out directly: there is no
+ * replacement to find, and no node to swap in.
+ *
+ * \param tree The tree
+ *
+ * \return The removed node
+ */
+static
+struct wavl_tree_node *_wavl_tree_remove_min(struct wavl_tree *tree)
+{
+    struct wavl_tree_node *node = tree->leftmost,
+                          *x = node->right,
+                          *p = node->parent;
+    bool is_2_child = false;
+
+    WAVL_ASSERT(NULL != node);
+    WAVL_ASSERT(NULL == node->left);
+
+    __wavl_tree_cache_forget(tree, node);
+
+    /* The right child of the minimum, if any, is a leaf */
+    tree->leftmost = NULL != x ? x : p;
+
+    /* Only if the minimum is the sole node */
+    if (node == tree->rightmost) {
+        tree->rightmost = p;
+    }
+
+    if (NULL != x) {
+        x->parent = p;
+    }
+
+    if (NULL == p) {
+        tree->root = x;
+    } else {
+        WAVL_ASSERT(p->left == node);
+        is_2_child = __wavl_tree_node_is_2_child(node, p);
+        p->left = x;
+
+        if (true == is_2_child) {
+            _wavl_tree_delete_rebalance_3_child(tree, x, p);
+        } else if (NULL == x && NULL == p->right) {
+            _wavl_tree_delete_rebalance_2_2_leaf(tree, p);
+        }
+    }
+
+    WAVL_STAT_INC(tree, removes);
+
+    node->left = node->right = node->parent = NULL;
+    node->rp = false;
+
+    return node;
+}
+
+wavl_result_t wavl_tree_remove(struct wavl_tree *tree,
+                               struct wavl_tree_node *node)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != node);
+
+    if (true == node->pending) {
+        __wavl_tree_unstage(tree, node);
+        goto done;
+    }
+
+    _wavl_tree_remove_at(tree, node,
+            NULL != node->left && NULL != node->right ? _wavl_tree_find_minimum_at(node->right) : NULL);
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_tree_set_relaxed(struct wavl_tree *tree,
+                                    wavl_node_dupe_func_t on_dupe,
+                                    void *arg)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+
+    if (NULL == on_dupe) {
+        if (WAVL_FAILED(ret = wavl_tree_rebalance_step(tree, SIZE_MAX))) {
+            goto done;
+        }
+
+        tree->on_dupe = NULL;
+        tree->on_dupe_arg = NULL;
+        goto done;
+    }
+
+    tree->on_dupe = on_dupe;
+    tree->on_dupe_arg = arg;
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_tree_rebalance_step(struct wavl_tree *tree,
+                                       size_t budget)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+
+    for (; budget > 0 && 0 != tree->nr_pending; budget--) {
+        struct wavl_tree_node *node = tree->staged_first,
+                              *parent = NULL,
+                              *cur = tree->root;
+        int dir = -1;
+        size_t path_len __attribute__((unused)) = 0;
+
+        /* Find where the node goes before taking it off the list, so that it stays staged if
+         * the comparison fails */
+        while (NULL != cur) {
+            WAVL_STAT_INC(tree, compares);
+            path_len++;
+
+            if (WAVL_FAILED(ret = tree->node_cmp(tree, node, cur, &dir))) {
+                goto done;
+            }
+
+            if (0 == dir) {
+                if (0 == (tree->flags & WAVL_TREE_FLAG_MULTI)) {
+                    break;
+                }
+
+                /* After the equal nodes already in the tree, which were inserted earlier */
+                dir = 1;
+            }
+
+            parent = cur;
+            cur = dir < 0 ? cur->left : cur->right;
+        }
+
+        WAVL_STAT_MAX(tree, max_path_len, path_len);
+
+        __wavl_tree_unstage(tree, node);
+
+        if (NULL != cur) {
+            /* A duplicate: hand the node back, rather than hold up the items behind it */
+            tree->on_dupe(tree, node, tree->on_dupe_arg);
+            continue;
+        }
+
+        _wavl_tree_insert_at(tree, parent, dir, node);
+    }
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_tree_get_pending(struct wavl_tree *tree,
+                                    size_t *pnr_pending)
+{
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != pnr_pending);
+
+    *pnr_pending = tree->nr_pending;
+
+    return WAVL_ERR_OK;
+}
+
+wavl_result_t wavl_tree_min(struct wavl_tree *tree,
+                            struct wavl_tree_node **pmin)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != pmin);
+
+    *pmin = NULL;
+
+    if (WAVL_FAILED(ret = __wavl_tree_settle(tree))) {
+        goto done;
+    }
+
+    *pmin = tree->leftmost;
+
+    ret = NULL != *pmin ? WAVL_ERR_OK : WAVL_ERR_TREE_NOT_FOUND;
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_tree_max(struct wavl_tree *tree,
+                            struct wavl_tree_node **pmax)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != pmax);
+
+    *pmax = NULL;
+
+    if (WAVL_FAILED(ret = __wavl_tree_settle(tree))) {
+        goto done;
+    }
+
+    *pmax = tree->rightmost;
+
+    ret = NULL != *pmax ? WAVL_ERR_OK : WAVL_ERR_TREE_NOT_FOUND;
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_tree_next(struct wavl_tree *tree,
+                             struct wavl_tree_node *node,
+                             struct wavl_tree_node **pnext)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != node);
+    WAVL_ASSERT_ARG(NULL != pnext);
+
+    *pnext = NULL;
+
+    if (WAVL_FAILED(ret = __wavl_tree_settle(tree))) {
+        goto done;
+    }
+
+    *pnext = _wavl_tree_node_next(node);
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_tree_count(struct wavl_tree *tree,
+                              void *key,
+                              size_t *pcount)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_tree_node *first = NULL,
+                          *last = NULL;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != pcount);
+
+    *pcount = 0;
+
+    if (WAVL_FAILED(ret = wavl_tree_equal_range(tree, key, &first, &last))) {
+        if (WAVL_ERR_TREE_NOT_FOUND == ret) {
+            ret = WAVL_ERR_OK;
+        }
+        goto done;
+    }
+
+    for (*pcount = 1; first != last; (*pcount)++) {
+        first = _wavl_tree_node_next(first);
+    }
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_tree_remove_and_next(struct wavl_tree *tree,
+                                        struct wavl_tree_node *node,
+                                        struct wavl_tree_node **pnext)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_tree_node *next = NULL;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != node);
+    WAVL_ASSERT_ARG(NULL != pnext);
+
+    *pnext = NULL;
+
+    /* The next node may be staged, and a staged node has no place in the tree yet */
+    if (WAVL_FAILED(ret = __wavl_tree_settle(tree))) {
+        goto done;
+    }
+
+    /* Removal only relinks nodes, so the successor is still the successor afterwards */
+    next = _wavl_tree_node_next(node);
+
+    _wavl_tree_remove_at(tree, node, next);
+
+    *pnext = next;
+
+done:
+    return ret;
+}
+
+
+wavl_result_t wavl_tree_replace(struct wavl_tree *tree,
+                                struct wavl_tree_node *old,
+                                struct wavl_tree_node *new)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != old);
+    WAVL_ASSERT_ARG(NULL != new);
+    WAVL_ASSERT_ARG(old != new);
+
+    if (true == old->pending) {
+        /* The new node takes the place of the old one in the list of staged items */
+        *new = *old;
+
+        if (NULL != new->left) {
+            new->left->right = new;
+        } else {
+            tree->staged_first = new;
+        }
+
+        if (NULL != new->right) {
+            new->right->left = new;
+        } else {
+            tree->staged_last = new;
+        }
+
+        old->left = old->right = NULL;
+        old->pending = false;
+        goto done;
+    }
+
+    __wavl_tree_cache_forget(tree, old);
+
+    _wavl_tree_swap_in_node_at(tree, old, new);
+    old->rp = false;
+    new->pending = false;
+
+#ifdef WAVL_TREE_INLINE_KEY
+    new->key = old->key;
+#endif
+
+    if (old == tree->leftmost) {
+        tree->leftmost = new;
+    }
+
+    if (old == tree->rightmost) {
+        tree->rightmost = new;
+    }
+
+done:
+    return ret;
+}
+
+/**
+ * Put a node back between its old neighbours, after moving it elsewhere failed. The two are
+ * adjacent, so one of them has a free child slot on the side facing the other.
+ *
+ * \param tree The tree
+ * \param node The node to put back
+ * \param pred The old predecessor of the node, or NULL
+ * \param succ The old successor of the node, or NULL
+ */
+static
+void _wavl_tree_relink(struct wavl_tree *tree,
+                       struct wavl_tree_node *node,
+                       struct wavl_tree_node *pred,
+                       struct wavl_tree_node *succ)
+{
+    if (NULL != pred && NULL == pred->right) {
+        _wavl_tree_insert_at(tree, pred, 1, node);
+    } else if (NULL != succ) {
+        WAVL_ASSERT(NULL == succ->left);
+        _wavl_tree_insert_at(tree, succ, -1, node);
+    } else {
+        _wavl_tree_insert_at(tree, NULL, -1, node);
+    }
+}
+
+wavl_result_t wavl_tree_update_key(struct wavl_tree *tree,
+                                   struct wavl_tree_node *node,
+                                   void *key)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_tree_node *pred = NULL,
+                          *succ = NULL;
+    bool multi = false,
+         after_pred = true,
+         before_succ = true;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != node);
+
+    if (true == node->pending) {
+        /* The staged items are in no order, and the step moves the node in by its new key */
+        goto done;
+    }
+
+    multi = 0 != (tree->flags & WAVL_TREE_FLAG_MULTI);
+    pred = _wavl_tree_node_prev(node);
+    succ = _wavl_tree_node_next(node);
+
+    if (NULL != pred) {
+        int dir = 0;
+
+        WAVL_STAT_INC(tree, compares);
+
+        if (WAVL_FAILED(ret = tree->key_cmp(tree, key, pred, &dir))) {
+            goto done;
+        }
+
+        after_pred = dir > 0 || (true == multi && 0 == dir);
+    }
+
+    if (true == after_pred && NULL != succ) {
+        int dir = 0;
+
+        WAVL_STAT_INC(tree, compares);
+
+        if (WAVL_FAILED(ret = tree->key_cmp(tree, key, succ, &dir))) {
+            goto done;
+        }
+
+        before_succ = dir < 0 || (true == multi && 0 == dir);
+    }
+
+    if (true == after_pred && true == before_succ) {
+        /* The node is still in order, so the tree need not change */
+        goto done;
+    }
+
+    /* Take the node out, and put it back in starting from the neighbour on the side it is
+     * moving toward. That neighbour is still in the tree, and is as close as it gets. If the
+     * new key is a duplicate, or cannot be compared, the node goes back where it was.
+     */
+    _wavl_tree_remove_at(tree, node, succ);
+
+    if (WAVL_FAILED(ret = wavl_tree_insert_from(tree, true == after_pred ? succ : pred, key, node))) {
+        _wavl_tree_relink(tree, node, pred, succ);
+    }
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_tree_update_key_u64(struct wavl_tree *tree,
+                                       struct wavl_tree_node *node,
+                                       uint64_t prefix,
+                                       void *key)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != node);
+
+#ifdef WAVL_TREE_INLINE_KEY
+    struct wavl_tree_node *pred = NULL,
+                          *succ = NULL;
+    int dir = 1;
+
+    if (true == node->pending) {
+        /* The step moves the node in by its new key */
+        node->key = prefix;
+        goto done;
+    }
+
+    pred = _wavl_tree_node_prev(node);
+    succ = _wavl_tree_node_next(node);
+
+    if (NULL != pred && WAVL_FAILED(ret = __wavl_tree_u64_compare(tree, prefix, key, pred, &dir))) {
+        goto done;
+    }
+
+    if (dir > 0 && NULL != succ) {
+        if (WAVL_FAILED(ret = __wavl_tree_u64_compare(tree, prefix, key, succ, &dir))) {
+            goto done;
+        }
+
+        dir = -dir;
+    }
+
+    if (dir > 0) {
+        /* Still in order: only the stored prefix changes */
+        node->key = prefix;
+        goto done;
+    }
+
+    /* There is no finger search on inline keys, so the node goes back in from the root. The
+     * stored prefix only changes once the node is in its new place. */
+    _wavl_tree_remove_at(tree, node, succ);
+
+    if (WAVL_FAILED(ret = wavl_tree_insert_u64(tree, prefix, key, node))) {
+        _wavl_tree_relink(tree, node, pred, succ);
+    }
+
+done:
+    return ret;
+#else
+    (void)prefix;
+    (void)key;
+    ret = WAVL_ERR_NOT_SUPPORTED;
+    return ret;
+#endif
+}
+
+wavl_result_t wavl_pq_init(struct wavl_pq *pq,
+                           wavl_node_to_node_compare_func_t node_cmp,
+                           wavl_key_to_node_compare_func_t key_cmp)
+{
+    WAVL_ASSERT_ARG(NULL != pq);
+
+    return wavl_tree_init(&pq->tree, node_cmp, key_cmp);
+}
+
+wavl_result_t wavl_pq_push(struct wavl_pq *pq,
+                           void *key,
+                           struct wavl_tree_node *node)
+{
+    WAVL_ASSERT_ARG(NULL != pq);
+
+    return wavl_tree_insert(&pq->tree, key, node);
+}
+
+wavl_result_t wavl_pq_peek_min(struct wavl_pq *pq,
+                               struct wavl_tree_node **pmin)
+{
+    WAVL_ASSERT_ARG(NULL != pq);
+
+    return wavl_tree_min(&pq->tree, pmin);
+}
+
+wavl_result_t wavl_pq_pop_min(struct wavl_pq *pq,
+                              struct wavl_tree_node **pmin)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != pq);
+    WAVL_ASSERT_ARG(NULL != pmin);
+
+    *pmin = NULL;
+
+    if (WAVL_FAILED(ret = __wavl_tree_settle(&pq->tree))) {
+        goto done;
+    }
+
+    if (NULL == pq->tree.leftmost) {
+        ret = WAVL_ERR_TREE_NOT_FOUND;
+        goto done;
+    }
+
+    *pmin = _wavl_tree_remove_min(&pq->tree);
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_pq_remove(struct wavl_pq *pq,
+                             struct wavl_tree_node *node)
+{
+    WAVL_ASSERT_ARG(NULL != pq);
+
+    return wavl_tree_remove(&pq->tree, node);
+}
+
+/**
+ * Rank difference between a child (possibly NULL) and its parent, according to the
+ * rank parities.
+ */
+static inline
+size_t __wavl_tree_node_rank_diff(struct wavl_tree_node *n, struct wavl_tree_node *p_n)
+{
+    return __wavl_tree_node_is_2_child(n, p_n) ? 2 : 1;
+}
+
+/**
+ * Check that a child exists, and that its parent pointer points back to the parent.
+ */
+static inline
+bool __wavl_tree_inspect_child_ok(struct wavl_tree_node *n, struct wavl_tree_node *p_n)
+{
+    return NULL != n && n->parent == p_n;
+}
+
+/**
+ * Compute floor(2 * log2(n)) + 1: the number of levels a WAVL tree with n nodes may have.
+ */
+static
+size_t _wavl_tree_height_bound(size_t n)
+{
+    size_t lg = 0;
+    double pow_2k = 0.0;
+
+    if (0 == n) {
+        return 0;
+    }
+
+    lg = 63 - __builtin_clzll((unsigned long long)n);
+    pow_2k = (double)(1ull << lg);
+
+    /* floor(2 * log2(n)) is 2 * floor(log2(n)), plus one if n >= sqrt(2) * 2^floor(log2(n)) */
+    return 2 * lg + ((double)n * (double)n >= 2.0 * pow_2k * pow_2k ? 1 : 0) + 1;
+}
+
+wavl_result_t wavl_tree_inspect(struct wavl_tree *tree,
+                                struct wavl_tree_report *report)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_tree_node *cur = NULL;
+
+    /* The rank distance hist is indexed by distance from the root rank */
+    size_t dist_hist[WAVL_TREE_REPORT_BUCKETS] = { 0 };
+
+    size_t depth = 0,
+           depth_sum = 0,
+           dist = 0,
+           ext_dist = 0;
+
+    bool have_ext = false;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != report);
+
+    *report = (struct wavl_tree_report){ 0 };
+    report->nr_pending = tree->nr_pending;
+
+    cur = tree->root;
+
+    /*
+     * Walk the tree in pre-order, using the parent pointers to climb back up. Ranks are
+     * tracked as a distance from the (as yet unknown) rank of the root. Every external
+     * position has rank -1, which tells us the rank of the root once we find the first one.
+     */
+    while (NULL != cur) {
+        struct wavl_tree_node *children[2] = { cur->left, cur->right };
+
+        report->nr_nodes++;
+        depth_sum += depth;
+
+        if (depth > report->max_depth) {
+            report->max_depth = depth;
+        }
+
+        report->depth_hist[depth < WAVL_TREE_REPORT_BUCKETS ? depth : WAVL_TREE_REPORT_BUCKETS - 1]++;
+        dist_hist[dist < WAVL_TREE_REPORT_BUCKETS ? dist : WAVL_TREE_REPORT_BUCKETS - 1]++;
+
+        for (size_t i = 0; i < 2; i++) {
+            if (NULL == children[i]) {
+                size_t child_dist = dist + __wavl_tree_node_rank_diff(NULL, cur);
+
+                if (false == have_ext) {
+                    have_ext = true;
+                    ext_dist = child_dist;
+                } else if (child_dist != ext_dist) {
+                    report->rank_violations++;
+                }
+            } else if (false == __wavl_tree_inspect_child_ok(children[i], cur)) {
+                report->link_violations++;
+            }
+        }
+
+        /* Descend if we can */
+        if (__wavl_tree_inspect_child_ok(cur->left, cur)) {
+            dist += __wavl_tree_node_rank_diff(cur->left, cur);
+            depth++;
+            cur = cur->left;
+            continue;
+        }
+
+        if (__wavl_tree_inspect_child_ok(cur->right, cur)) {
+            dist += __wavl_tree_node_rank_diff(cur->right, cur);
+            depth++;
+            cur = cur->right;
+            continue;
+        }
+
+        /* Climb until we find a right subtree we have not yet visited */
+        while (cur != tree->root) {
+            struct wavl_tree_node *p_cur = cur->parent;
+
+            dist -= __wavl_tree_node_rank_diff(cur, p_cur);
+            depth--;
+
+            if (cur == p_cur->left && __wavl_tree_inspect_child_ok(p_cur->right, p_cur)) {
+                cur = p_cur->right;
+                dist += __wavl_tree_node_rank_diff(cur, p_cur);
+                depth++;
+                break;
+            }
+
+            cur = p_cur;
+        }
+
+        if (cur == tree->root) {
+            break;
+        }
+    }
+
+    if (0 == report->nr_nodes) {
+        goto done;
+    }
+
+    report->height = report->max_depth + 1;
+    report->mean_depth = (double)depth_sum / (double)report->nr_nodes;
+    report->height_bound = _wavl_tree_height_bound(report->nr_nodes);
+
+    /* External nodes have rank -1, so the root is one less than their distance */
+    report->root_rank = ext_dist - 1;
+
+    for (size_t i = 0; i < WAVL_TREE_REPORT_BUCKETS && i <= report->root_rank; i++) {
+        size_t rank = report->root_rank - i;
+        report->rank_hist[rank < WAVL_TREE_REPORT_BUCKETS ? rank : WAVL_TREE_REPORT_BUCKETS - 1] += dist_hist[i];
+    }
+
+done:
+    return ret;
+}
+
+/**
+ * State for relocating a tree into an arena
+ */
+struct wavl_tree_relayout_state {
+    char *arena;                    /**< Base of the arena */
+    size_t elem_size;               /**< Size of each containing structure */
+    size_t node_offset;             /**< Offset of the node in the containing structure */
+    size_t nr_emitted;              /**< Number of elements copied so far */
+};
+
+/**
+ * Copy the container of the given node to the next slot in the arena. The parent pointer
+ * of the original node is overwritten to point to its copy, so we can fix up links later.
+ */
+static
+void _wavl_tree_relayout_emit(struct wavl_tree_relayout_state *st,
+                              struct wavl_tree_node *node)
+{
+    char *dst = st->arena + st->nr_emitted * st->elem_size;
+
+    memcpy(dst, (char *)node - st->node_offset, st->elem_size);
+    node->parent = (struct wavl_tree_node *)(dst + st->node_offset);
+
+    st->nr_emitted++;
+}
+
+static
+void _wavl_tree_relayout_veb(struct wavl_tree_relayout_state *st,
+                             struct wavl_tree_node *node,
+                             size_t levels);
+
+/**
+ * Lay out each of the subtrees rooted at the given depth below node, left to right.
+ */
+static
+void _wavl_tree_relayout_veb_bottoms(struct wavl_tree_relayout_state *st,
+                                     struct wavl_tree_node *node,
+                                     size_t depth,
+                                     size_t levels)
+{
+    if (NULL == node) {
+        return;
+    }
+
+    if (0 == depth) {
+        _wavl_tree_relayout_veb(st, node, levels);
+        return;
+    }
+
+    _wavl_tree_relayout_veb_bottoms(st, node->left, depth - 1, levels);
+    _wavl_tree_relayout_veb_bottoms(st, node->right, depth - 1, levels);
+}
+
+/**
+ * Lay out the top `levels` levels of the subtree rooted at node in van Emde Boas order:
+ * split the levels in half, lay out the top half recursively, then each of the subtrees
+ * hanging off the bottom of the top half.
+ *
+ * Recursion depth is bounded by the height of the tree.
+ */
+static
+void _wavl_tree_relayout_veb(struct wavl_tree_relayout_state *st,
+                             struct wavl_tree_node *node,
+                             size_t levels)
+{
+    size_t top = levels / 2;
+
+    if (NULL == node || 0 == levels) {
+        return;
+    }
+
+    if (1 == levels) {
+        _wavl_tree_relayout_emit(st, node);
+        return;
+    }
+
+    _wavl_tree_relayout_veb(st, node, top);
+    _wavl_tree_relayout_veb_bottoms(st, node, top, levels - top);
+}
+
+/**
+ * Get the new location of a node, after it has been emitted.
+ */
+static inline
+struct wavl_tree_node *__wavl_tree_relayout_forward(struct wavl_tree_node *old)
+{
+    return NULL == old ? NULL : old->parent;
+}
+
+wavl_result_t wavl_tree_relayout(struct wavl_tree *tree,
+                                 void *arena,
+                                 size_t arena_size,
+                                 size_t elem_size,
+                                 size_t node_offset)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_tree_report report;
+    struct wavl_tree_relayout_state st;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != arena);
+    WAVL_ASSERT_ARG(elem_size >= node_offset + sizeof(struct wavl_tree_node));
+
+    /* Staged items must be in the tree to be laid out with it */
+    if (WAVL_FAILED(ret = __wavl_tree_settle(tree))) {
+        goto done;
+    }
+
+    if (WAVL_FAILED(ret = wavl_tree_inspect(tree, &report))) {
+        goto done;
+    }
+
+    if (0 != report.link_violations) {
+        ret = WAVL_ERR_TREE_CORRUPT;
+        goto done;
+    }
+
+    if (report.nr_nodes > arena_size / elem_size) {
+        ret = WAVL_ERR_NO_SPACE;
+        goto done;
+    }
+
+    if (0 == report.nr_nodes) {
+        goto done;
+    }
+
+    st.arena = arena;
+    st.elem_size = elem_size;
+    st.node_offset = node_offset;
+    st.nr_emitted = 0;
+
+    /* Every node is about to move */
+    __wavl_tree_cache_flush(tree);
+
+    /* Copy all the containers in, leaving forwarding pointers behind */
+    _wavl_tree_relayout_veb(&st, tree->root, report.height);
+    WAVL_ASSERT(st.nr_emitted == report.nr_nodes);
+
+    /* Fix up the links of the copies. The copies still point at the original nodes. */
+    for (size_t i = 0; i < st.nr_emitted; i++) {
+        struct wavl_tree_node *node =
+            (struct wavl_tree_node *)(st.arena + i * st.elem_size + st.node_offset);
+
+        node->left = __wavl_tree_relayout_forward(node->left);
+        node->right = __wavl_tree_relayout_forward(node->right);
+        node->parent = __wavl_tree_relayout_forward(node->parent);
+    }
+
+    tree->root = __wavl_tree_relayout_forward(tree->root);
+    tree->leftmost = __wavl_tree_relayout_forward(tree->leftmost);
+    tree->rightmost = __wavl_tree_relayout_forward(tree->rightmost);
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_frozen_init(struct wavl_frozen *frozen,
+                               uint64_t *keys,
+                               struct wavl_tree_node **nodes,
+                               size_t capacity)
+{
+    WAVL_ASSERT_ARG(NULL != frozen);
+    WAVL_ASSERT_ARG(NULL != keys || 0 == capacity);
+    WAVL_ASSERT_ARG(NULL != nodes || 0 == capacity);
+
+    frozen->keys = keys;
+    frozen->nodes = nodes;
+    frozen->nr_nodes = 0;
+    frozen->capacity = capacity;
+
+    return WAVL_ERR_OK;
+}
+
+/**
+ * State for freezing a tree
+ */
+struct wavl_tree_freeze_state {
+    struct wavl_frozen *frozen;     /**< The image being built */
+    wavl_node_to_u64_func_t key_func; /**< Key extraction function */
+    struct wavl_tree_node *next;    /**< The next node, in order, to be placed */
+    bool out_of_order;              /**< Set if the key function disagrees with the tree */
+};
+
+/**
+ * Fill in the implicit subtree rooted at index i with the next nodes from the tree, in
+ * order. Recursion depth is log2 of the number of nodes.
+ */
+static
+void _wavl_tree_freeze_fill(struct wavl_tree_freeze_state *st, size_t i)
+{
+    struct wavl_frozen *frozen = st->frozen;
+
+    if (i >= frozen->nr_nodes) {
+        return;
+    }
+
+    _wavl_tree_freeze_fill(st, 2 * i + 1);
+
+    frozen->nodes[i] = st->next;
+    frozen->keys[i] = st->key_func(st->next);
+    st->next = _wavl_tree_node_next(st->next);
+
+    if (NULL != st->next && st->key_func(st->next) < frozen->keys[i]) {
+        st->out_of_order = true;
+    }
+
+    _wavl_tree_freeze_fill(st, 2 * i + 2);
+}
+
+wavl_result_t wavl_tree_freeze(struct wavl_tree *tree,
+                               wavl_node_to_u64_func_t key_func,
+                               struct wavl_frozen *frozen)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_tree_freeze_state st;
+    size_t nr_nodes = 0;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != key_func);
+    WAVL_ASSERT_ARG(NULL != frozen);
+
+    frozen->nr_nodes = 0;
+
+    /* Staged items must be in the tree to be frozen with it */
+    if (WAVL_FAILED(ret = __wavl_tree_settle(tree))) {
+        goto done;
+    }
+
+    if (NULL == tree->root) {
+        goto done;
+    }
+
+    /* Count the nodes, checking that we have room for all of them */
+    for (struct wavl_tree_node *cur = tree->leftmost;
+            NULL != cur;
+            cur = _wavl_tree_node_next(cur))
+    {
+        if (nr_nodes == frozen->capacity) {
+            ret = WAVL_ERR_NO_SPACE;
+            goto done;
+        }
+        nr_nodes++;
+    }
+
+    frozen->nr_nodes = nr_nodes;
+
+    st.frozen = frozen;
+    st.key_func = key_func;
+    st.next = tree->leftmost;
+    st.out_of_order = false;
+
+    _wavl_tree_freeze_fill(&st, 0);
+
+    if (true == st.out_of_order) {
+        frozen->nr_nodes = 0;
+        ret = WAVL_ERR_BAD_ARG;
+    }
+
+done:
+    return ret;
+}
+
+/**
+ * Branch-free search for the index of the first key >= the given key. Returns nr_nodes if
+ * there is no such key.
+ */
+static inline
+size_t _wavl_frozen_lower_bound_index(struct wavl_frozen *frozen, uint64_t key)
+{
+    const uint64_t *keys = frozen->keys;
+    size_t n = frozen->nr_nodes,
+           i = 0,
+           k = 0;
+
+    while (i < n) {
+        /* The 16 descendants 4 levels down are adjacent: fetch that cache line now */
+        __builtin_prefetch((const void *)((uintptr_t)keys + (16 * i + 15) * sizeof(uint64_t)));
+        i = 2 * i + 1 + (keys[i] < key);
+    }
+
+    /*
+     * Every right turn taken after the last left turn took us past keys that were too
+     * small. Undo those, and the final left turn, to land on the lower bound. Here k is the
+     * 1-based index of the final position.
+     */
+    k = i + 1;
+    k >>= __builtin_ffsll(~(long long)k);
+
+    return 0 == k ? n : k - 1;
+}
+
+wavl_result_t wavl_frozen_find(struct wavl_frozen *frozen,
+                               uint64_t key,
+                               struct wavl_tree_node **pfound)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    size_t i = 0;
+
+    WAVL_ASSERT_ARG(NULL != frozen);
+    WAVL_ASSERT_ARG(NULL != pfound);
+
+    i = _wavl_frozen_lower_bound_index(frozen, key);
+
+    if (i == frozen->nr_nodes || frozen->keys[i] != key) {
+        *pfound = NULL;
+        ret = WAVL_ERR_TREE_NOT_FOUND;
+        goto done;
+    }
 
+    *pfound = frozen->nodes[i];
+
+done:
     return ret;
 }
 
+wavl_result_t wavl_frozen_lower_bound(struct wavl_frozen *frozen,
+                                      uint64_t key,
+                                      struct wavl_tree_node **pfound)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    size_t i = 0;
+
+    WAVL_ASSERT_ARG(NULL != frozen);
+    WAVL_ASSERT_ARG(NULL != pfound);
+
+    i = _wavl_frozen_lower_bound_index(frozen, key);
+
+    if (i == frozen->nr_nodes) {
+        *pfound = NULL;
+        ret = WAVL_ERR_TREE_NOT_FOUND;
+        goto done;
+    }
+
+    *pfound = frozen->nodes[i];
+
+done:
+    return ret;
+}
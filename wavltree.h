@@ -44,7 +44,8 @@ wavl_result_t wavl_tree_init(struct wavl_tree *tree,
  *
  * \return WAVL_ERR_OK on success. If a duplicate node is found, returns WAVL_ERR_TREE_DUPE.
  *
- * \note This function rebalances the WAVL tree automatically.
+ * \note This function rebalances the WAVL tree automatically, unless the tree is in
+ *       relaxed-balance mode (see `wavl_tree_set_relaxed`).
  */
 wavl_result_t wavl_tree_insert(struct wavl_tree *tree,
                                void *key,
@@ -64,6 +65,315 @@ wavl_result_t wavl_tree_find(struct wavl_tree *tree,
                              void *key,
                              struct wavl_tree_node **pfound);
 
+/**
+ * Find the first and last items with the given key. Walk from first to last with
+ * `wavl_tree_next` to visit all of them, in insertion order.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param key The key to search for in the tree.
+ * \param pfirst The first item with the key. Set to NULL if there is none.
+ * \param plast The last item with the key. Set to NULL if there is none.
+ *
+ * \return WAVL_ERR_OK when at least one item is found, WAVL_ERR_TREE_NOT_FOUND otherwise.
+ */
+wavl_result_t wavl_tree_equal_range(struct wavl_tree *tree,
+                                    void *key,
+                                    struct wavl_tree_node **pfirst,
+                                    struct wavl_tree_node **plast);
+
+/**
+ * Count the items with the given key. This is O(log n + k) for k matching items.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param key The key to count.
+ * \param pcount The number of items with the key, returned by reference.
+ *
+ * \return WAVL_ERR_OK on success (including when the count is zero), an error code otherwise.
+ */
+wavl_result_t wavl_tree_count(struct wavl_tree *tree,
+                              void *key,
+                              size_t *pcount);
+
+/**
+ * Find the given key in the WAVL tree, starting from a node already in the tree. The search
+ * climbs from the finger only as far as needed to bracket the key, then descends. Walking
+ * through keys in order, each search from the last key found costs O(1) amortized, and a
+ * key d positions away costs O(log d) amortized over such a walk. A single search is still
+ * O(log n) in the worst case: two neighbouring keys can sit on either side of a high
+ * ancestor, and the climb to it and the descent from it are both long.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param finger A node in the tree to start the search from. If NULL, the search starts at
+ *               the root.
+ * \param key The key to search for in the tree.
+ * \param pfound The found node. Set to NULL if the node is not found.
+ *
+ * \return WAVL_ERR_OK when the node is found, WAVL_ERR_TREE_NOT_FOUND if the node is not
+ *         found. The actual node is returned by reference in pfound.
+ */
+wavl_result_t wavl_tree_find_from(struct wavl_tree *tree,
+                                  struct wavl_tree_node *finger,
+                                  void *key,
+                                  struct wavl_tree_node **pfound);
+
+/**
+ * Insert the given item into the WAVL tree, searching for its place starting from a node
+ * already in the tree. See `wavl_tree_find_from`.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param finger A node in the tree to start the search from. If NULL, the search starts at
+ *               the root.
+ * \param key The key of the item being inserted.
+ * \param node The `struct wavl_tree_node` that represents an element to be inserted.
+ *
+ * \return WAVL_ERR_OK on success. If a duplicate node is found, returns WAVL_ERR_TREE_DUPE.
+ *
+ * \note Rebalancing costs the same as for `wavl_tree_insert`: amortized O(1).
+ */
+wavl_result_t wavl_tree_insert_from(struct wavl_tree *tree,
+                                    struct wavl_tree_node *finger,
+                                    void *key,
+                                    struct wavl_tree_node *node);
+
+/**
+ * Insert the given item into a tree keyed by inline integer keys. The integer key (or an
+ * ordered prefix of the full key) is stored in the node itself, so the search compares it
+ * without calling out to the key comparison function, or touching the containing structure.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param prefix The integer key, or a prefix of the full key that orders the same way.
+ * \param key The full key for the item, passed to the key comparison function only when
+ *            prefix is equal to the prefix of a node in the tree. If NULL, the prefix is the
+ *            entire key, and the comparison function is never called.
+ * \param node The `struct wavl_tree_node` that represents an element to be inserted.
+ *
+ * \return WAVL_ERR_OK on success. If a duplicate node is found, returns WAVL_ERR_TREE_DUPE.
+ *         If the library was built without `WAVL_TREE_INLINE_KEY`, returns
+ *         WAVL_ERR_NOT_SUPPORTED.
+ *
+ * \note All nodes in a tree must be inserted using the same function: a tree uses either inline
+ *       keys, or plain `wavl_tree_insert`. `WAVL_TREE_INLINE_KEY` must be defined consistently for
+ *       the library and all users of `struct wavl_tree_node`.
+ */
+wavl_result_t wavl_tree_insert_u64(struct wavl_tree *tree,
+                                   uint64_t prefix,
+                                   void *key,
+                                   struct wavl_tree_node *node);
+
+/**
+ * Find the given key in a tree keyed by inline integer keys. See `wavl_tree_insert_u64`.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param prefix The integer key, or the prefix of the full key.
+ * \param key The full key, or NULL if the prefix is the entire key.
+ * \param pfound The found node. Set to NULL if the node is not found.
+ *
+ * \return WAVL_ERR_OK when the node is found, WAVL_ERR_TREE_NOT_FOUND if the node is not
+ *         found, or WAVL_ERR_NOT_SUPPORTED if the library was built without
+ *         `WAVL_TREE_INLINE_KEY`.
+ */
+wavl_result_t wavl_tree_find_u64(struct wavl_tree *tree,
+                                 uint64_t prefix,
+                                 void *key,
+                                 struct wavl_tree_node **pfound);
+
+/**
+ * Initialize a new WAVL Tree, with options.
+ *
+ * \param tree Pointer to memory to be initialized as a new WAVL tree
+ * \param node_cmp Pointer to function that performs node-to-node comparisons
+ * \param key_cmp Pointer to function that performs key-to-node comparisons
+ * \param flags Zero or more of the following, or'd together:
+ *              * `WAVL_TREE_FLAG_MULTI`: permit duplicate keys. `wavl_tree_insert` places an
+ *                item after all items with an equal key, so equal items stay in the order they
+ *                were inserted. Use `wavl_tree_equal_range` or `wavl_tree_count` to find them;
+ *                `wavl_tree_find` returns any one of them. `wavl_tree_insert_from` and
+ *                `wavl_tree_update_key` also accept duplicates; the inline-key and byte-string
+ *                functions still return WAVL_ERR_TREE_DUPE.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ */
+wavl_result_t wavl_tree_init_flags(struct wavl_tree *tree,
+                                   wavl_node_to_node_compare_func_t node_cmp,
+                                   wavl_key_to_node_compare_func_t key_cmp,
+                                   uint32_t flags);
+
+/**
+ * Initialize a new WAVL tree keyed by variable-length byte strings. The tree provides its own
+ * comparison functions, so `wavl_tree_insert` and `wavl_tree_find` take a pointer to a
+ * `struct wavl_bytes` as the key. `wavl_tree_insert_bytes` and `wavl_tree_find_bytes` are
+ * faster for long keys with shared prefixes.
+ *
+ * \param tree Pointer to memory to be initialized as a new WAVL tree
+ * \param node_bytes Pointer to function that gets the key of a node. The key must not change
+ *                   while the node is in the tree.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ */
+wavl_result_t wavl_tree_init_bytes(struct wavl_tree *tree,
+                                   wavl_node_to_bytes_func_t node_bytes);
+
+/**
+ * Insert the given item into a tree keyed by byte strings. During the descent, the length of
+ * the prefix the key shares with the nearest nodes on either side is tracked. Every node
+ * below shares at least the shorter of the two, so each comparison starts past it.
+ *
+ * \param tree Pointer to the tree state structure, initialized with `wavl_tree_init_bytes`.
+ * \param key The key of the item being inserted.
+ * \param len Length of the key, in bytes.
+ * \param node The `struct wavl_tree_node` that represents an element to be inserted.
+ *
+ * \return WAVL_ERR_OK on success. If a duplicate node is found, returns WAVL_ERR_TREE_DUPE.
+ *         If the tree is not keyed by byte strings, returns WAVL_ERR_BAD_ARG.
+ */
+wavl_result_t wavl_tree_insert_bytes(struct wavl_tree *tree,
+                                     const void *key,
+                                     size_t len,
+                                     struct wavl_tree_node *node);
+
+/**
+ * Find the given key in a tree keyed by byte strings. See `wavl_tree_insert_bytes`.
+ *
+ * \param tree Pointer to the tree state structure, initialized with `wavl_tree_init_bytes`.
+ * \param key The key to search for.
+ * \param len Length of the key, in bytes.
+ * \param pfound The found node. Set to NULL if the node is not found.
+ *
+ * \return WAVL_ERR_OK when the node is found, WAVL_ERR_TREE_NOT_FOUND if the node is not
+ *         found. If the tree is not keyed by byte strings, returns WAVL_ERR_BAD_ARG.
+ */
+wavl_result_t wavl_tree_find_bytes(struct wavl_tree *tree,
+                                   const void *key,
+                                   size_t len,
+                                   struct wavl_tree_node **pfound);
+
+/**
+ * Number of lookups `wavl_tree_find_batch` keeps in flight at once.
+ */
+#define WAVL_TREE_FIND_BATCH_WIDTH      16
+
+/**
+ * Find a batch of keys in the WAVL tree. Up to `WAVL_TREE_FIND_BATCH_WIDTH` searches are
+ * advanced one level at a time, round-robin, prefetching the next node of each search.
+ * The memory latency of each search is then hidden behind the work on the others.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param keys Array of keys to search for.
+ * \param nr_keys Number of keys in the keys array.
+ * \param results Array of nr_keys node pointers. Each is set to the node found for the key
+ *                at the same index, or NULL if that key is not in the tree.
+ *
+ * \return WAVL_ERR_OK if all searches completed (whether or not the keys were found), or
+ *         the error returned by the key comparison function. The contents of results are
+ *         undefined in the latter case.
+ */
+wavl_result_t wavl_tree_find_batch(struct wavl_tree *tree,
+                                   void *const *keys,
+                                   size_t nr_keys,
+                                   struct wavl_tree_node **results);
+
+/**
+ * Give a tree a lookup cache, in front of the descent done by `wavl_tree_find`. The cache is
+ * split into sets of `WAVL_TREE_CACHE_WAYS` slots, and the hash of a key picks the set. A
+ * lookup first checks the set for a slot with the same hash, and confirms it with one call
+ * to the key comparison function, so a hit skips the descent. A node found by descending
+ * takes the last slot of its set, and moves to the front when it is hit again, so keys
+ * that are looked up once do not push out the keys that are looked up all the time.
+ *
+ * Removing a node drops it from the cache. Before changing the key of a node, call
+ * `wavl_tree_cache_forget` on it, while its hash is still that of the old key.
+ * `wavl_tree_relayout` moves every node, so it empties the cache. With
+ * `WAVL_TREE_STATS`, the `cache_hits` and `cache_misses` counters show how well the cache
+ * is working.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param key_hash Pointer to function that hashes a key, as passed to `wavl_tree_find`.
+ * \param node_hash Pointer to function that hashes the key of a node. Must agree with
+ *                  key_hash.
+ * \param slots Array of nr_slots cache slots. Must stay valid as long as the cache is in use.
+ *              Its contents on entry do not matter. Pass NULL to remove the cache.
+ * \param nr_slots Number of slots. Must be a power of two, and at least
+ *                 `WAVL_TREE_CACHE_WAYS`, unless slots is NULL.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ */
+wavl_result_t wavl_tree_set_cache(struct wavl_tree *tree,
+                                  wavl_key_hash_func_t key_hash,
+                                  wavl_node_hash_func_t node_hash,
+                                  struct wavl_tree_cache_slot *slots,
+                                  size_t nr_slots);
+
+/**
+ * Drop a node from the lookup cache of a tree, if it is there. The node is found by the hash
+ * of its current key, so this must be called before the key changes.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param node The node to drop.
+ *
+ * eturn WAVL_ERR_OK on success, an error code otherwise.
+ */
+wavl_result_t wavl_tree_cache_forget(struct wavl_tree *tree,
+                                     struct wavl_tree_node *node);
+
+/**
+ * Put a tree in relaxed-balance mode, or take it out. In relaxed mode, the insertion
+ * functions do not search or touch the tree at all: they append the new item to a list of
+ * staged items, threaded through the item's own node, in O(1). `wavl_tree_rebalance_step`
+ * then moves staged items into the tree a few at a time, oldest first, when the caller has
+ * time to spare. The duplicate check is deferred to the step too: a staged item whose key is
+ * already in the tree (in a tree without `WAVL_TREE_FLAG_MULTI`) is handed to on_dupe, and
+ * the step carries on with the next one.
+ *
+ * Queries see the staged items, because every function that reads the tree (lookups, the
+ * ordered queries, walks and images) first moves all staged items in. A burst of inserts
+ * therefore costs little until the next read, or until a step is run. Removing, replacing or
+ * re-keying a staged item is O(1), and does not touch the tree. Removals of items in the
+ * tree are not deferred, and still rebalance as they go.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param on_dupe Function to take back a staged item that turns out to be a duplicate. It may
+ *                free the item. Pass NULL to leave relaxed mode: every staged item is first
+ *                moved into the tree.
+ * \param arg Argument passed to on_dupe.
+ *
+ * \return WAVL_ERR_OK on success, or an error from `wavl_tree_rebalance_step` when leaving
+ *         relaxed mode, in which case the tree stays in relaxed mode.
+ *
+ * \note Rank parities leave no room to record a rank violation for later, so the deferred
+ *       work is held as whole items rather than as violations marked in the tree.
+ */
+wavl_result_t wavl_tree_set_relaxed(struct wavl_tree *tree,
+                                    wavl_node_dupe_func_t on_dupe,
+                                    void *arg);
+
+/**
+ * Move up to budget staged items into a tree in relaxed-balance mode, oldest first,
+ * rebalancing the tree after each one. A staged item with the same key as an item in the tree
+ * is handed to the on_dupe function given to `wavl_tree_set_relaxed` instead, and counts
+ * against the budget. Items with equal keys (in a tree with `WAVL_TREE_FLAG_MULTI`) end up in
+ * the order they were inserted.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param budget Largest number of items to move.
+ *
+ * \return WAVL_ERR_OK on success, even if items remain staged (or the tree is not in relaxed
+ *         mode), or the error returned by the node comparison function, in which case the
+ *         item being moved stays staged.
+ */
+wavl_result_t wavl_tree_rebalance_step(struct wavl_tree *tree,
+                                       size_t budget);
+
+/**
+ * Get the number of items inserted in relaxed-balance mode that are not yet in the tree.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param pnr_pending The number of pending items, returned by reference.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ */
+wavl_result_t wavl_tree_get_pending(struct wavl_tree *tree,
+                                    size_t *pnr_pending);
+
 /**
  * Remove the specified item directly from the WAVL tree. If you do not already
  * have a reference to the node itself, use `wavl_tree_find` to get a reference
@@ -79,3 +389,311 @@ wavl_result_t wavl_tree_find(struct wavl_tree *tree,
 wavl_result_t wavl_tree_remove(struct wavl_tree *tree,
                                struct wavl_tree_node *node);
 
+/**
+ * Replace an item in the WAVL tree with another item with an equal key. The new node takes the
+ * place of the old one in constant time: no keys are compared, and the tree is not rebalanced.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param old The node to replace. Must be in the tree.
+ * \param new The node to put in its place. Must not be in the tree.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ *
+ * \note The key of new must compare equal to the key of old. This is not checked. On
+ *       success, old is no longer in the tree.
+ */
+wavl_result_t wavl_tree_replace(struct wavl_tree *tree,
+                                struct wavl_tree_node *old,
+                                struct wavl_tree_node *new);
+
+/**
+ * Reposition an item after its key has changed. The new key is compared with the keys of the
+ * item's neighbours: if it still falls between them, the tree is left as it is. Otherwise the
+ * item is removed, and inserted again starting from the neighbour on the side it moved toward
+ * (see `wavl_tree_insert_from`), so a small move costs little more than a small search.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param node The item whose key has changed. Must be in the tree.
+ * \param key The new key of the item. The containing structure must already hold this key,
+ *            since the neighbours of node are compared against it.
+ *
+ * \return WAVL_ERR_OK on success. If the new key is a duplicate of another item's key (in a
+ *         tree without `WAVL_TREE_FLAG_MULTI`), returns WAVL_ERR_TREE_DUPE. On that or any
+ *         other error, the item stays in the tree at its old position, and the caller must
+ *         put its old key back (or remove it) before the tree is used again.
+ *
+ * \note In a tree with a lookup cache, call `wavl_tree_cache_forget` on the item before
+ *       changing its key.
+ *
+ * \note Trees filled with `wavl_tree_insert_u64` must use `wavl_tree_update_key_u64`, which
+ *       also updates the prefix stored in the node.
+ */
+wavl_result_t wavl_tree_update_key(struct wavl_tree *tree,
+                                   struct wavl_tree_node *node,
+                                   void *key);
+
+/**
+ * Reposition an item in a tree keyed by inline integer keys after its key has changed, as
+ * `wavl_tree_update_key` does, and store its new prefix. If the item is still in order, only
+ * the prefix changes. Otherwise it is inserted again from the root, as
+ * `wavl_tree_insert_u64` has no finger search.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param node The item whose key has changed. Must be in the tree.
+ * \param prefix The new integer key, or the new prefix of the full key.
+ * \param key The new full key, or NULL if the prefix is the entire key. As for
+ *            `wavl_tree_update_key`, the containing structure must already hold it.
+ *
+ * \return WAVL_ERR_OK on success, or an error as for `wavl_tree_update_key`, in which case
+ *         the item and its stored prefix stay as they were. If the library was built without
+ *         `WAVL_TREE_INLINE_KEY`, returns WAVL_ERR_NOT_SUPPORTED.
+ */
+wavl_result_t wavl_tree_update_key_u64(struct wavl_tree *tree,
+                                       struct wavl_tree_node *node,
+                                       uint64_t prefix,
+                                       void *key);
+
+/**
+ * Get the minimum node of the WAVL tree. The minimum is cached, so this is O(1), once any
+ * items staged in relaxed-balance mode are in the tree.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param pmin The node with the smallest key, returned by reference. Set to NULL if the
+ *             tree is empty.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_TREE_NOT_FOUND if the tree is empty.
+ */
+wavl_result_t wavl_tree_min(struct wavl_tree *tree,
+                            struct wavl_tree_node **pmin);
+
+/**
+ * Get the maximum node of the WAVL tree. The maximum is cached, so this is O(1), once any
+ * items staged in relaxed-balance mode are in the tree.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param pmax The node with the largest key, returned by reference. Set to NULL if the
+ *             tree is empty.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_TREE_NOT_FOUND if the tree is empty.
+ */
+wavl_result_t wavl_tree_max(struct wavl_tree *tree,
+                            struct wavl_tree_node **pmax);
+
+/**
+ * Get the in-order successor of the given node.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param node Pointer to a node in the tree.
+ * \param pnext The in-order successor of node, returned by reference. Set to NULL if node
+ *              is the last node in the tree.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ */
+wavl_result_t wavl_tree_next(struct wavl_tree *tree,
+                             struct wavl_tree_node *node,
+                             struct wavl_tree_node **pnext);
+
+/**
+ * Remove the specified item from the WAVL tree, and return the item that followed it. This
+ * allows removing items while walking the tree in order, without searching for the place
+ * to continue from after each removal.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param node Pointer to the node to remove from the tree.
+ * \param pnext The in-order successor of node, returned by reference. Set to NULL if node
+ *              was the last node in the tree.
+ *
+ * \return WAVL_ERR_OK on successful removal. Most errors are housekeeping-related.
+ *
+ * \note This function rebalances the WAVL tree automatically.
+ */
+wavl_result_t wavl_tree_remove_and_next(struct wavl_tree *tree,
+                                        struct wavl_tree_node *node,
+                                        struct wavl_tree_node **pnext);
+
+
+/**
+ * Get a snapshot of the statistics counters for the given tree.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param pstats Returns the current counter values by reference.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_NOT_SUPPORTED if the library was built without
+ *         `WAVL_TREE_STATS`. In the latter case, the counters are all returned as zero.
+ *
+ * \note Statistics are compiled out unless `WAVL_TREE_STATS` is defined. The same definition
+ *       must be used for the library and every user of `struct wavl_tree`.
+ */
+wavl_result_t wavl_tree_get_stats(struct wavl_tree *tree,
+                                  struct wavl_tree_stats *pstats);
+
+/**
+ * Walk the entire tree and report on its shape: node count, height, depth distribution,
+ * and the distribution of ranks reconstructed from the stored rank parities. Any
+ * inconsistencies in the rank rule or in the parent links are counted as well.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param report The report, returned by reference.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ *
+ * \note This is an O(n) operation, and uses O(1) additional space.
+ */
+wavl_result_t wavl_tree_inspect(struct wavl_tree *tree,
+                                struct wavl_tree_report *report);
+
+/**
+ * Relocate every element of the tree into a contiguous arena, in van Emde Boas order.
+ * In this layout, every subtree of height h occupies a contiguous run of memory, so
+ * a search touches O(log_B n) cache lines or pages for any block size B, rather than
+ * one for every level of the tree.
+ *
+ * Since the tree is intrusive, the entire containing structure of each node is copied
+ * (using `memcpy`), not just the `struct wavl_tree_node`. All elements of the tree must
+ * be the same size, and all nodes must be at the same offset in their containers.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param arena The memory to relocate the elements into. Must be suitably aligned for
+ *              the containing structure.
+ * \param arena_size Size of the arena, in bytes. Must be at least the number of nodes
+ *                   times `elem_size`.
+ * \param elem_size Size of the structure containing each `struct wavl_tree_node`.
+ * \param node_offset Offset of the `struct wavl_tree_node` in the containing structure.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_NO_SPACE if the arena is too small, or
+ *         WAVL_ERR_TREE_CORRUPT if the tree is inconsistent. The tree is unchanged on
+ *         failure.
+ *
+ * \note On success, the original containers are no longer part of the tree, and their
+ *       `struct wavl_tree_node` contents are undefined. The caller may free them. The
+ *       shape of the tree and all ranks are preserved. The arena must not overlap any
+ *       of the elements currently in the tree.
+ */
+wavl_result_t wavl_tree_relayout(struct wavl_tree *tree,
+                                 void *arena,
+                                 size_t arena_size,
+                                 size_t elem_size,
+                                 size_t node_offset);
+
+/**
+ * Initialize a frozen tree image, with caller-provided storage.
+ *
+ * \param frozen The frozen image to initialize.
+ * \param keys Array of capacity keys.
+ * \param nodes Array of capacity node pointers.
+ * \param capacity The number of entries in the keys and nodes arrays.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ */
+wavl_result_t wavl_frozen_init(struct wavl_frozen *frozen,
+                               uint64_t *keys,
+                               struct wavl_tree_node **nodes,
+                               size_t capacity);
+
+/**
+ * Freeze the current contents of the tree into a read-only image. The tree remains the
+ * source of truth: the image is a snapshot, and must be rebuilt (or discarded) when the
+ * tree is modified.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param key_func Function to get the integer key for a node. The order of the integer keys
+ *                 must match the order of the tree.
+ * \param frozen The frozen image to populate. Any previous contents are replaced.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_NO_SPACE if the tree has more nodes than the image
+ *         has capacity for, or WAVL_ERR_BAD_ARG if key_func does not agree with the order of
+ *         the tree.
+ */
+wavl_result_t wavl_tree_freeze(struct wavl_tree *tree,
+                               wavl_node_to_u64_func_t key_func,
+                               struct wavl_frozen *frozen);
+
+/**
+ * Find the node with the given key in a frozen image.
+ *
+ * \param frozen The frozen image.
+ * \param key The key to search for.
+ * \param pfound The found node. Set to NULL if the node is not found.
+ *
+ * \return WAVL_ERR_OK when the node is found, WAVL_ERR_TREE_NOT_FOUND otherwise.
+ */
+wavl_result_t wavl_frozen_find(struct wavl_frozen *frozen,
+                               uint64_t key,
+                               struct wavl_tree_node **pfound);
+
+/**
+ * Find the first node in a frozen image with a key greater than or equal to the given key.
+ *
+ * \param frozen The frozen image.
+ * \param key The key to search for.
+ * \param pfound The found node. Set to NULL if there is no such node.
+ *
+ * \return WAVL_ERR_OK when a node is found, WAVL_ERR_TREE_NOT_FOUND otherwise.
+ */
+wavl_result_t wavl_frozen_lower_bound(struct wavl_frozen *frozen,
+                                      uint64_t key,
+                                      struct wavl_tree_node **pfound);
+
+/**
+ * Initialize a priority queue. A priority queue is a WAVL tree, with removal of the minimum
+ * specialized: the minimum is cached, and has no left child, so it is spliced out directly.
+ *
+ * \param pq Pointer to memory to be initialized as a new priority queue
+ * \param node_cmp Pointer to function that performs node-to-node comparisons
+ * \param key_cmp Pointer to function that performs key-to-node comparisons
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ *
+ * \note As in any WAVL tree, keys must be unique. Items with the same priority (such as
+ *       timers with the same deadline) need a tie-breaker in the key, like a sequence number.
+ */
+wavl_result_t wavl_pq_init(struct wavl_pq *pq,
+                           wavl_node_to_node_compare_func_t node_cmp,
+                           wavl_key_to_node_compare_func_t key_cmp);
+
+/**
+ * Add an item to the priority queue.
+ *
+ * \param pq The priority queue
+ * \param key The key (priority) of the item
+ * \param node The `struct wavl_tree_node` that represents the item
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_TREE_DUPE if the key is already queued.
+ */
+wavl_result_t wavl_pq_push(struct wavl_pq *pq,
+                           void *key,
+                           struct wavl_tree_node *node);
+
+/**
+ * Get the item with the smallest key, without removing it. This is O(1).
+ *
+ * \param pq The priority queue
+ * \param pmin The item, returned by reference. Set to NULL if the queue is empty.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_TREE_NOT_FOUND if the queue is empty.
+ */
+wavl_result_t wavl_pq_peek_min(struct wavl_pq *pq,
+                               struct wavl_tree_node **pmin);
+
+/**
+ * Remove the item with the smallest key, and return it.
+ *
+ * \param pq The priority queue
+ * \param pmin The removed item, returned by reference. Set to NULL if the queue is empty.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_TREE_NOT_FOUND if the queue is empty.
+ */
+wavl_result_t wavl_pq_pop_min(struct wavl_pq *pq,
+                              struct wavl_tree_node **pmin);
+
+/**
+ * Remove an arbitrary item from the priority queue, such as a timer being cancelled.
+ *
+ * \param pq The priority queue
+ * \param node The item to remove. Must be in the queue.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ */
+wavl_result_t wavl_pq_remove(struct wavl_pq *pq,
+                             struct wavl_tree_node *node);
+
@@ -0,0 +1,1851 @@
+/*
+ * Copyright (c) 2021, Phil Vachon <phil@security-embedded.com>>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** \file wavltree_bench.c
+ * Microbenchmarks for the WAVL tree. Each workload is timed per operation type
+ * (insert, find, remove). When run with `-p`, Linux hardware performance counters
+ * are sampled around each phase as well.
+ */
+
+#define _GNU_SOURCE
+
+#include "wavltree.h"
+#include "wavltree_compact.h"
+#include "wavltree_slab.h"
+#include "wavltree_parallel.h"
+#include "wavltree_htree.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#define BENCH_NODE(_x) WAVL_CONTAINER_OF((_x), struct bench_node, node)
+
+/**
+ * Node used for benchmarking
+ */
+struct bench_node {
+    uint64_t key;                   /**< The key of this node */
+    struct wavl_tree_node node;     /**< The tree node */
+};
+
+/**
+ * The hardware counters we try to sample. Any of these can be missing; the
+ * benchmark reports whatever the kernel and hardware will give us.
+ */
+enum bench_counter {
+    BENCH_CTR_INSTRUCTIONS,
+    BENCH_CTR_BRANCH_MISSES,
+    BENCH_CTR_L1D_MISSES,
+    BENCH_CTR_LLC_MISSES,
+    BENCH_CTR_DTLB_MISSES,
+    BENCH_CTR_MAX,
+};
+
+static
+const char *bench_counter_names[BENCH_CTR_MAX] = {
+    [BENCH_CTR_INSTRUCTIONS] = "insns",
+    [BENCH_CTR_BRANCH_MISSES] = "br-miss",
+    [BENCH_CTR_L1D_MISSES] = "l1d-miss",
+    [BENCH_CTR_LLC_MISSES] = "llc-miss",
+    [BENCH_CTR_DTLB_MISSES] = "dtlb-miss",
+};
+
+/**
+ * A set of open performance counters. A file descriptor of -1 means the counter
+ * is not available.
+ */
+struct bench_counters {
+    int fds[BENCH_CTR_MAX];
+    uint64_t values[BENCH_CTR_MAX];
+};
+
+/**
+ * Results for a single phase of a workload
+ */
+struct bench_phase {
+    uint64_t nsec;
+    struct bench_counters ctrs;
+};
+
+static
+uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#ifdef __linux__
+static
+int bench_perf_open(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+#define BENCH_HW_CACHE(_cache, _op, _result) \
+    ((_cache) | ((_op) << 8) | ((_result) << 16))
+
+static
+void bench_counters_open(struct bench_counters *ctrs)
+{
+    ctrs->fds[BENCH_CTR_INSTRUCTIONS] =
+        bench_perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    ctrs->fds[BENCH_CTR_BRANCH_MISSES] =
+        bench_perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    ctrs->fds[BENCH_CTR_L1D_MISSES] =
+        bench_perf_open(PERF_TYPE_HW_CACHE,
+                BENCH_HW_CACHE(PERF_COUNT_HW_CACHE_L1D,
+                    PERF_COUNT_HW_CACHE_OP_READ,
+                    PERF_COUNT_HW_CACHE_RESULT_MISS));
+    ctrs->fds[BENCH_CTR_LLC_MISSES] =
+        bench_perf_open(PERF_TYPE_HW_CACHE,
+                BENCH_HW_CACHE(PERF_COUNT_HW_CACHE_LL,
+                    PERF_COUNT_HW_CACHE_OP_READ,
+                    PERF_COUNT_HW_CACHE_RESULT_MISS));
+    ctrs->fds[BENCH_CTR_DTLB_MISSES] =
+        bench_perf_open(PERF_TYPE_HW_CACHE,
+                BENCH_HW_CACHE(PERF_COUNT_HW_CACHE_DTLB,
+                    PERF_COUNT_HW_CACHE_OP_READ,
+                    PERF_COUNT_HW_CACHE_RESULT_MISS));
+}
+
+static
+void bench_counters_start(struct bench_counters *ctrs)
+{
+    for (size_t i = 0; i < BENCH_CTR_MAX; i++) {
+        if (0 > ctrs->fds[i]) {
+            continue;
+        }
+        ioctl(ctrs->fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(ctrs->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static
+void bench_counters_stop(struct bench_counters *ctrs)
+{
+    for (size_t i = 0; i < BENCH_CTR_MAX; i++) {
+        uint64_t value = 0;
+
+        ctrs->values[i] = 0;
+
+        if (0 > ctrs->fds[i]) {
+            continue;
+        }
+
+        ioctl(ctrs->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (sizeof(value) == read(ctrs->fds[i], &value, sizeof(value))) {
+            ctrs->values[i] = value;
+        }
+    }
+}
+
+static
+void bench_counters_close(struct bench_counters *ctrs)
+{
+    for (size_t i = 0; i < BENCH_CTR_MAX; i++) {
+        if (0 <= ctrs->fds[i]) {
+            close(ctrs->fds[i]);
+        }
+        ctrs->fds[i] = -1;
+    }
+}
+#else /* !defined(__linux__) */
+static
+void bench_counters_open(struct bench_counters *ctrs)
+{
+    for (size_t i = 0; i < BENCH_CTR_MAX; i++) {
+        ctrs->fds[i] = -1;
+    }
+}
+
+static
+void bench_counters_start(struct bench_counters *ctrs)
+{
+    (void)ctrs;
+}
+
+static
+void bench_counters_stop(struct bench_counters *ctrs)
+{
+    memset(ctrs->values, 0, sizeof(ctrs->values));
+}
+
+static
+void bench_counters_close(struct bench_counters *ctrs)
+{
+    (void)ctrs;
+}
+#endif /* defined(__linux__) */
+
+static
+void bench_counters_disable(struct bench_counters *ctrs)
+{
+    for (size_t i = 0; i < BENCH_CTR_MAX; i++) {
+        ctrs->fds[i] = -1;
+        ctrs->values[i] = 0;
+    }
+}
+
+static
+bool bench_counters_any(struct bench_counters *ctrs)
+{
+    for (size_t i = 0; i < BENCH_CTR_MAX; i++) {
+        if (0 <= ctrs->fds[i]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Start a timed phase
+ */
+static
+void bench_phase_start(struct bench_phase *phase, struct bench_counters *ctrs)
+{
+    bench_counters_start(ctrs);
+    phase->nsec = bench_now_ns();
+}
+
+/**
+ * Complete a timed phase, capturing the counter values
+ */
+static
+void bench_phase_stop(struct bench_phase *phase, struct bench_counters *ctrs)
+{
+    phase->nsec = bench_now_ns() - phase->nsec;
+    bench_counters_stop(ctrs);
+    phase->ctrs = *ctrs;
+}
+
+static
+void bench_phase_report(const char *workload, const char *op,
+                        struct bench_phase *phase, size_t nr_ops)
+{
+    printf("%-8s %-8s %10zu ops %9.2f ns/op", workload, op, nr_ops,
+            (double)phase->nsec / (double)nr_ops);
+
+    for (size_t i = 0; i < BENCH_CTR_MAX; i++) {
+        if (0 > phase->ctrs.fds[i]) {
+            printf(" %s=n/a", bench_counter_names[i]);
+        } else {
+            printf(" %s=%.2f", bench_counter_names[i],
+                    (double)phase->ctrs.values[i] / (double)nr_ops);
+        }
+    }
+
+    printf("\n");
+}
+
+static
+wavl_result_t _bench_node_to_node_compare_func(struct wavl_tree *tree __attribute__((unused)),
+                                               struct wavl_tree_node *lhs,
+                                               struct wavl_tree_node *rhs,
+                                               int *pdir)
+{
+    uint64_t l = BENCH_NODE(lhs)->key,
+             r = BENCH_NODE(rhs)->key;
+
+    *pdir = (l > r) - (l < r);
+    return WAVL_ERR_OK;
+}
+
+static
+wavl_result_t _bench_key_to_node_compare_func(struct wavl_tree *tree __attribute__((unused)),
+                                              void *key_lhs,
+                                              struct wavl_tree_node *rhs,
+                                              int *pdir)
+{
+    uint64_t l = (uint64_t)(uintptr_t)key_lhs,
+             r = BENCH_NODE(rhs)->key;
+
+    *pdir = (l > r) - (l < r);
+    return WAVL_ERR_OK;
+}
+
+static
+uint64_t _bench_node_to_u64_func(struct wavl_tree_node *node)
+{
+    return BENCH_NODE(node)->key;
+}
+
+static
+uint64_t bench_xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    return *state = x;
+}
+
+/**
+ * Fisher-Yates shuffle of the node pointer array
+ */
+static
+void bench_shuffle(struct bench_node **order, size_t nr, uint64_t *seed)
+{
+    for (size_t i = nr - 1; i > 0; i--) {
+        size_t j = bench_xorshift64(seed) % (i + 1);
+        struct bench_node *tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+}
+
+/**
+ * Run a single workload: insert all nodes in the given order, find all of them in a
+ * shuffled order (one at a time, batched, then from a frozen image), find them all in
+ * ascending order (from the root, then from a finger), then remove them all in another
+ * shuffled order.
+ */
+static
+int bench_run_workload(const char *name, struct bench_node **order, size_t nr,
+                       void **keys, struct wavl_tree_node **results, uint64_t *frozen_keys,
+                       uint64_t *seed, struct bench_counters *ctrs)
+{
+    struct wavl_tree tree;
+    struct wavl_frozen frozen;
+    struct bench_phase phase;
+    struct wavl_tree_node *finger = NULL;
+
+    if (WAVL_FAILED(wavl_tree_init(&tree, _bench_node_to_node_compare_func,
+                    _bench_key_to_node_compare_func)))
+    {
+        fprintf(stderr, "Failed to initialize tree\n");
+        return -1;
+    }
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        if (WAVL_FAILED(wavl_tree_insert(&tree, (void *)(uintptr_t)order[i]->key, &order[i]->node))) {
+            fprintf(stderr, "Failed to insert key %" PRIu64 "\n", order[i]->key);
+            return -1;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "insert", &phase, nr);
+
+    bench_shuffle(order, nr, seed);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct wavl_tree_node *found = NULL;
+        if (WAVL_FAILED(wavl_tree_find(&tree, (void *)(uintptr_t)order[i]->key, &found))) {
+            fprintf(stderr, "Failed to find key %" PRIu64 "\n", order[i]->key);
+            return -1;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "find", &phase, nr);
+
+    bench_shuffle(order, nr, seed);
+
+    for (size_t i = 0; i < nr; i++) {
+        keys[i] = (void *)(uintptr_t)order[i]->key;
+    }
+
+    bench_phase_start(&phase, ctrs);
+    if (WAVL_FAILED(wavl_tree_find_batch(&tree, keys, nr, results))) {
+        fprintf(stderr, "Failed to run batched search\n");
+        return -1;
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "find-bat", &phase, nr);
+
+    for (size_t i = 0; i < nr; i++) {
+        if (&order[i]->node != results[i]) {
+            fprintf(stderr, "Batched search for key %" PRIu64 " returned the wrong node\n", order[i]->key);
+            return -1;
+        }
+    }
+
+    /* Reuse the result array for the frozen image's node pointers */
+    wavl_frozen_init(&frozen, frozen_keys, results, nr);
+
+    bench_phase_start(&phase, ctrs);
+    if (WAVL_FAILED(wavl_tree_freeze(&tree, _bench_node_to_u64_func, &frozen))) {
+        fprintf(stderr, "Failed to freeze tree\n");
+        return -1;
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "freeze", &phase, nr);
+
+    bench_shuffle(order, nr, seed);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct wavl_tree_node *found = NULL;
+        if (WAVL_FAILED(wavl_frozen_find(&frozen, order[i]->key, &found))) {
+            fprintf(stderr, "Failed to find key %" PRIu64 " in frozen image\n", order[i]->key);
+            return -1;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "find-frz", &phase, nr);
+
+    /* Ascending keys, from the root, then from the node found for the previous key */
+    bench_phase_start(&phase, ctrs);
+    for (uint64_t key = 1; key <= nr; key++) {
+        struct wavl_tree_node *found = NULL;
+        if (WAVL_FAILED(wavl_tree_find(&tree, (void *)(uintptr_t)key, &found))) {
+            fprintf(stderr, "Failed to find key %" PRIu64 "\n", key);
+            return -1;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "find-asc", &phase, nr);
+
+    bench_phase_start(&phase, ctrs);
+    for (uint64_t key = 1; key <= nr; key++) {
+        if (WAVL_FAILED(wavl_tree_find_from(&tree, finger, (void *)(uintptr_t)key, &finger))) {
+            fprintf(stderr, "Failed to find key %" PRIu64 " from finger\n", key);
+            return -1;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "find-fgr", &phase, nr);
+
+    bench_shuffle(order, nr, seed);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        if (WAVL_FAILED(wavl_tree_remove(&tree, &order[i]->node))) {
+            fprintf(stderr, "Failed to remove key %" PRIu64 "\n", order[i]->key);
+            return -1;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "remove", &phase, nr);
+
+    return 0;
+}
+
+#ifdef WAVL_TREE_INLINE_KEY
+/**
+ * Insert, find and remove using inline integer keys, so the comparison function is never
+ * called and the containing structure is never touched.
+ */
+static
+int bench_run_u64(const char *name, struct bench_node **order, size_t nr,
+                  uint64_t *seed, struct bench_counters *ctrs)
+{
+    struct wavl_tree tree;
+    struct bench_phase phase;
+
+    if (WAVL_FAILED(wavl_tree_init(&tree, _bench_node_to_node_compare_func,
+                    _bench_key_to_node_compare_func)))
+    {
+        fprintf(stderr, "Failed to initialize tree\n");
+        return -1;
+    }
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        if (WAVL_FAILED(wavl_tree_insert_u64(&tree, order[i]->key, NULL, &order[i]->node))) {
+            fprintf(stderr, "Failed to insert key %" PRIu64 "\n", order[i]->key);
+            return -1;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "insert", &phase, nr);
+
+    bench_shuffle(order, nr, seed);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct wavl_tree_node *found = NULL;
+        if (WAVL_FAILED(wavl_tree_find_u64(&tree, order[i]->key, NULL, &found))) {
+            fprintf(stderr, "Failed to find key %" PRIu64 "\n", order[i]->key);
+            return -1;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "find", &phase, nr);
+
+    bench_shuffle(order, nr, seed);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        if (WAVL_FAILED(wavl_tree_remove(&tree, &order[i]->node))) {
+            fprintf(stderr, "Failed to remove key %" PRIu64 "\n", order[i]->key);
+            return -1;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "remove", &phase, nr);
+
+    return 0;
+}
+#endif /* defined(WAVL_TREE_INLINE_KEY) */
+
+/**
+ * Node used for benchmarking the compact tree
+ */
+struct bench_cnode {
+    uint64_t key;                   /**< The key of this node */
+    struct wavl_ctree_node node;    /**< The compact tree node */
+};
+
+#define BENCH_CNODE(_x) WAVL_CONTAINER_OF((_x), struct bench_cnode, node)
+
+static
+wavl_result_t _bench_key_to_cnode_compare_func(struct wavl_ctree *tree, void *key, struct wavl_ctree_node *rhs, int *pdir)
+{
+    uint64_t lhs_key = (uint64_t)(uintptr_t)key,
+             rhs_key = BENCH_CNODE(rhs)->key;
+
+    (void)tree;
+
+    *pdir = lhs_key < rhs_key ? -1 : (lhs_key > rhs_key ? 1 : 0);
+
+    return WAVL_ERR_OK;
+}
+
+/**
+ * Insert, find and remove using the compact (parent-pointer free) tree, in the same order as
+ * the given nodes.
+ */
+static
+int bench_run_compact(const char *name, struct bench_node **order, size_t nr,
+                      uint64_t *seed, struct bench_counters *ctrs)
+{
+    struct wavl_ctree tree;
+    struct bench_phase phase;
+    struct bench_cnode *cnodes = NULL;
+    int ret = -1;
+
+    if (NULL == (cnodes = calloc(nr, sizeof(*cnodes)))) {
+        fprintf(stderr, "Failed to allocate %zu compact nodes\n", nr);
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr; i++) {
+        cnodes[i].key = order[i]->key;
+    }
+
+    if (WAVL_FAILED(wavl_ctree_init(&tree, _bench_key_to_cnode_compare_func))) {
+        fprintf(stderr, "Failed to initialize tree\n");
+        goto done;
+    }
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        if (WAVL_FAILED(wavl_ctree_insert(&tree, (void *)(uintptr_t)cnodes[i].key, &cnodes[i].node))) {
+            fprintf(stderr, "Failed to insert key %" PRIu64 "\n", cnodes[i].key);
+            goto done;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "insert", &phase, nr);
+
+    bench_shuffle(order, nr, seed);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct wavl_ctree_node *found = NULL;
+        if (WAVL_FAILED(wavl_ctree_find(&tree, (void *)(uintptr_t)order[i]->key, &found))) {
+            fprintf(stderr, "Failed to find key %" PRIu64 "\n", order[i]->key);
+            goto done;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "find", &phase, nr);
+
+    bench_shuffle(order, nr, seed);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        if (WAVL_FAILED(wavl_ctree_remove(&tree, (void *)(uintptr_t)order[i]->key, NULL))) {
+            fprintf(stderr, "Failed to remove key %" PRIu64 "\n", order[i]->key);
+            goto done;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "remove", &phase, nr);
+
+    ret = 0;
+
+done:
+    free(cnodes);
+    return ret;
+}
+
+/**
+ * Length of the URL-like keys used by the byte-string workload, including the terminator
+ */
+#define BENCH_URL_LEN                   64
+
+/**
+ * URL-like keys for the byte-string workload, indexed by bench_node key - 1
+ */
+static
+char *bench_urls = NULL;
+
+static
+struct wavl_bytes _bench_node_to_bytes_func(struct wavl_tree_node *node)
+{
+    const char *url = &bench_urls[(BENCH_NODE(node)->key - 1) * BENCH_URL_LEN];
+
+    return (struct wavl_bytes){ .ptr = url, .len = strlen(url) };
+}
+
+/**
+ * Insert, find and remove using byte-string keys with a long shared prefix. Lookups are
+ * timed both with prefix skipping, and with a full comparison at every node.
+ */
+static
+int bench_run_bytes(const char *name, struct bench_node **order, size_t nr,
+                    uint64_t *seed, struct bench_counters *ctrs)
+{
+    struct wavl_tree tree;
+    struct bench_phase phase;
+    int ret = -1;
+
+    if (NULL == (bench_urls = calloc(nr, BENCH_URL_LEN))) {
+        fprintf(stderr, "Failed to allocate byte-string keys\n");
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr; i++) {
+        snprintf(&bench_urls[(order[i]->key - 1) * BENCH_URL_LEN], BENCH_URL_LEN,
+                "https://www.example.com/catalog/items/by-id/%" PRIu64, order[i]->key);
+    }
+
+    if (WAVL_FAILED(wavl_tree_init_bytes(&tree, _bench_node_to_bytes_func))) {
+        fprintf(stderr, "Failed to initialize tree\n");
+        goto done;
+    }
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct wavl_bytes key = _bench_node_to_bytes_func(&order[i]->node);
+        if (WAVL_FAILED(wavl_tree_insert_bytes(&tree, key.ptr, key.len, &order[i]->node))) {
+            fprintf(stderr, "Failed to insert key %" PRIu64 "\n", order[i]->key);
+            goto done;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "insert", &phase, nr);
+
+    bench_shuffle(order, nr, seed);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct wavl_tree_node *found = NULL;
+        struct wavl_bytes key = _bench_node_to_bytes_func(&order[i]->node);
+        if (WAVL_FAILED(wavl_tree_find_bytes(&tree, key.ptr, key.len, &found))) {
+            fprintf(stderr, "Failed to find key %" PRIu64 "\n", order[i]->key);
+            goto done;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "find", &phase, nr);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct wavl_tree_node *found = NULL;
+        struct wavl_bytes key = _bench_node_to_bytes_func(&order[i]->node);
+        if (WAVL_FAILED(wavl_tree_find(&tree, &key, &found))) {
+            fprintf(stderr, "Failed to find key %" PRIu64 "\n", order[i]->key);
+            goto done;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "find-cmp", &phase, nr);
+
+    bench_shuffle(order, nr, seed);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        if (WAVL_FAILED(wavl_tree_remove(&tree, &order[i]->node))) {
+            fprintf(stderr, "Failed to remove key %" PRIu64 "\n", order[i]->key);
+            goto done;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "remove", &phase, nr);
+
+    ret = 0;
+
+done:
+    free(bench_urls);
+    bench_urls = NULL;
+    return ret;
+}
+
+/**
+ * Timer keys carry the index of the node in the low bits, so that every key is unique, and the
+ * deadline above them.
+ */
+#define BENCH_TIMER_ID_BITS             24
+#define BENCH_TIMER_MAX                 (1ull << BENCH_TIMER_ID_BITS)
+
+/**
+ * Get the next deadline for the given timer key: a pseudorandom interval later.
+ */
+static inline
+uint64_t bench_timer_next(uint64_t key, uint64_t *rng)
+{
+    return key + ((1 + bench_xorshift64(rng) % 4096) << BENCH_TIMER_ID_BITS);
+}
+
+/**
+ * Binary min-heap of nodes, for comparison with the tree
+ */
+struct bench_bheap {
+    struct bench_node **heap;
+    size_t nr;
+};
+
+static
+void bench_bheap_push(struct bench_bheap *bh, struct bench_node *node)
+{
+    size_t i = bh->nr++;
+
+    while (0 != i) {
+        size_t parent = (i - 1) / 2;
+
+        if (bh->heap[parent]->key <= node->key) {
+            break;
+        }
+
+        bh->heap[i] = bh->heap[parent];
+        i = parent;
+    }
+
+    bh->heap[i] = node;
+}
+
+static
+struct bench_node *bench_bheap_pop(struct bench_bheap *bh)
+{
+    struct bench_node *min = bh->heap[0],
+                      *last = bh->heap[--bh->nr];
+    size_t i = 0;
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+
+        if (child >= bh->nr) {
+            break;
+        }
+
+        if (child + 1 < bh->nr && bh->heap[child + 1]->key < bh->heap[child]->key) {
+            child++;
+        }
+
+        if (last->key <= bh->heap[child]->key) {
+            break;
+        }
+
+        bh->heap[i] = bh->heap[child];
+        i = child;
+    }
+
+    bh->heap[i] = last;
+
+    return min;
+}
+
+/**
+ * Pairing heap node, for comparison with the tree
+ */
+struct bench_pnode {
+    uint64_t key;
+    struct bench_pnode *child,
+                       *sibling;
+};
+
+static
+struct bench_pnode *bench_pheap_meld(struct bench_pnode *a, struct bench_pnode *b)
+{
+    if (NULL == a) {
+        return b;
+    }
+
+    if (NULL == b) {
+        return a;
+    }
+
+    if (b->key < a->key) {
+        struct bench_pnode *tmp = a;
+        a = b;
+        b = tmp;
+    }
+
+    b->sibling = a->child;
+    a->child = b;
+
+    return a;
+}
+
+/**
+ * Pop the minimum of a pairing heap, with the standard two-pass pairing of its children.
+ */
+static
+struct bench_pnode *bench_pheap_pop(struct bench_pnode **proot)
+{
+    struct bench_pnode *min = *proot,
+                       *list = min->child,
+                       *paired = NULL,
+                       *root = NULL;
+
+    /* Meld pairs left to right, building a reversed list of the results */
+    while (NULL != list) {
+        struct bench_pnode *a = list,
+                           *b = a->sibling;
+
+        if (NULL == b) {
+            a->sibling = paired;
+            paired = a;
+            break;
+        }
+
+        list = b->sibling;
+        a->sibling = b->sibling = NULL;
+        a = bench_pheap_meld(a, b);
+        a->sibling = paired;
+        paired = a;
+    }
+
+    /* Then meld the results right to left */
+    while (NULL != paired) {
+        struct bench_pnode *next = paired->sibling;
+        paired->sibling = NULL;
+        root = bench_pheap_meld(root, paired);
+        paired = next;
+    }
+
+    *proot = root;
+    min->child = NULL;
+
+    return min;
+}
+
+/**
+ * Timer queue workload: arm nr timers, then repeatedly expire the earliest and re-arm it at
+ * a later deadline, then expire everything. The same deadlines are generated for the WAVL
+ * priority queue, a binary heap and a pairing heap.
+ */
+static
+int bench_run_timers(struct bench_node *bnodes, size_t nr, uint64_t seed, struct bench_counters *ctrs)
+{
+    struct wavl_pq pq;
+    struct bench_bheap bh = { .heap = NULL, .nr = 0 };
+    struct bench_pnode *pnodes = NULL,
+                       *proot = NULL;
+    struct bench_phase phase;
+    uint64_t rng = seed;
+    uint64_t sum[3] = { 0, 0, 0 };
+    int ret = -1;
+
+    if (nr >= BENCH_TIMER_MAX) {
+        fprintf(stderr, "Skipping timer workload: at most %llu timers are supported\n", BENCH_TIMER_MAX - 1);
+        return 0;
+    }
+
+    if (NULL == (bh.heap = calloc(nr, sizeof(*bh.heap))) ||
+            NULL == (pnodes = calloc(nr, sizeof(*pnodes))))
+    {
+        fprintf(stderr, "Failed to allocate heaps\n");
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr; i++) {
+        WAVL_TREE_NODE_CLEAR(&bnodes[i].node);
+        bnodes[i].key = pnodes[i].key = bench_timer_next(i, &rng);
+    }
+
+    /* WAVL priority queue */
+    if (WAVL_FAILED(wavl_pq_init(&pq, _bench_node_to_node_compare_func, _bench_key_to_node_compare_func))) {
+        fprintf(stderr, "Failed to initialize priority queue\n");
+        goto done;
+    }
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        if (WAVL_FAILED(wavl_pq_push(&pq, (void *)(uintptr_t)bnodes[i].key, &bnodes[i].node))) {
+            fprintf(stderr, "Failed to push key %" PRIu64 "\n", bnodes[i].key);
+            goto done;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report("pq-wavl", "arm", &phase, nr);
+
+    rng = seed;
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct wavl_tree_node *min = NULL;
+        struct bench_node *bn = NULL;
+
+        wavl_pq_pop_min(&pq, &min);
+        bn = BENCH_NODE(min);
+        sum[0] += bn->key;
+        bn->key = bench_timer_next(bn->key, &rng);
+        wavl_pq_push(&pq, (void *)(uintptr_t)bn->key, &bn->node);
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report("pq-wavl", "rearm", &phase, nr);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct wavl_tree_node *min = NULL;
+        wavl_pq_pop_min(&pq, &min);
+        sum[0] += BENCH_NODE(min)->key;
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report("pq-wavl", "expire", &phase, nr);
+
+    /* Binary heap, with the same deadlines */
+    for (size_t i = 0; i < nr; i++) {
+        bnodes[i].key = pnodes[i].key;
+    }
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        bench_bheap_push(&bh, &bnodes[i]);
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report("pq-bheap", "arm", &phase, nr);
+
+    rng = seed;
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct bench_node *bn = bench_bheap_pop(&bh);
+        sum[1] += bn->key;
+        bn->key = bench_timer_next(bn->key, &rng);
+        bench_bheap_push(&bh, bn);
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report("pq-bheap", "rearm", &phase, nr);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        sum[1] += bench_bheap_pop(&bh)->key;
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report("pq-bheap", "expire", &phase, nr);
+
+    /* Pairing heap, with the same deadlines */
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        proot = bench_pheap_meld(proot, &pnodes[i]);
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report("pq-pair", "arm", &phase, nr);
+
+    rng = seed;
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct bench_pnode *pn = bench_pheap_pop(&proot);
+        sum[2] += pn->key;
+        pn->key = bench_timer_next(pn->key, &rng);
+        proot = bench_pheap_meld(proot, pn);
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report("pq-pair", "rearm", &phase, nr);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        sum[2] += bench_pheap_pop(&proot)->key;
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report("pq-pair", "expire", &phase, nr);
+
+    /* All three must have expired the same timers */
+    if (sum[0] != sum[1] || sum[0] != sum[2]) {
+        fprintf(stderr, "Timer queues disagree\n");
+        goto done;
+    }
+
+    ret = 0;
+
+done:
+    free(pnodes);
+    free(bh.heap);
+    return ret;
+}
+
+/**
+ * Build a tree in the given order, then compare lookups before and after relocating the
+ * tree into van Emde Boas order.
+ */
+static
+int bench_run_relayout(const char *name, struct bench_node **order, size_t nr,
+                       uint64_t *seed, struct bench_counters *ctrs)
+{
+    struct wavl_tree tree;
+    struct bench_phase phase;
+    struct bench_node *arena = NULL;
+    int ret = -1;
+
+    if (WAVL_FAILED(wavl_tree_init(&tree, _bench_node_to_node_compare_func,
+                    _bench_key_to_node_compare_func)))
+    {
+        fprintf(stderr, "Failed to initialize tree\n");
+        goto done;
+    }
+
+    if (NULL == (arena = calloc(nr, sizeof(*arena)))) {
+        fprintf(stderr, "Failed to allocate relayout arena\n");
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr; i++) {
+        if (WAVL_FAILED(wavl_tree_insert(&tree, (void *)(uintptr_t)order[i]->key, &order[i]->node))) {
+            fprintf(stderr, "Failed to insert key %" PRIu64 "\n", order[i]->key);
+            goto done;
+        }
+    }
+
+    bench_shuffle(order, nr, seed);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct wavl_tree_node *found = NULL;
+        if (WAVL_FAILED(wavl_tree_find(&tree, (void *)(uintptr_t)order[i]->key, &found))) {
+            fprintf(stderr, "Failed to find key %" PRIu64 "\n", order[i]->key);
+            goto done;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "find", &phase, nr);
+
+    bench_phase_start(&phase, ctrs);
+    if (WAVL_FAILED(wavl_tree_relayout(&tree, arena, nr * sizeof(*arena), sizeof(*arena),
+                    offsetof(struct bench_node, node))))
+    {
+        fprintf(stderr, "Failed to relayout tree\n");
+        goto done;
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "relayout", &phase, nr);
+
+    /* The original nodes still hold their keys, but are no longer in the tree */
+    bench_shuffle(order, nr, seed);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct wavl_tree_node *found = NULL;
+        if (WAVL_FAILED(wavl_tree_find(&tree, (void *)(uintptr_t)order[i]->key, &found))) {
+            fprintf(stderr, "Failed to find key %" PRIu64 "\n", order[i]->key);
+            goto done;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "find-veb", &phase, nr);
+
+    ret = 0;
+
+done:
+    free(arena);
+    return ret;
+}
+
+/**
+ * Where the containers of the slab workload come from
+ */
+enum bench_alloc {
+    BENCH_ALLOC_MALLOC,             /**< malloc, interleaved with other allocations */
+    BENCH_ALLOC_SLAB,               /**< A slab, backed by small pages */
+    BENCH_ALLOC_SLAB_HUGE,          /**< A slab, backed by huge pages */
+};
+
+/**
+ * Allocate, insert, find, churn and free nr containers, with the containers allocated by
+ * malloc or by a slab. With malloc, every container is followed by a filler allocation of
+ * random size, as other data structures would in a real heap, so the nodes are spread over
+ * many more pages.
+ */
+static
+int bench_run_slab(const char *name, enum bench_alloc alloc, struct bench_node **order, size_t nr,
+                   uint64_t *seed, struct bench_counters *ctrs)
+{
+    struct wavl_tree tree;
+    struct wavl_slab slab;
+    struct wavl_slab_cache cache;
+    struct wavl_slab_stats stats;
+    struct bench_phase phase;
+    struct bench_node **conts = NULL;
+    struct wavl_tree_node *found = NULL;
+    void **fillers = NULL;
+    bool have_slab = false,
+         have_tree = false;
+    int ret = -1;
+
+    if (NULL == (conts = calloc(nr, sizeof(*conts))) ||
+            NULL == (fillers = calloc(nr, sizeof(*fillers))))
+    {
+        fprintf(stderr, "Failed to allocate container arrays\n");
+        goto done;
+    }
+
+    if (BENCH_ALLOC_MALLOC != alloc) {
+        if (WAVL_FAILED(wavl_slab_init(&slab, sizeof(struct bench_node),
+                        BENCH_ALLOC_SLAB_HUGE == alloc ? WAVL_SLAB_FLAG_HUGETLB | WAVL_SLAB_FLAG_THP : 0)))
+        {
+            fprintf(stderr, "Failed to initialize slab\n");
+            goto done;
+        }
+        have_slab = true;
+        wavl_slab_cache_init(&cache, &slab);
+    }
+
+    if (WAVL_FAILED(wavl_tree_init(&tree, _bench_node_to_node_compare_func,
+                    _bench_key_to_node_compare_func)))
+    {
+        fprintf(stderr, "Failed to initialize tree\n");
+        goto done;
+    }
+    have_tree = true;
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        void *obj = NULL;
+
+        if (true == have_slab) {
+            if (WAVL_FAILED(wavl_slab_alloc(&cache, &obj))) {
+                obj = NULL;
+            }
+        } else if (NULL != (obj = malloc(sizeof(struct bench_node))) &&
+                NULL == (fillers[i] = malloc(16 + bench_xorshift64(seed) % 256)))
+        {
+            free(obj);
+            obj = NULL;
+        }
+
+        if (NULL == obj) {
+            fprintf(stderr, "Failed to allocate container\n");
+            goto done;
+        }
+
+        conts[i] = obj;
+        conts[i]->key = order[i]->key;
+        WAVL_TREE_NODE_CLEAR(&conts[i]->node);
+        wavl_tree_insert(&tree, (void *)(uintptr_t)conts[i]->key, &conts[i]->node);
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "insert", &phase, nr);
+
+    bench_shuffle(order, nr, seed);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct wavl_tree_node *found = NULL;
+        if (WAVL_FAILED(wavl_tree_find(&tree, (void *)(uintptr_t)order[i]->key, &found))) {
+            fprintf(stderr, "Failed to find key %" PRIu64 "\n", order[i]->key);
+            goto done;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "find", &phase, nr);
+
+    /* Replace each container with a freshly allocated one, in a random order */
+    bench_shuffle(order, nr, seed);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct wavl_tree_node *found = NULL;
+        struct bench_node *cont = NULL;
+        void *obj = NULL;
+
+        wavl_tree_find(&tree, (void *)(uintptr_t)order[i]->key, &found);
+        wavl_tree_remove(&tree, found);
+        cont = BENCH_NODE(found);
+
+        if (true == have_slab) {
+            wavl_slab_free(&cache, cont);
+            if (WAVL_FAILED(wavl_slab_alloc(&cache, &obj))) {
+                obj = NULL;
+            }
+        } else {
+            free(cont);
+            obj = malloc(sizeof(struct bench_node));
+        }
+
+        if (NULL == obj) {
+            fprintf(stderr, "Failed to allocate container\n");
+            goto done;
+        }
+
+        cont = obj;
+        cont->key = order[i]->key;
+        WAVL_TREE_NODE_CLEAR(&cont->node);
+        wavl_tree_insert(&tree, (void *)(uintptr_t)cont->key, &cont->node);
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "churn", &phase, nr);
+
+    bench_shuffle(order, nr, seed);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct wavl_tree_node *found = NULL;
+
+        wavl_tree_find(&tree, (void *)(uintptr_t)order[i]->key, &found);
+        wavl_tree_remove(&tree, found);
+
+        if (true == have_slab) {
+            wavl_slab_free(&cache, BENCH_NODE(found));
+        } else {
+            free(BENCH_NODE(found));
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "remove", &phase, nr);
+
+    if (true == have_slab) {
+        wavl_slab_get_stats(&slab, &stats);
+        fprintf(stdout, "%-8s %zu-byte objects, %zu chunks (%zu hugetlb), %" PRIu64 " refills, %" PRIu64 " drains\n",
+                name, stats.obj_size, stats.nr_chunks, stats.nr_hugetlb_chunks,
+                stats.nr_refills, stats.nr_drains);
+    }
+
+    ret = 0;
+
+done:
+    /* If a phase bailed out, free the containers still in the tree. A slab frees its own. */
+    while (true == have_tree && false == have_slab && WAVL_OK(wavl_tree_min(&tree, &found))) {
+        wavl_tree_remove(&tree, found);
+        free(BENCH_NODE(found));
+    }
+    for (size_t i = 0; NULL != fillers && i < nr; i++) {
+        free(fillers[i]);
+    }
+    if (true == have_slab) {
+        wavl_slab_destroy(&slab);
+    }
+    free(fillers);
+    free(conts);
+    return ret;
+}
+
+static
+wavl_result_t _bench_sum_fold_func(struct wavl_tree *tree __attribute__((unused)),
+                                   struct wavl_tree_node *node,
+                                   void *acc,
+                                   void *arg __attribute__((unused)))
+{
+    *(uint64_t *)acc += BENCH_NODE(node)->key;
+    return WAVL_ERR_OK;
+}
+
+static
+wavl_result_t _bench_sum_combine_func(void *acc,
+                                      const void *other,
+                                      void *arg __attribute__((unused)))
+{
+    *(uint64_t *)acc += *(const uint64_t *)other;
+    return WAVL_ERR_OK;
+}
+
+/**
+ * Build a tree from nodes in the given order, by inserting them one at a time, then with
+ * parallel bulk builds on an increasing number of threads. Then sum the keys of the tree,
+ * in an in-order walk and in parallel reductions.
+ */
+static
+int bench_run_build(const char *name, struct bench_node **order, size_t nr,
+                    struct bench_counters *ctrs)
+{
+    struct wavl_tree tree;
+    struct bench_phase phase;
+    struct wavl_tree_node **nodes = NULL;
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t sum = 0;
+    int ret = -1;
+
+    if (NULL == (nodes = calloc(nr, sizeof(*nodes)))) {
+        fprintf(stderr, "Failed to allocate node array\n");
+        goto done;
+    }
+
+    if (WAVL_FAILED(wavl_tree_init(&tree, _bench_node_to_node_compare_func,
+                    _bench_key_to_node_compare_func)))
+    {
+        fprintf(stderr, "Failed to initialize tree\n");
+        goto done;
+    }
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        WAVL_TREE_NODE_CLEAR(&order[i]->node);
+        wavl_tree_insert(&tree, (void *)(uintptr_t)order[i]->key, &order[i]->node);
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "insert", &phase, nr);
+
+    for (size_t nthreads = 1; nthreads <= (size_t)(nr_cpus < 1 ? 1 : nr_cpus); nthreads *= 2) {
+        char op[32];
+
+        for (size_t i = 0; i < nr; i++) {
+            nodes[i] = &order[i]->node;
+        }
+
+        wavl_tree_init(&tree, _bench_node_to_node_compare_func, _bench_key_to_node_compare_func);
+
+        bench_phase_start(&phase, ctrs);
+        if (WAVL_FAILED(wavl_tree_build_parallel(&tree, nodes, nr, nthreads))) {
+            fprintf(stderr, "Failed to build tree on %zu threads\n", nthreads);
+            goto done;
+        }
+        bench_phase_stop(&phase, ctrs);
+
+        snprintf(op, sizeof(op), "build/%zu", nthreads);
+        bench_phase_report(name, op, &phase, nr);
+    }
+
+    /* Sum every key, walking the tree in order, then with parallel reductions */
+    bench_phase_start(&phase, ctrs);
+    for (struct wavl_tree_node *cur = tree.leftmost; NULL != cur; wavl_tree_next(&tree, cur, &cur)) {
+        sum += BENCH_NODE(cur)->key;
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "walk", &phase, nr);
+
+    for (size_t nthreads = 1; nthreads <= (size_t)(nr_cpus < 1 ? 1 : nr_cpus); nthreads *= 2) {
+        char op[32];
+        uint64_t psum = 0;
+
+        bench_phase_start(&phase, ctrs);
+        wavl_tree_parallel_reduce(&tree, _bench_sum_fold_func, _bench_sum_combine_func,
+                &psum, sizeof(psum), NULL, nthreads);
+        bench_phase_stop(&phase, ctrs);
+
+        if (psum != sum) {
+            fprintf(stderr, "Parallel sum on %zu threads is wrong\n", nthreads);
+            goto done;
+        }
+
+        snprintf(op, sizeof(op), "reduce/%zu", nthreads);
+        bench_phase_report(name, op, &phase, nr);
+    }
+
+    ret = 0;
+
+done:
+    free(nodes);
+    return ret;
+}
+
+static
+uint64_t _bench_node_hash_func(struct wavl_tree_node *node)
+{
+    return BENCH_NODE(node)->key;
+}
+
+static
+uint64_t _bench_key_hash_func(void *key)
+{
+    return (uint64_t)(uintptr_t)key;
+}
+
+/**
+ * Compare exact-match lookups through a hashed tree's table with lookups in its tree.
+ */
+static
+int bench_run_htree(const char *name, struct bench_node **order, size_t nr,
+                    uint64_t *seed, struct bench_counters *ctrs)
+{
+    struct wavl_htree htree;
+    struct wavl_htree_slot *slots = NULL;
+    struct bench_phase phase;
+    size_t nr_slots = 2;
+    int ret = -1;
+
+    while (WAVL_HTREE_CAPACITY(nr_slots) < nr) {
+        nr_slots *= 2;
+    }
+
+    if (NULL == (slots = calloc(nr_slots, sizeof(*slots)))) {
+        fprintf(stderr, "Failed to allocate %zu hash table slots\n", nr_slots);
+        goto done;
+    }
+
+    if (WAVL_FAILED(wavl_htree_init(&htree, _bench_node_to_node_compare_func,
+                    _bench_key_to_node_compare_func, _bench_node_hash_func,
+                    _bench_key_hash_func, slots, nr_slots)))
+    {
+        fprintf(stderr, "Failed to initialize hashed tree\n");
+        goto done;
+    }
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        WAVL_TREE_NODE_CLEAR(&order[i]->node);
+        if (WAVL_FAILED(wavl_htree_insert(&htree, (void *)(uintptr_t)order[i]->key, &order[i]->node))) {
+            fprintf(stderr, "Failed to insert key %" PRIu64 "\n", order[i]->key);
+            goto done;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "insert", &phase, nr);
+
+    bench_shuffle(order, nr, seed);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct wavl_tree_node *found = NULL;
+        wavl_tree_find(wavl_htree_tree(&htree), (void *)(uintptr_t)order[i]->key, &found);
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "tfind", &phase, nr);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct wavl_tree_node *found = NULL;
+        if (WAVL_FAILED(wavl_htree_find(&htree, (void *)(uintptr_t)order[i]->key, &found))) {
+            fprintf(stderr, "Failed to find key %" PRIu64 "\n", order[i]->key);
+            goto done;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "hfind", &phase, nr);
+
+    bench_shuffle(order, nr, seed);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        wavl_htree_remove(&htree, &order[i]->node);
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "remove", &phase, nr);
+
+    ret = 0;
+
+done:
+    free(slots);
+    return ret;
+}
+
+/**
+ * Number of slots in the lookup cache of the zipf workload
+ */
+#define BENCH_CACHE_SLOTS               4096
+
+/**
+ * Look up keys drawn from a Zipf distribution (with exponent 1), without and then with a
+ * lookup cache. The node inserted i-th is the i-th most popular.
+ */
+static
+int bench_run_zipf(const char *name, struct bench_node **order, size_t nr,
+                   uint64_t *seed, struct bench_counters *ctrs)
+{
+    struct wavl_tree tree;
+    struct wavl_tree_cache_slot *slots = NULL;
+    struct bench_phase phase;
+    double *cdf = NULL;
+    uint64_t *lookups = NULL;
+    double total = 0.0;
+    int ret = -1;
+
+    if (NULL == (cdf = calloc(nr, sizeof(*cdf))) ||
+            NULL == (lookups = calloc(nr, sizeof(*lookups))) ||
+            NULL == (slots = calloc(BENCH_CACHE_SLOTS, sizeof(*slots))))
+    {
+        fprintf(stderr, "Failed to allocate zipf workload\n");
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr; i++) {
+        total += 1.0 / (double)(i + 1);
+        cdf[i] = total;
+    }
+
+    for (size_t i = 0; i < nr; i++) {
+        double u = (double)(bench_xorshift64(seed) >> 11) / (double)(1ull << 53) * total;
+        size_t lo = 0,
+               hi = nr - 1;
+
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+
+            if (cdf[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        lookups[i] = order[lo]->key;
+    }
+
+    if (WAVL_FAILED(wavl_tree_init(&tree, _bench_node_to_node_compare_func,
+                    _bench_key_to_node_compare_func)))
+    {
+        fprintf(stderr, "Failed to initialize tree\n");
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr; i++) {
+        WAVL_TREE_NODE_CLEAR(&order[i]->node);
+        wavl_tree_insert(&tree, (void *)(uintptr_t)order[i]->key, &order[i]->node);
+    }
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct wavl_tree_node *found = NULL;
+        wavl_tree_find(&tree, (void *)(uintptr_t)lookups[i], &found);
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "find", &phase, nr);
+
+    wavl_tree_set_cache(&tree, _bench_key_hash_func, _bench_node_hash_func, slots, BENCH_CACHE_SLOTS);
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = 0; i < nr; i++) {
+        struct wavl_tree_node *found = NULL;
+        if (WAVL_FAILED(wavl_tree_find(&tree, (void *)(uintptr_t)lookups[i], &found))) {
+            fprintf(stderr, "Failed to find key %" PRIu64 "\n", lookups[i]);
+            goto done;
+        }
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "cfind", &phase, nr);
+
+    ret = 0;
+
+done:
+    free(slots);
+    free(lookups);
+    free(cdf);
+    return ret;
+}
+
+/**
+ * Number of inserts per burst in the relaxed workload
+ */
+#define BENCH_RELAXED_BURST             1024
+
+/**
+ * Count the staged duplicates handed back in the relaxed workload. The keys are distinct, so
+ * there should be none.
+ */
+static
+void _bench_dupe_func(struct wavl_tree *tree __attribute__((unused)),
+                      struct wavl_tree_node *node __attribute__((unused)),
+                      void *arg)
+{
+    (*(size_t *)arg)++;
+}
+
+/**
+ * Insert the second half of the keys into a tree holding the first half, in bursts: first
+ * rebalancing inline, then in relaxed-balance mode, with the staged items moved into the
+ * tree after each burst. The time spent in the bursts and in the steps is reported apart.
+ * Hardware counters are not sampled, since the timed stretches are short.
+ */
+static
+int bench_run_relaxed(const char *name, struct bench_node **order, size_t nr,
+                      struct bench_counters *ctrs)
+{
+    struct wavl_tree tree;
+    struct bench_phase phase;
+    const size_t half = nr / 2;
+    uint64_t burst_ns = 0,
+             step_ns = 0;
+    size_t nr_dupes = 0;
+    int ret = -1;
+
+    if (WAVL_FAILED(wavl_tree_init(&tree, _bench_node_to_node_compare_func,
+                    _bench_key_to_node_compare_func)))
+    {
+        fprintf(stderr, "Failed to initialize tree\n");
+        goto done;
+    }
+
+    for (size_t i = 0; i < half; i++) {
+        WAVL_TREE_NODE_CLEAR(&order[i]->node);
+        wavl_tree_insert(&tree, (void *)(uintptr_t)order[i]->key, &order[i]->node);
+    }
+
+    bench_phase_start(&phase, ctrs);
+    for (size_t i = half; i < nr; i++) {
+        WAVL_TREE_NODE_CLEAR(&order[i]->node);
+        wavl_tree_insert(&tree, (void *)(uintptr_t)order[i]->key, &order[i]->node);
+    }
+    bench_phase_stop(&phase, ctrs);
+    bench_phase_report(name, "insert", &phase, nr - half);
+
+    for (size_t i = half; i < nr; i++) {
+        wavl_tree_remove(&tree, &order[i]->node);
+    }
+
+    wavl_tree_set_relaxed(&tree, _bench_dupe_func, &nr_dupes);
+
+    for (size_t i = half; i < nr; i += BENCH_RELAXED_BURST) {
+        size_t end = i + BENCH_RELAXED_BURST < nr ? i + BENCH_RELAXED_BURST : nr;
+        uint64_t start = bench_now_ns();
+
+        for (size_t j = i; j < end; j++) {
+            WAVL_TREE_NODE_CLEAR(&order[j]->node);
+            wavl_tree_insert(&tree, (void *)(uintptr_t)order[j]->key, &order[j]->node);
+        }
+
+        burst_ns += bench_now_ns() - start;
+        start = bench_now_ns();
+
+        if (WAVL_FAILED(wavl_tree_rebalance_step(&tree, SIZE_MAX)) || 0 != nr_dupes) {
+            fprintf(stderr, "Failed to move staged items into the tree\n");
+            goto done;
+        }
+
+        step_ns += bench_now_ns() - start;
+    }
+
+    bench_counters_disable(&phase.ctrs);
+
+    phase.nsec = burst_ns;
+    bench_phase_report(name, "rinsert", &phase, nr - half);
+
+    phase.nsec = step_ns;
+    bench_phase_report(name, "step", &phase, nr - half);
+
+    ret = 0;
+
+done:
+    return ret;
+}
+
+static
+void bench_usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n nodes] [-s seed] [-p]\n", name);
+    fprintf(stderr, "  -n nodes   Number of nodes per workload (default 1000000)\n");
+    fprintf(stderr, "  -s seed    Seed for the pseudorandom workloads\n");
+    fprintf(stderr, "  -p         Sample hardware performance counters\n");
+}
+
+int main(int argc, char *const argv[])
+{
+    int ret = EXIT_FAILURE,
+        opt = -1;
+    size_t nr = 1000000;
+    uint64_t seed = 0x9e3779b97f4a7c15ull;
+    bool use_perf = false;
+    struct bench_node *bnodes = NULL;
+    struct bench_node **order = NULL;
+    void **keys = NULL;
+    struct wavl_tree_node **results = NULL;
+    uint64_t *frozen_keys = NULL;
+    struct bench_counters ctrs;
+
+    bench_counters_disable(&ctrs);
+
+    while (-1 != (opt = getopt(argc, argv, "n:s:ph"))) {
+        switch (opt) {
+        case 'n':
+            nr = strtoull(optarg, NULL, 0);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'p':
+            use_perf = true;
+            break;
+        default:
+            bench_usage(argv[0]);
+            goto done;
+        }
+    }
+
+    if (0 == nr || 0 == seed) {
+        bench_usage(argv[0]);
+        goto done;
+    }
+
+    if (true == use_perf) {
+        bench_counters_open(&ctrs);
+        if (false == bench_counters_any(&ctrs)) {
+            fprintf(stderr, "Hardware performance counters are unavailable, reporting timings only.\n");
+        }
+    }
+
+    if (NULL == (bnodes = calloc(nr, sizeof(*bnodes)))) {
+        fprintf(stderr, "Failed to allocate %zu nodes\n", nr);
+        goto done;
+    }
+
+    if (NULL == (order = calloc(nr, sizeof(*order)))) {
+        fprintf(stderr, "Failed to allocate node order array\n");
+        goto done;
+    }
+
+    if (NULL == (keys = calloc(nr, sizeof(*keys))) ||
+            NULL == (results = calloc(nr, sizeof(*results))) ||
+            NULL == (frozen_keys = calloc(nr, sizeof(*frozen_keys))))
+    {
+        fprintf(stderr, "Failed to allocate search arrays\n");
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr; i++) {
+        bnodes[i].key = i + 1;
+        order[i] = &bnodes[i];
+    }
+
+    /* Sequential insertion: worst case for rebalancing */
+    if (0 != bench_run_workload("seq", order, nr, keys, results, frozen_keys, &seed, &ctrs)) {
+        goto done;
+    }
+
+    /* Pseudorandom insertion order */
+    for (size_t i = 0; i < nr; i++) {
+        order[i] = &bnodes[i];
+    }
+    bench_shuffle(order, nr, &seed);
+
+    if (0 != bench_run_workload("random", order, nr, keys, results, frozen_keys, &seed, &ctrs)) {
+        goto done;
+    }
+
+#ifdef WAVL_TREE_INLINE_KEY
+    /* Pseudorandom insertion order, with inline keys */
+    bench_shuffle(order, nr, &seed);
+
+    if (0 != bench_run_u64("u64", order, nr, &seed, &ctrs)) {
+        goto done;
+    }
+#endif
+
+    /* Pseudorandom insertion order, into a compact tree */
+    bench_shuffle(order, nr, &seed);
+
+    if (0 != bench_run_compact("compact", order, nr, &seed, &ctrs)) {
+        goto done;
+    }
+
+    /* Byte-string keys with a long shared prefix */
+    for (size_t i = 0; i < nr; i++) {
+        WAVL_TREE_NODE_CLEAR(&bnodes[i].node);
+        order[i] = &bnodes[i];
+    }
+    bench_shuffle(order, nr, &seed);
+
+    if (0 != bench_run_bytes("bytes", order, nr, &seed, &ctrs)) {
+        goto done;
+    }
+
+    /* Timer queues, against a binary heap and a pairing heap */
+    if (0 != bench_run_timers(bnodes, nr, seed, &ctrs)) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < nr; i++) {
+        bnodes[i].key = i + 1;
+    }
+
+    /* Containers from malloc, against containers from a slab */
+    bench_shuffle(order, nr, &seed);
+
+    if (0 != bench_run_slab("malloc", BENCH_ALLOC_MALLOC, order, nr, &seed, &ctrs) ||
+            0 != bench_run_slab("slab", BENCH_ALLOC_SLAB, order, nr, &seed, &ctrs) ||
+            0 != bench_run_slab("slab-hp", BENCH_ALLOC_SLAB_HUGE, order, nr, &seed, &ctrs))
+    {
+        goto done;
+    }
+
+    /* Inserting one at a time, against parallel bulk builds */
+    bench_shuffle(order, nr, &seed);
+
+    if (0 != bench_run_build("build", order, nr, &ctrs)) {
+        goto done;
+    }
+
+    /* Exact-match lookups through a hash table, against the tree */
+    bench_shuffle(order, nr, &seed);
+
+    if (0 != bench_run_htree("htree", order, nr, &seed, &ctrs)) {
+        goto done;
+    }
+
+    /* Skewed lookups, without and with a lookup cache */
+    bench_shuffle(order, nr, &seed);
+
+    if (0 != bench_run_zipf("zipf", order, nr, &seed, &ctrs)) {
+        goto done;
+    }
+
+    /* Bursts of inserts, rebalanced inline and then deferred */
+    bench_shuffle(order, nr, &seed);
+
+    if (0 != bench_run_relaxed("relaxed", order, nr, &ctrs)) {
+        goto done;
+    }
+
+    /* Lookups before and after a van Emde Boas relayout */
+    for (size_t i = 0; i < nr; i++) {
+        WAVL_TREE_NODE_CLEAR(&bnodes[i].node);
+        order[i] = &bnodes[i];
+    }
+    bench_shuffle(order, nr, &seed);
+
+    if (0 != bench_run_relayout("veb", order, nr, &seed, &ctrs)) {
+        goto done;
+    }
+
+    ret = EXIT_SUCCESS;
+
+done:
+    bench_counters_close(&ctrs);
+    free(frozen_keys);
+    free(results);
+    free(keys);
+    free(order);
+    free(bnodes);
+    return ret;
+}
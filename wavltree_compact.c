@@ -0,0 +1,526 @@
+/*
+ * Copyright (c) 2021, Phil Vachon <phil@security-embedded.com>>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "wavltree_compact.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+wavl_result_t wavl_ctree_init(struct wavl_ctree *tree,
+                              wavl_ckey_to_node_compare_func_t key_cmp)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != key_cmp);
+
+    tree->proot = NULL;
+    tree->root = 0;
+    tree->base = 0;
+    tree->key_cmp = key_cmp;
+
+    return ret;
+}
+
+wavl_result_t wavl_ctree_init_based(struct wavl_ctree *tree,
+                                    wavl_ckey_to_node_compare_func_t key_cmp,
+                                    void *base,
+                                    uintptr_t *proot)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != key_cmp);
+    WAVL_ASSERT_ARG(NULL != base);
+    WAVL_ASSERT_ARG(0 == ((uintptr_t)base & 1));
+    WAVL_ASSERT_ARG(NULL != proot);
+
+    tree->proot = proot;
+    tree->root = 0;
+    tree->base = (uintptr_t)base;
+    tree->key_cmp = key_cmp;
+
+    return ret;
+}
+
+static inline
+void __wavl_ctree_node_set_left(struct wavl_ctree *tree,
+                                struct wavl_ctree_node *n,
+                                struct wavl_ctree_node *left)
+{
+    uintptr_t link = __wavl_ctree_node_to_link(tree, left);
+
+    WAVL_ASSERT(0 == (link & 1));
+    n->left_rp = link | (n->left_rp & 1);
+}
+
+static inline
+void __wavl_ctree_node_set_right(struct wavl_ctree *tree,
+                                 struct wavl_ctree_node *n,
+                                 struct wavl_ctree_node *right)
+{
+    n->right = __wavl_ctree_node_to_link(tree, right);
+}
+
+static inline
+void __wavl_ctree_set_root(struct wavl_ctree *tree, struct wavl_ctree_node *root)
+{
+    *__wavl_ctree_root_link(tree) = __wavl_ctree_node_to_link(tree, root);
+}
+
+static inline
+void __wavl_ctree_node_set_parity(struct wavl_ctree_node *n, bool rp)
+{
+    n->left_rp = (n->left_rp & ~(uintptr_t)1) | (uintptr_t)rp;
+}
+
+/**
+ * Promote or demote the given node's rank. Both flip the rank parity.
+ */
+static inline
+void __wavl_ctree_node_flip(struct wavl_ctree_node *n)
+{
+    n->left_rp ^= 1;
+}
+
+static inline
+bool __wavl_ctree_node_is_leaf(struct wavl_ctree_node *n)
+{
+    return 0 == (n->left_rp & ~(uintptr_t)1) && 0 == n->right;
+}
+
+/**
+ * Get the other child of parent. Child may be NULL, in which case parent must have exactly
+ * one child.
+ */
+static inline
+struct wavl_ctree_node *__wavl_ctree_node_get_sibling(struct wavl_ctree *tree,
+                                                      struct wavl_ctree_node *parent,
+                                                      struct wavl_ctree_node *child)
+{
+    return wavl_ctree_node_left(tree, parent) == child ? wavl_ctree_node_right(tree, parent) : wavl_ctree_node_left(tree, parent);
+}
+
+/**
+ * Replace the child old_child of parent with new_child. If parent is NULL, old_child is the
+ * root of the tree.
+ */
+static inline
+void __wavl_ctree_replace_child(struct wavl_ctree *tree,
+                                struct wavl_ctree_node *parent,
+                                struct wavl_ctree_node *old_child,
+                                struct wavl_ctree_node *new_child)
+{
+    if (NULL == parent) {
+        __wavl_ctree_set_root(tree, new_child);
+    } else if (wavl_ctree_node_left(tree, parent) == old_child) {
+        __wavl_ctree_node_set_left(tree, parent, new_child);
+    } else {
+        WAVL_ASSERT(wavl_ctree_node_right(tree, parent) == old_child);
+        __wavl_ctree_node_set_right(tree, parent, new_child);
+    }
+}
+
+/**
+ * Rotate x, a child of p, up into the place of p. The rank parities are unchanged.
+ *
+ * \param tree The tree
+ * \param gp The parent of p, or NULL if p is the root
+ * \param p The node to rotate down
+ * \param x The child of p to rotate up
+ */
+static
+void _wavl_ctree_rotate_up(struct wavl_ctree *tree,
+                           struct wavl_ctree_node *gp,
+                           struct wavl_ctree_node *p,
+                           struct wavl_ctree_node *x)
+{
+    if (wavl_ctree_node_left(tree, p) == x) {
+        __wavl_ctree_node_set_left(tree, p, wavl_ctree_node_right(tree, x));
+        __wavl_ctree_node_set_right(tree, x, p);
+    } else {
+        WAVL_ASSERT(wavl_ctree_node_right(tree, p) == x);
+        __wavl_ctree_node_set_right(tree, p, wavl_ctree_node_left(tree, x));
+        __wavl_ctree_node_set_left(tree, x, p);
+    }
+
+    __wavl_ctree_replace_child(tree, gp, p, x);
+}
+
+/**
+ * Rebalance after an insertion made x a 0-child of its parent.
+ *
+ * \param tree The tree
+ * \param path The nodes from the root down to the parent of x
+ * \param depth Number of nodes in path
+ * \param x The 0-child
+ */
+static
+void _wavl_ctree_insert_rebalance(struct wavl_ctree *tree,
+                                  struct wavl_ctree_node **path,
+                                  size_t depth,
+                                  struct wavl_ctree_node *x)
+{
+    size_t i = depth - 1;
+
+    WAVL_ASSERT(0 != depth);
+
+    for (;;) {
+        struct wavl_ctree_node *p = path[i],
+                               *gp = 0 != i ? path[i - 1] : NULL,
+                               *s = __wavl_ctree_node_get_sibling(tree, p, x),
+                               *y = NULL;
+
+        if (wavl_ctree_node_parity(s) != wavl_ctree_node_parity(p)) {
+            /* The sibling is a 1-child: promote, and check if p is now a 0-child */
+            __wavl_ctree_node_flip(p);
+
+            if (NULL == gp || wavl_ctree_node_parity(p) != wavl_ctree_node_parity(gp)) {
+                return;
+            }
+
+            x = p;
+            i--;
+            continue;
+        }
+
+        /* The sibling is a 2-child: rotate, based on the inner child of x */
+        y = wavl_ctree_node_left(tree, p) == x ? wavl_ctree_node_right(tree, x) : wavl_ctree_node_left(tree, x);
+
+        if (wavl_ctree_node_parity(y) == wavl_ctree_node_parity(x)) {
+            _wavl_ctree_rotate_up(tree, gp, p, x);
+            __wavl_ctree_node_flip(p);
+        } else {
+            /* Promote y, demote x, demote p */
+            _wavl_ctree_rotate_up(tree, p, x, y);
+            _wavl_ctree_rotate_up(tree, gp, p, y);
+            __wavl_ctree_node_flip(y);
+            __wavl_ctree_node_flip(x);
+            __wavl_ctree_node_flip(p);
+        }
+
+        return;
+    }
+}
+
+wavl_result_t wavl_ctree_insert(struct wavl_ctree *tree,
+                                void *key,
+                                struct wavl_ctree_node *node)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_ctree_node *path[WAVL_CTREE_MAX_DEPTH],
+                           *cur = NULL,
+                           *parent = NULL;
+    size_t depth = 0;
+    bool was_leaf = false;
+    int dir = -1;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != node);
+    WAVL_ASSERT_ARG(0 == ((uintptr_t)node & 1));
+    WAVL_ASSERT_ARG((uintptr_t)node != tree->base);
+
+    cur = wavl_ctree_root(tree);
+
+    while (NULL != cur) {
+        if (WAVL_FAILED(ret = tree->key_cmp(tree, key, cur, &dir))) {
+            goto done;
+        }
+
+        if (0 == dir) {
+            ret = WAVL_ERR_TREE_DUPE;
+            goto done;
+        }
+
+        if (WAVL_CTREE_MAX_DEPTH == depth) {
+            ret = WAVL_ERR_TREE_CORRUPT;
+            goto done;
+        }
+
+        path[depth++] = cur;
+        cur = dir < 0 ? wavl_ctree_node_left(tree, cur) : wavl_ctree_node_right(tree, cur);
+    }
+
+    /* Freshly inserted nodes are leaves, of rank 0 */
+    WAVL_CTREE_NODE_CLEAR(node);
+
+    if (0 == depth) {
+        __wavl_ctree_set_root(tree, node);
+        goto done;
+    }
+
+    parent = path[depth - 1];
+    was_leaf = __wavl_ctree_node_is_leaf(parent);
+
+    if (dir < 0) {
+        __wavl_ctree_node_set_left(tree, parent, node);
+    } else {
+        __wavl_ctree_node_set_right(tree, parent, node);
+    }
+
+    if (true == was_leaf) {
+        _wavl_ctree_insert_rebalance(tree, path, depth, node);
+    }
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_ctree_find(struct wavl_ctree *tree,
+                              void *key,
+                              struct wavl_ctree_node **pfound)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_ctree_node *cur = NULL;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != pfound);
+
+    *pfound = NULL;
+
+    cur = wavl_ctree_root(tree);
+
+    while (NULL != cur) {
+        int dir = -1;
+
+        if (WAVL_FAILED(ret = tree->key_cmp(tree, key, cur, &dir))) {
+            goto done;
+        }
+
+        if (0 == dir) {
+            *pfound = cur;
+            goto done;
+        }
+
+        cur = dir < 0 ? wavl_ctree_node_left(tree, cur) : wavl_ctree_node_right(tree, cur);
+    }
+
+    ret = WAVL_ERR_TREE_NOT_FOUND;
+
+done:
+    return ret;
+}
+
+/**
+ * Rebalance after a removal made x a 3-child of its parent.
+ *
+ * \param tree The tree
+ * \param path The nodes from the root down to the parent of x
+ * \param depth Number of nodes in path
+ * \param x The 3-child. May be NULL.
+ */
+static
+void _wavl_ctree_delete_rebalance(struct wavl_ctree *tree,
+                                  struct wavl_ctree_node **path,
+                                  size_t depth,
+                                  struct wavl_ctree_node *x)
+{
+    size_t i = depth - 1;
+
+    WAVL_ASSERT(0 != depth);
+
+    for (;;) {
+        struct wavl_ctree_node *p = path[i],
+                               *gp = 0 != i ? path[i - 1] : NULL,
+                               *y = __wavl_ctree_node_get_sibling(tree, p, x),
+                               *z = NULL,
+                               *v = NULL;
+        bool p_was_2_child = NULL != gp && wavl_ctree_node_parity(p) == wavl_ctree_node_parity(gp);
+
+        WAVL_ASSERT(NULL != y);
+
+        if (wavl_ctree_node_parity(y) == wavl_ctree_node_parity(p)) {
+            /* The sibling is a 2-child: demote */
+            __wavl_ctree_node_flip(p);
+        } else if (wavl_ctree_node_parity(wavl_ctree_node_left(tree, y)) == wavl_ctree_node_parity(y) &&
+                wavl_ctree_node_parity(wavl_ctree_node_right(tree, y)) == wavl_ctree_node_parity(y))
+        {
+            /* The sibling is a 1-child, and a 2,2 node: demote both */
+            __wavl_ctree_node_flip(p);
+            __wavl_ctree_node_flip(y);
+        } else {
+            /* Rotate, based on the outer child z and the inner child v of y */
+            if (wavl_ctree_node_right(tree, p) == y) {
+                z = wavl_ctree_node_right(tree, y);
+                v = wavl_ctree_node_left(tree, y);
+            } else {
+                z = wavl_ctree_node_left(tree, y);
+                v = wavl_ctree_node_right(tree, y);
+            }
+
+            if (wavl_ctree_node_parity(z) != wavl_ctree_node_parity(y)) {
+                /* Promote y, demote p (twice, if p is now a leaf) */
+                _wavl_ctree_rotate_up(tree, gp, p, y);
+                __wavl_ctree_node_flip(y);
+
+                if (false == __wavl_ctree_node_is_leaf(p)) {
+                    __wavl_ctree_node_flip(p);
+                }
+            } else {
+                /* Promote v twice, demote y, demote p twice */
+                _wavl_ctree_rotate_up(tree, p, y, v);
+                _wavl_ctree_rotate_up(tree, gp, p, v);
+                __wavl_ctree_node_flip(y);
+            }
+
+            return;
+        }
+
+        if (false == p_was_2_child) {
+            return;
+        }
+
+        x = p;
+        i--;
+    }
+}
+
+wavl_result_t wavl_ctree_remove(struct wavl_ctree *tree,
+                                void *key,
+                                struct wavl_ctree_node **premoved)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_ctree_node *path[WAVL_CTREE_MAX_DEPTH],
+                           *cur = NULL,
+                           *parent = NULL,
+                           *x = NULL;
+    size_t depth = 0;
+    bool removed_rp = false;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+
+    if (NULL != premoved) {
+        *premoved = NULL;
+    }
+
+    cur = wavl_ctree_root(tree);
+
+    while (NULL != cur) {
+        int dir = -1;
+
+        if (WAVL_FAILED(ret = tree->key_cmp(tree, key, cur, &dir))) {
+            goto done;
+        }
+
+        if (WAVL_CTREE_MAX_DEPTH == depth) {
+            ret = WAVL_ERR_TREE_CORRUPT;
+            goto done;
+        }
+
+        path[depth++] = cur;
+
+        if (0 == dir) {
+            break;
+        }
+
+        cur = dir < 0 ? wavl_ctree_node_left(tree, cur) : wavl_ctree_node_right(tree, cur);
+    }
+
+    if (NULL == cur) {
+        ret = WAVL_ERR_TREE_NOT_FOUND;
+        goto done;
+    }
+
+    if (NULL != wavl_ctree_node_left(tree, cur) && NULL != wavl_ctree_node_right(tree, cur)) {
+        /* Swap the in-order successor into the place of the node, and remove it from its old
+         * place instead.
+         */
+        size_t cur_idx = depth - 1;
+        struct wavl_ctree_node *succ = wavl_ctree_node_right(tree, cur),
+                               *succ_parent = cur;
+
+        while (NULL != wavl_ctree_node_left(tree, succ)) {
+            if (WAVL_CTREE_MAX_DEPTH == depth) {
+                ret = WAVL_ERR_TREE_CORRUPT;
+                goto done;
+            }
+
+            path[depth++] = succ;
+            succ_parent = succ;
+            succ = wavl_ctree_node_left(tree, succ);
+        }
+
+        removed_rp = wavl_ctree_node_parity(succ);
+        x = wavl_ctree_node_right(tree, succ);
+
+        if (succ_parent == cur) {
+            parent = succ;
+        } else {
+            __wavl_ctree_node_set_left(tree, succ_parent, x);
+            __wavl_ctree_node_set_right(tree, succ, wavl_ctree_node_right(tree, cur));
+            parent = succ_parent;
+        }
+
+        __wavl_ctree_node_set_left(tree, succ, wavl_ctree_node_left(tree, cur));
+        __wavl_ctree_node_set_parity(succ, wavl_ctree_node_parity(cur));
+        __wavl_ctree_replace_child(tree, 0 != cur_idx ? path[cur_idx - 1] : NULL, cur, succ);
+        path[cur_idx] = succ;
+    } else {
+        x = NULL != wavl_ctree_node_left(tree, cur) ? wavl_ctree_node_left(tree, cur) : wavl_ctree_node_right(tree, cur);
+        removed_rp = wavl_ctree_node_parity(cur);
+        depth--;
+        parent = 0 != depth ? path[depth - 1] : NULL;
+        __wavl_ctree_replace_child(tree, parent, cur, x);
+    }
+
+    if (NULL != premoved) {
+        *premoved = cur;
+    }
+
+    WAVL_CTREE_NODE_CLEAR(cur);
+
+    if (NULL == parent) {
+        goto done;
+    }
+
+    WAVL_ASSERT(path[depth - 1] == parent);
+
+    if (removed_rp == wavl_ctree_node_parity(parent)) {
+        /* The removed node was a 2-child, so its replacement is a 3-child */
+        _wavl_ctree_delete_rebalance(tree, path, depth, x);
+    } else if (__wavl_ctree_node_is_leaf(parent)) {
+        /* The parent is now a 2,2 leaf: demote it, which can make it a 3-child */
+        struct wavl_ctree_node *gp = 1 < depth ? path[depth - 2] : NULL;
+        bool was_2_child = NULL != gp && wavl_ctree_node_parity(parent) == wavl_ctree_node_parity(gp);
+
+        WAVL_ASSERT(true == wavl_ctree_node_parity(parent));
+        __wavl_ctree_node_flip(parent);
+
+        if (true == was_2_child) {
+            _wavl_ctree_delete_rebalance(tree, path, depth - 1, parent);
+        }
+    }
+
+done:
+    return ret;
+}
+
@@ -0,0 +1,179 @@
+#pragma once
+
+/** \file wavltree_compact.h
+ * Compact WAVL tree, with two-pointer nodes and no parent pointers. The rank parity is kept
+ * in the low bit of the left child pointer. Insertion and removal record the search path on
+ * the stack and rebalance from it, rather than walking back up through parent pointers.
+ *
+ * Child links are stored as offsets from a base address. For an ordinary tree the base is 0,
+ * so a link is just the address of the child. A tree initialized with `wavl_ctree_init_based`
+ * keeps its links, and its root, relative to the start of a memory region, so the region can
+ * be mapped at a different address in each process that uses the tree.
+ */
+
+#include "wavltree.h"
+
+#include <stdint.h>
+
+struct wavl_ctree_node;
+struct wavl_ctree;
+
+/**
+ * Maximum depth of a compact tree. The height of a WAVL tree is at most 2 * log2(n), and
+ * there can not be more nodes than fit in the address space.
+ */
+#define WAVL_CTREE_MAX_DEPTH            (2 * 8 * sizeof(void *))
+
+typedef wavl_result_t (*wavl_ckey_to_node_compare_func_t)(struct wavl_ctree *tree,
+                                                          void *key_lhs,
+                                                          struct wavl_ctree_node *rhs,
+                                                          int *pdir);
+
+struct wavl_ctree_node {
+    uintptr_t left_rp;              /**< Link to the left-hand child, with the rank parity in bit 0 */
+    uintptr_t right;                /**< Link to the right-hand child; 0 if not present */
+};
+
+#define WAVL_CTREE_NODE_CLEAR(_n) do { (_n)->left_rp = 0; (_n)->right = 0; } while (0)
+
+struct wavl_ctree {
+    uintptr_t *proot;                           /**< Where the root link is kept; NULL for root */
+    uintptr_t root;                             /**< Link to the root of the tree */
+    uintptr_t base;                             /**< Address links are relative to; 0 for pointers */
+    wavl_ckey_to_node_compare_func_t key_cmp;   /**< Function pointer to compare a key to a node */
+};
+
+/**
+ * Convert a link to a node pointer. A link of 0 is a missing node, whatever the base.
+ */
+static inline
+struct wavl_ctree_node *__wavl_ctree_link_to_node(struct wavl_ctree *tree, uintptr_t link)
+{
+    return (struct wavl_ctree_node *)((tree->base + link) & -(uintptr_t)(0 != link));
+}
+
+static inline
+uintptr_t __wavl_ctree_node_to_link(struct wavl_ctree *tree, struct wavl_ctree_node *node)
+{
+    return NULL == node ? 0 : (uintptr_t)node - tree->base;
+}
+
+static inline
+uintptr_t *__wavl_ctree_root_link(struct wavl_ctree *tree)
+{
+    return NULL == tree->proot ? &tree->root : tree->proot;
+}
+
+/**
+ * Get the root of a compact tree.
+ */
+static inline
+struct wavl_ctree_node *wavl_ctree_root(struct wavl_ctree *tree)
+{
+    return __wavl_ctree_link_to_node(tree, *__wavl_ctree_root_link(tree));
+}
+
+/**
+ * Get the left-hand child of a compact tree node.
+ */
+static inline
+struct wavl_ctree_node *wavl_ctree_node_left(struct wavl_ctree *tree, struct wavl_ctree_node *node)
+{
+    return __wavl_ctree_link_to_node(tree, node->left_rp & ~(uintptr_t)1);
+}
+
+/**
+ * Get the right-hand child of a compact tree node.
+ */
+static inline
+struct wavl_ctree_node *wavl_ctree_node_right(struct wavl_ctree *tree, struct wavl_ctree_node *node)
+{
+    return __wavl_ctree_link_to_node(tree, node->right);
+}
+
+/**
+ * Get the rank parity of a compact tree node. A missing node has rank -1, so is odd.
+ */
+static inline
+bool wavl_ctree_node_parity(struct wavl_ctree_node *node)
+{
+    return NULL == node ? true : !!(node->left_rp & 1);
+}
+
+/**
+ * Initialize a new compact WAVL tree.
+ *
+ * \param tree Pointer to memory to be initialized as a new compact WAVL tree
+ * \param key_cmp Pointer to function that performs key-to-node comparisons
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ */
+wavl_result_t wavl_ctree_init(struct wavl_ctree *tree,
+                              wavl_ckey_to_node_compare_func_t key_cmp);
+
+/**
+ * Initialize a handle on a compact WAVL tree whose nodes live in a memory region that may be
+ * mapped at a different address in each process. All links, including the link to the root,
+ * are stored as offsets from the start of the region. Every process initializes its own
+ * handle, with its own base address and comparison function.
+ *
+ * \param tree Pointer to memory to be initialized as the handle on the tree
+ * \param key_cmp Pointer to function that performs key-to-node comparisons
+ * \param base The address the region is mapped at in this process. Must be 2-byte aligned.
+ *             No node may be placed at the base itself, since an offset of 0 means NULL.
+ * \param proot Where the link to the root of the tree is kept, inside the region. Set this
+ *              to 0 before the first handle on a new tree is initialized.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ *
+ * \note The tree does no locking. Processes must serialize modifications, and lookups that
+ *       race with modifications, with a lock of their own.
+ */
+wavl_result_t wavl_ctree_init_based(struct wavl_ctree *tree,
+                                    wavl_ckey_to_node_compare_func_t key_cmp,
+                                    void *base,
+                                    uintptr_t *proot);
+
+/**
+ * Insert the given item into the compact WAVL tree.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param key The key of the item being inserted.
+ * \param node The `struct wavl_ctree_node` that represents the element to be inserted. Must be
+ *             at least 2-byte aligned.
+ *
+ * \return WAVL_ERR_OK on success. If a duplicate node is found, returns WAVL_ERR_TREE_DUPE.
+ *         If the tree is deeper than `WAVL_CTREE_MAX_DEPTH`, returns WAVL_ERR_TREE_CORRUPT.
+ */
+wavl_result_t wavl_ctree_insert(struct wavl_ctree *tree,
+                                void *key,
+                                struct wavl_ctree_node *node);
+
+/**
+ * Find the given key in the compact WAVL tree, and return it if present.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param key The key to search for in the tree.
+ * \param pfound The found node. Set to NULL if the node is not found.
+ *
+ * \return WAVL_ERR_OK when the node is found, WAVL_ERR_TREE_NOT_FOUND otherwise.
+ */
+wavl_result_t wavl_ctree_find(struct wavl_ctree *tree,
+                              void *key,
+                              struct wavl_ctree_node **pfound);
+
+/**
+ * Remove the item with the given key from the compact WAVL tree. Since nodes do not know their
+ * parents, removal always searches from the root.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param key The key of the item to remove.
+ * \param premoved The removed node, returned by reference. Set to NULL if not found. May be NULL.
+ *
+ * \return WAVL_ERR_OK on successful removal, WAVL_ERR_TREE_NOT_FOUND if the key is not in the
+ *         tree.
+ */
+wavl_result_t wavl_ctree_remove(struct wavl_ctree *tree,
+                                void *key,
+                                struct wavl_ctree_node **premoved);
+
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2021, Phil Vachon <phil@security-embedded.com>>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "wavltree_htree.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Fibonacci hashing multiplier: 2^64 divided by the golden ratio. Multiplying by this
+ * spreads the bits of a weak hash (such as an integer key used as its own hash) into the
+ * high bits, which select the slot.
+ */
+#define WAVL_HTREE_MIX                  0x9e3779b97f4a7c15ull
+
+/**
+ * Get the home slot of a hash.
+ */
+static inline
+size_t __wavl_htree_home(struct wavl_htree *htree, uint64_t hash)
+{
+    return (size_t)((hash * WAVL_HTREE_MIX) >> htree->shift);
+}
+
+/**
+ * Probe the hash table for a key.
+ *
+ * \param htree The hashed tree
+ * \param key The key to search for
+ * \param hash The hash of key
+ * \param pidx The slot holding the key if found, otherwise the empty slot that ended the
+ *             probe, returned by reference
+ * \param pfound The node found, or NULL, returned by reference
+ *
+ * \return WAVL_ERR_OK, or the error returned by the key comparison function.
+ */
+static
+wavl_result_t _wavl_htree_probe(struct wavl_htree *htree,
+                                void *key,
+                                uint64_t hash,
+                                size_t *pidx,
+                                struct wavl_tree_node **pfound)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+    size_t mask = htree->nr_slots - 1,
+           idx = __wavl_htree_home(htree, hash);
+
+    *pfound = NULL;
+
+    for (;; idx = (idx + 1) & mask) {
+        struct wavl_htree_slot *slot = &htree->slots[idx];
+        int dir = -1;
+
+        if (NULL == slot->node) {
+            break;
+        }
+
+        if (slot->hash != hash) {
+            continue;
+        }
+
+#ifdef WAVL_TREE_STATS
+        htree->tree.stats.compares++;
+#endif
+
+        if (WAVL_FAILED(ret = htree->tree.key_cmp(&htree->tree, key, slot->node, &dir))) {
+            goto done;
+        }
+
+        if (0 == dir) {
+            *pfound = slot->node;
+            break;
+        }
+    }
+
+    *pidx = idx;
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_htree_init(struct wavl_htree *htree,
+                              wavl_node_to_node_compare_func_t node_cmp,
+                              wavl_key_to_node_compare_func_t key_cmp,
+                              wavl_node_hash_func_t node_hash,
+                              wavl_key_hash_func_t key_hash,
+                              struct wavl_htree_slot *slots,
+                              size_t nr_slots)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != htree);
+    WAVL_ASSERT_ARG(NULL != node_hash);
+    WAVL_ASSERT_ARG(NULL != key_hash);
+    WAVL_ASSERT_ARG(NULL != slots);
+    WAVL_ASSERT_ARG(2 <= nr_slots && 0 == (nr_slots & (nr_slots - 1)));
+
+    if (WAVL_FAILED(ret = wavl_tree_init(&htree->tree, node_cmp, key_cmp))) {
+        goto done;
+    }
+
+    memset(slots, 0, nr_slots * sizeof(*slots));
+
+    htree->node_hash = node_hash;
+    htree->key_hash = key_hash;
+    htree->slots = slots;
+    htree->nr_slots = nr_slots;
+    htree->shift = 64 - (unsigned)__builtin_ctzll((unsigned long long)nr_slots);
+    htree->nr_items = 0;
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_htree_insert(struct wavl_htree *htree,
+                                void *key,
+                                struct wavl_tree_node *node)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+    struct wavl_tree_node *found = NULL;
+    uint64_t hash = 0;
+    size_t idx = 0;
+
+    WAVL_ASSERT_ARG(NULL != htree);
+    WAVL_ASSERT_ARG(NULL != node);
+
+    hash = htree->key_hash(key);
+
+    if (WAVL_FAILED(ret = _wavl_htree_probe(htree, key, hash, &idx, &found))) {
+        goto done;
+    }
+
+    if (NULL != found) {
+        ret = WAVL_ERR_TREE_DUPE;
+        goto done;
+    }
+
+    if (htree->nr_items >= WAVL_HTREE_CAPACITY(htree->nr_slots)) {
+        ret = WAVL_ERR_NO_SPACE;
+        goto done;
+    }
+
+    /* Nothing can fail once the tree has taken the node */
+    if (WAVL_FAILED(ret = wavl_tree_insert(&htree->tree, key, node))) {
+        goto done;
+    }
+
+    htree->slots[idx].hash = hash;
+    htree->slots[idx].node = node;
+    htree->nr_items++;
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_htree_find(struct wavl_htree *htree,
+                              void *key,
+                              struct wavl_tree_node **pfound)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+    size_t idx = 0;
+
+    WAVL_ASSERT_ARG(NULL != htree);
+    WAVL_ASSERT_ARG(NULL != pfound);
+
+    if (WAVL_FAILED(ret = _wavl_htree_probe(htree, key, htree->key_hash(key), &idx, pfound))) {
+        goto done;
+    }
+
+    if (NULL == *pfound) {
+        ret = WAVL_ERR_TREE_NOT_FOUND;
+    }
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_htree_remove(struct wavl_htree *htree,
+                                struct wavl_tree_node *node)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+    size_t mask = 0,
+           hole = 0;
+
+    WAVL_ASSERT_ARG(NULL != htree);
+    WAVL_ASSERT_ARG(NULL != node);
+
+    mask = htree->nr_slots - 1;
+
+    /* The node is somewhere along the probe sequence of its hash */
+    for (hole = __wavl_htree_home(htree, htree->node_hash(node));
+            node != htree->slots[hole].node;
+            hole = (hole + 1) & mask)
+    {
+        if (NULL == htree->slots[hole].node) {
+            ret = WAVL_ERR_TREE_NOT_FOUND;
+            goto done;
+        }
+    }
+
+    if (WAVL_FAILED(ret = wavl_tree_remove(&htree->tree, node))) {
+        goto done;
+    }
+
+    /*
+     * Close the hole: walk the rest of the cluster, and move back each entry whose home
+     * slot does not lie between the hole and the entry, so every entry stays reachable
+     * from its home slot without crossing an empty one.
+     */
+    for (size_t idx = (hole + 1) & mask; NULL != htree->slots[idx].node; idx = (idx + 1) & mask) {
+        size_t home = __wavl_htree_home(htree, htree->slots[idx].hash);
+
+        if (((idx - home) & mask) >= ((idx - hole) & mask)) {
+            htree->slots[hole] = htree->slots[idx];
+            hole = idx;
+        }
+    }
+
+    htree->slots[hole].node = NULL;
+    htree->nr_items--;
+
+done:
+    return ret;
+}
+
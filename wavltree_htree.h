@@ -0,0 +1,120 @@
+#pragma once
+
+/** \file wavltree_htree.h
+ * A hashed tree: a WAVL tree that keeps its items in order, paired with an open-addressing
+ * hash table of pointers to the same nodes. Exact-match lookups go through the hash table,
+ * and cost one key comparison in the common case, rather than one per level of the tree.
+ * Ordered queries (minimum, maximum, successor, ranges) use the tree. Inserting or removing
+ * an item updates both, so the two can never disagree.
+ *
+ * Like the rest of the library, this does not allocate memory: the caller provides the
+ * array of hash table slots. The table uses linear probing, and backward-shift deletion, so
+ * it needs no tombstones and lookups never slow down with churn.
+ */
+
+#include "wavltree.h"
+
+#include <stdint.h>
+
+/**
+ * A hash table slot. All members are private.
+ */
+struct wavl_htree_slot {
+    uint64_t hash;                  /**< Hash of the key of the node */
+    struct wavl_tree_node *node;    /**< The node; NULL if the slot is empty */
+};
+
+/**
+ * A hashed tree. All members of this structure are private.
+ */
+struct wavl_htree {
+    struct wavl_tree tree;              /**< The tree holding the items in order */
+    wavl_node_hash_func_t node_hash;    /**< Gets the hash of a node */
+    wavl_key_hash_func_t key_hash;      /**< Gets the hash of a key */
+    struct wavl_htree_slot *slots;      /**< The hash table */
+    size_t nr_slots;                    /**< Number of slots in the table, a power of two */
+    unsigned shift;                     /**< Shift to get a slot index from a mixed hash */
+    size_t nr_items;                    /**< Number of items in the table (and the tree) */
+};
+
+/**
+ * Number of items a table of nr_slots slots can hold. The table is kept at most 7/8 full,
+ * and always has an empty slot, so that probe sequences stay short and always end.
+ */
+#define WAVL_HTREE_CAPACITY(nr_slots)   ((nr_slots) - ((nr_slots) + 7) / 8)
+
+/**
+ * Initialize a hashed tree, with caller-provided storage for the hash table.
+ *
+ * \param htree The hashed tree to initialize.
+ * \param node_cmp Pointer to function that performs node-to-node comparisons.
+ * \param key_cmp Pointer to function that performs key-to-node comparisons.
+ * \param node_hash Pointer to function that hashes the key of a node.
+ * \param key_hash Pointer to function that hashes a key.
+ * \param slots Array of nr_slots hash table slots. Must stay valid as long as the hashed tree
+ *              is in use. Its contents on entry do not matter.
+ * \param nr_slots Number of slots. Must be a power of two, and at least 2. At most
+ *                 `WAVL_HTREE_CAPACITY(nr_slots)` items can be inserted.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ */
+wavl_result_t wavl_htree_init(struct wavl_htree *htree,
+                              wavl_node_to_node_compare_func_t node_cmp,
+                              wavl_key_to_node_compare_func_t key_cmp,
+                              wavl_node_hash_func_t node_hash,
+                              wavl_key_hash_func_t key_hash,
+                              struct wavl_htree_slot *slots,
+                              size_t nr_slots);
+
+/**
+ * Insert an item into the hash table and the tree.
+ *
+ * \param htree The hashed tree.
+ * \param key The key of the item being inserted.
+ * \param node The `struct wavl_tree_node` that represents the item.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_TREE_DUPE if an item with an equal key is
+ *         present, or WAVL_ERR_NO_SPACE if the hash table is full. The hashed tree is
+ *         unchanged on failure.
+ */
+wavl_result_t wavl_htree_insert(struct wavl_htree *htree,
+                                void *key,
+                                struct wavl_tree_node *node);
+
+/**
+ * Find the item with the given key, through the hash table.
+ *
+ * \param htree The hashed tree.
+ * \param key The key to search for.
+ * \param pfound The found node. Set to NULL if the key is not present.
+ *
+ * \return WAVL_ERR_OK when the node is found, WAVL_ERR_TREE_NOT_FOUND otherwise, or the
+ *         error returned by the key comparison function.
+ */
+wavl_result_t wavl_htree_find(struct wavl_htree *htree,
+                              void *key,
+                              struct wavl_tree_node **pfound);
+
+/**
+ * Remove an item from the hash table and the tree.
+ *
+ * \param htree The hashed tree.
+ * \param node The node to remove. Must be in the hashed tree.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_TREE_NOT_FOUND if the node is not in the hash
+ *         table (in which case the tree is not touched either).
+ */
+wavl_result_t wavl_htree_remove(struct wavl_htree *htree,
+                                struct wavl_tree_node *node);
+
+/**
+ * Get the tree of a hashed tree, for ordered queries such as `wavl_tree_min`,
+ * `wavl_tree_next` or `wavl_tree_equal_range`. Do not insert into or remove from this tree
+ * directly, or the hash table will no longer match it.
+ */
+static inline
+struct wavl_tree *wavl_htree_tree(struct wavl_htree *htree)
+{
+    return &htree->tree;
+}
+
@@ -0,0 +1,444 @@
+/*
+ * Copyright (c) 2021, Phil Vachon <phil@security-embedded.com>>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "wavltree_image.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+_Static_assert(64 == sizeof(struct wavl_image_header), "image header must be 64 bytes");
+
+/**
+ * State for writing an image
+ */
+struct wavl_image_write_state {
+    struct wavl_tree *tree;         /**< The tree being written */
+    int fd;                         /**< The image file */
+    size_t nr_records;              /**< Number of records in the image */
+    size_t key_size;                /**< Size of a key */
+    size_t value_size;              /**< Size of a value */
+    size_t record_size;             /**< Stride between records */
+    wavl_node_serialize_func_t serialize; /**< Serializer */
+    struct wavl_tree_node *next;    /**< The next node, in order, to be written */
+    bool have_prev;                 /**< Set once a record has been written */
+    uint8_t prev_key[WAVL_IMAGE_MAX_RECORD]; /**< Key of the previous record, in order */
+    uint8_t record[WAVL_IMAGE_MAX_RECORD];   /**< Record being written */
+};
+
+/**
+ * Write a buffer at the given offset, retrying short writes.
+ */
+static
+wavl_result_t _wavl_image_pwrite_all(int fd, const void *buf, size_t len, off_t offset)
+{
+    const uint8_t *ptr = buf;
+
+    while (len > 0) {
+        ssize_t written = pwrite(fd, ptr, len, offset);
+
+        if (written < 0) {
+            return WAVL_ERR_IMAGE_IO;
+        }
+
+        ptr += written;
+        len -= (size_t)written;
+        offset += written;
+    }
+
+    return WAVL_ERR_OK;
+}
+
+/**
+ * Write the implicit subtree rooted at index i with the next nodes from the tree, in order.
+ * Recursion depth is log2 of the number of nodes.
+ */
+static
+wavl_result_t _wavl_image_write_fill(struct wavl_image_write_state *st, size_t i)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    if (i >= st->nr_records) {
+        goto done;
+    }
+
+    if (WAVL_FAILED(ret = _wavl_image_write_fill(st, 2 * i + 1))) {
+        goto done;
+    }
+
+    WAVL_ASSERT(NULL != st->next);
+
+    memset(st->record, 0, st->record_size);
+
+    if (WAVL_FAILED(ret = st->serialize(st->next, st->record, st->record + st->key_size))) {
+        goto done;
+    }
+
+    if (true == st->have_prev && memcmp(st->prev_key, st->record, st->key_size) >= 0) {
+        ret = WAVL_ERR_BAD_ARG;
+        goto done;
+    }
+
+    memcpy(st->prev_key, st->record, st->key_size);
+    st->have_prev = true;
+
+    if (WAVL_FAILED(ret = _wavl_image_pwrite_all(st->fd, st->record, st->record_size,
+                    (off_t)(sizeof(struct wavl_image_header) + i * st->record_size))))
+    {
+        goto done;
+    }
+
+    if (WAVL_FAILED(ret = wavl_tree_next(st->tree, st->next, &st->next)) &&
+            WAVL_ERR_TREE_NOT_FOUND != ret)
+    {
+        goto done;
+    }
+
+    ret = _wavl_image_write_fill(st, 2 * i + 2);
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_tree_write_image(struct wavl_tree *tree,
+                                    int fd,
+                                    size_t key_size,
+                                    size_t value_size,
+                                    wavl_node_serialize_func_t serialize)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_image_write_state st_buf;
+    struct wavl_image_write_state *st = &st_buf;
+    struct wavl_image_header hdr;
+    struct wavl_tree_node *cur = NULL;
+    size_t nr_records = 0,
+           record_size = 0;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(0 <= fd);
+    WAVL_ASSERT_ARG(0 < key_size);
+    WAVL_ASSERT_ARG(key_size + value_size <= WAVL_IMAGE_MAX_RECORD);
+    WAVL_ASSERT_ARG(NULL != serialize);
+
+    /* Round records up to 8 bytes, so values are aligned for the caller to read in place */
+    record_size = (key_size + value_size + 7) & ~(size_t)7;
+
+    if (WAVL_FAILED(ret = wavl_tree_min(tree, &cur)) && WAVL_ERR_TREE_NOT_FOUND != ret) {
+        goto done;
+    }
+
+    for (struct wavl_tree_node *n = cur; NULL != n; ) {
+        nr_records++;
+        if (WAVL_FAILED(ret = wavl_tree_next(tree, n, &n)) && WAVL_ERR_TREE_NOT_FOUND != ret) {
+            goto done;
+        }
+    }
+
+    ret = WAVL_ERR_OK;
+
+    /* Truncating to zero first clears any old header, until the new one is in place */
+    if (0 != ftruncate(fd, 0) ||
+            0 != ftruncate(fd, (off_t)(sizeof(hdr) + nr_records * record_size)))
+    {
+        ret = WAVL_ERR_IMAGE_IO;
+        goto done;
+    }
+
+    st->tree = tree;
+    st->fd = fd;
+    st->nr_records = nr_records;
+    st->key_size = key_size;
+    st->value_size = value_size;
+    st->record_size = record_size;
+    st->serialize = serialize;
+    st->next = cur;
+    st->have_prev = false;
+
+    if (WAVL_FAILED(ret = _wavl_image_write_fill(st, 0))) {
+        goto done;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, WAVL_IMAGE_MAGIC, sizeof(WAVL_IMAGE_MAGIC));
+    hdr.version = WAVL_IMAGE_VERSION;
+    hdr.byte_order = WAVL_IMAGE_BYTE_ORDER;
+    hdr.key_size = (uint32_t)key_size;
+    hdr.value_size = (uint32_t)value_size;
+    hdr.record_size = (uint32_t)record_size;
+    hdr.nr_records = nr_records;
+    hdr.records_offset = sizeof(hdr);
+
+    ret = _wavl_image_pwrite_all(fd, &hdr, sizeof(hdr), 0);
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_image_open(struct wavl_image *image,
+                              int fd)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct stat sb;
+    const struct wavl_image_header *hdr = NULL;
+    void *map = MAP_FAILED;
+
+    WAVL_ASSERT_ARG(NULL != image);
+    WAVL_ASSERT_ARG(0 <= fd);
+
+    memset(image, 0, sizeof(*image));
+
+    if (0 != fstat(fd, &sb)) {
+        ret = WAVL_ERR_IMAGE_IO;
+        goto done;
+    }
+
+    if ((size_t)sb.st_size < sizeof(*hdr)) {
+        ret = WAVL_ERR_IMAGE_FORMAT;
+        goto done;
+    }
+
+    if (MAP_FAILED == (map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0))) {
+        ret = WAVL_ERR_IMAGE_IO;
+        goto done;
+    }
+
+    hdr = map;
+
+    if (0 != memcmp(hdr->magic, WAVL_IMAGE_MAGIC, sizeof(WAVL_IMAGE_MAGIC)) ||
+            WAVL_IMAGE_VERSION != hdr->version ||
+            WAVL_IMAGE_BYTE_ORDER != hdr->byte_order ||
+            0 == hdr->key_size ||
+            hdr->record_size < (uint64_t)hdr->key_size + hdr->value_size ||
+            0 != hdr->records_offset % 8 ||
+            hdr->records_offset > (uint64_t)sb.st_size ||
+            hdr->nr_records > ((uint64_t)sb.st_size - hdr->records_offset) / hdr->record_size)
+    {
+        ret = WAVL_ERR_IMAGE_FORMAT;
+        goto done;
+    }
+
+    image->map = map;
+    image->map_len = (size_t)sb.st_size;
+    image->records = (const uint8_t *)map + hdr->records_offset;
+    image->nr_records = hdr->nr_records;
+    image->key_size = hdr->key_size;
+    image->value_size = hdr->value_size;
+    image->record_size = hdr->record_size;
+
+done:
+    if (WAVL_FAILED(ret) && MAP_FAILED != map) {
+        munmap(map, (size_t)sb.st_size);
+    }
+    return ret;
+}
+
+wavl_result_t wavl_image_close(struct wavl_image *image)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != image);
+
+    if (NULL != image->map && 0 != munmap(image->map, image->map_len)) {
+        ret = WAVL_ERR_IMAGE_IO;
+    }
+
+    memset(image, 0, sizeof(*image));
+
+    return ret;
+}
+
+static inline
+const uint8_t *_wavl_image_rec(struct wavl_image *image, size_t i)
+{
+    return image->records + i * image->record_size;
+}
+
+/**
+ * Branch-free search for the index of the first key >= the given key. Returns nr_records if
+ * there is no such key. This is the same walk as `wavl_frozen_lower_bound`.
+ */
+static
+size_t _wavl_image_lower_bound_index(struct wavl_image *image, const void *key)
+{
+    size_t n = image->nr_records,
+           i = 0,
+           k = 0;
+
+    while (i < n) {
+        /* The 4 grandchildren are adjacent: start fetching them while we compare */
+        __builtin_prefetch(_wavl_image_rec(image, 4 * i + 3));
+        i = 2 * i + 1 + (memcmp(_wavl_image_rec(image, i), key, image->key_size) < 0);
+    }
+
+    k = i + 1;
+    k >>= __builtin_ffsll(~(long long)k);
+
+    return 0 == k ? n : k - 1;
+}
+
+wavl_result_t wavl_image_find(struct wavl_image *image,
+                              const void *key,
+                              const void **pvalue)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    size_t i = 0;
+
+    WAVL_ASSERT_ARG(NULL != image);
+    WAVL_ASSERT_ARG(NULL != key);
+    WAVL_ASSERT_ARG(NULL != pvalue);
+
+    i = _wavl_image_lower_bound_index(image, key);
+
+    if (i == image->nr_records || 0 != memcmp(_wavl_image_rec(image, i), key, image->key_size)) {
+        *pvalue = NULL;
+        ret = WAVL_ERR_TREE_NOT_FOUND;
+        goto done;
+    }
+
+    *pvalue = _wavl_image_rec(image, i) + image->key_size;
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_image_lower_bound(struct wavl_image *image,
+                                     const void *key,
+                                     size_t *ppos)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    size_t i = 0;
+
+    WAVL_ASSERT_ARG(NULL != image);
+    WAVL_ASSERT_ARG(NULL != key);
+    WAVL_ASSERT_ARG(NULL != ppos);
+
+    i = _wavl_image_lower_bound_index(image, key);
+
+    if (i == image->nr_records) {
+        *ppos = WAVL_IMAGE_END;
+        ret = WAVL_ERR_TREE_NOT_FOUND;
+        goto done;
+    }
+
+    *ppos = i;
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_image_first(struct wavl_image *image,
+                               size_t *ppos)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    size_t k = 1;
+
+    WAVL_ASSERT_ARG(NULL != image);
+    WAVL_ASSERT_ARG(NULL != ppos);
+
+    if (0 == image->nr_records) {
+        *ppos = WAVL_IMAGE_END;
+        ret = WAVL_ERR_TREE_NOT_FOUND;
+        goto done;
+    }
+
+    /* Using 1-based indices, the left child of k is 2k */
+    while (2 * k <= image->nr_records) {
+        k = 2 * k;
+    }
+
+    *ppos = k - 1;
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_image_next(struct wavl_image *image,
+                              size_t pos,
+                              size_t *pnext)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    size_t k = pos + 1;
+
+    WAVL_ASSERT_ARG(NULL != image);
+    WAVL_ASSERT_ARG(pos < image->nr_records);
+    WAVL_ASSERT_ARG(NULL != pnext);
+
+    if (2 * k + 1 <= image->nr_records) {
+        /* The leftmost record of the right subtree */
+        k = 2 * k + 1;
+        while (2 * k <= image->nr_records) {
+            k = 2 * k;
+        }
+    } else {
+        /* Climb past every right child, then past the left child to its parent */
+        k >>= __builtin_ffsll(~(long long)k);
+    }
+
+    if (0 == k) {
+        *pnext = WAVL_IMAGE_END;
+        ret = WAVL_ERR_TREE_NOT_FOUND;
+        goto done;
+    }
+
+    *pnext = k - 1;
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_image_record(struct wavl_image *image,
+                                size_t pos,
+                                const void **pkey,
+                                const void **pvalue)
+{
+    WAVL_ASSERT_ARG(NULL != image);
+    WAVL_ASSERT_ARG(pos < image->nr_records);
+
+    if (NULL != pkey) {
+        *pkey = _wavl_image_rec(image, pos);
+    }
+
+    if (NULL != pvalue) {
+        *pvalue = _wavl_image_rec(image, pos) + image->key_size;
+    }
+
+    return WAVL_ERR_OK;
+}
+
@@ -0,0 +1,177 @@
+#pragma once
+
+/** \file wavltree_image.h
+ * Read-only on-disk images of a WAVL tree. An image is a flat file of fixed-size records,
+ * each a key and a value produced by a caller-supplied serializer, laid out in Eytzinger
+ * (BFS) order. The children of the record at index i are at 2i + 1 and 2i + 2, so the file
+ * holds no pointers at all, and can be mapped at any address. Searches run directly against
+ * the mapping, so any number of processes can share one copy of an image in the page cache.
+ *
+ * Keys are compared with `memcmp`, so the serializer must produce keys whose byte order
+ * matches the order of the tree (e.g. big-endian integers). Images are only portable
+ * between machines with the same byte order.
+ */
+
+#include "wavltree.h"
+
+#include <stdint.h>
+
+/**
+ * Largest record (key plus value) that can be written to an image, in bytes.
+ */
+#define WAVL_IMAGE_MAX_RECORD           4096
+
+/**
+ * Position returned when there is no further record in an image.
+ */
+#define WAVL_IMAGE_END                  ((size_t)-1)
+
+/**
+ * Function to serialize a node into an image record. Must write exactly key_size bytes to
+ * key, and value_size bytes to value, as passed to `wavl_tree_write_image`.
+ */
+typedef wavl_result_t (*wavl_node_serialize_func_t)(struct wavl_tree_node *node,
+                                                    void *key,
+                                                    void *value);
+
+/**
+ * The header at the start of an image file. All fields are in host byte order.
+ */
+struct wavl_image_header {
+    char magic[8];                  /**< WAVL_IMAGE_MAGIC */
+    uint32_t version;               /**< WAVL_IMAGE_VERSION */
+    uint32_t byte_order;            /**< WAVL_IMAGE_BYTE_ORDER, as written by the host */
+    uint32_t key_size;              /**< Size of the key of each record, in bytes */
+    uint32_t value_size;            /**< Size of the value of each record, in bytes */
+    uint32_t record_size;           /**< Stride between records, in bytes */
+    uint32_t reserved;              /**< Must be zero */
+    uint64_t nr_records;            /**< Number of records in the image */
+    uint64_t records_offset;        /**< Offset of the first record from the start of the file */
+    uint8_t pad[16];                /**< Pads the header to 64 bytes */
+};
+
+#define WAVL_IMAGE_MAGIC                "WAVLIMG"
+#define WAVL_IMAGE_VERSION              1
+#define WAVL_IMAGE_BYTE_ORDER           0x01020304u
+
+/**
+ * A mapped tree image, as opened by `wavl_image_open`. All members of this structure are
+ * private.
+ */
+struct wavl_image {
+    void *map;                      /**< Start of the mapping */
+    size_t map_len;                 /**< Length of the mapping, in bytes */
+    const uint8_t *records;         /**< The first record, in Eytzinger order */
+    size_t nr_records;              /**< Number of records */
+    size_t key_size;                /**< Size of a key, in bytes */
+    size_t value_size;              /**< Size of a value, in bytes */
+    size_t record_size;             /**< Stride between records, in bytes */
+};
+
+/**
+ * Write an image of the tree to a file. The file is truncated to the size of the image. The
+ * header is written last, so a partially written image will fail to open.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param fd File descriptor, open for writing, to write the image to.
+ * \param key_size The size of each serialized key, in bytes. Must be at least 1.
+ * \param value_size The size of each serialized value, in bytes. May be 0.
+ * \param serialize Function to serialize a node into its key and value.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_IMAGE_IO if writing the file failed, or
+ *         WAVL_ERR_BAD_ARG if the serialized keys are not in strictly ascending order.
+ *         Errors returned by the serializer are passed back to the caller.
+ */
+wavl_result_t wavl_tree_write_image(struct wavl_tree *tree,
+                                    int fd,
+                                    size_t key_size,
+                                    size_t value_size,
+                                    wavl_node_serialize_func_t serialize);
+
+/**
+ * Map an image file into memory. The file descriptor may be closed once the image is open.
+ *
+ * \param image The image state to initialize.
+ * \param fd File descriptor, open for reading, of the image file.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_IMAGE_IO if the file could not be mapped, or
+ *         WAVL_ERR_IMAGE_FORMAT if the file is not a valid image for this host.
+ */
+wavl_result_t wavl_image_open(struct wavl_image *image,
+                              int fd);
+
+/**
+ * Unmap an image. Any keys or values previously returned from the image become invalid.
+ *
+ * \param image The image to close.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ */
+wavl_result_t wavl_image_close(struct wavl_image *image);
+
+/**
+ * Find the record with the given key in an image.
+ *
+ * \param image The image.
+ * \param key The key to search for, key_size bytes long.
+ * \param pvalue The value of the record, pointing into the mapping. Set to NULL if not found.
+ *
+ * \return WAVL_ERR_OK when the record is found, WAVL_ERR_TREE_NOT_FOUND otherwise.
+ */
+wavl_result_t wavl_image_find(struct wavl_image *image,
+                              const void *key,
+                              const void **pvalue);
+
+/**
+ * Find the position of the first record with a key greater than or equal to the given key.
+ * Together with `wavl_image_next`, this answers range queries.
+ *
+ * \param image The image.
+ * \param key The key to search for, key_size bytes long.
+ * \param ppos The position of the record. Set to WAVL_IMAGE_END if there is no such record.
+ *
+ * \return WAVL_ERR_OK when a record is found, WAVL_ERR_TREE_NOT_FOUND otherwise.
+ */
+wavl_result_t wavl_image_lower_bound(struct wavl_image *image,
+                                     const void *key,
+                                     size_t *ppos);
+
+/**
+ * Get the position of the record with the smallest key.
+ *
+ * \param image The image.
+ * \param ppos The position of the record. Set to WAVL_IMAGE_END if the image is empty.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_TREE_NOT_FOUND if the image is empty.
+ */
+wavl_result_t wavl_image_first(struct wavl_image *image,
+                               size_t *ppos);
+
+/**
+ * Get the position of the record that follows the given one, in key order.
+ *
+ * \param image The image.
+ * \param pos The position of the current record.
+ * \param pnext The position of the next record. Set to WAVL_IMAGE_END if pos is the last.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_TREE_NOT_FOUND if pos is the last record.
+ */
+wavl_result_t wavl_image_next(struct wavl_image *image,
+                              size_t pos,
+                              size_t *pnext);
+
+/**
+ * Get the key and value of the record at the given position.
+ *
+ * \param image The image.
+ * \param pos The position of the record.
+ * \param pkey The key, pointing into the mapping. May be NULL.
+ * \param pvalue The value, pointing into the mapping. May be NULL.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_BAD_ARG if pos is not a valid position.
+ */
+wavl_result_t wavl_image_record(struct wavl_image *image,
+                                size_t pos,
+                                const void **pkey,
+                                const void **pvalue);
+
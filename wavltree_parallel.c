@@ -0,0 +1,868 @@
+/*
+ * Copyright (c) 2021, Phil Vachon <phil@security-embedded.com>>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include "wavltree_parallel.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+/**
+ * Slices are sorted by insertion in runs of this many nodes, before merging.
+ */
+#define WAVL_PARALLEL_SORT_RUN          16
+
+/**
+ * A bulk build links the top levels of the tree on the calling thread, until there are this
+ * many subtrees per thread left to link. Handing out several subtrees to each thread evens
+ * out the work when the subtrees differ in size.
+ */
+#define WAVL_PARALLEL_TASKS_PER_THREAD  4
+
+/**
+ * Work done by one thread of a parallel operation.
+ */
+typedef wavl_result_t (*_wavl_parallel_func_t)(void *arg, size_t idx, size_t nr);
+
+struct _wavl_parallel_worker {
+    pthread_t thread;
+    _wavl_parallel_func_t func;
+    void *arg;
+    size_t idx;
+    size_t nr;
+    bool started;
+    wavl_result_t ret;
+};
+
+static
+void *_wavl_parallel_worker_main(void *arg)
+{
+    struct _wavl_parallel_worker *worker = arg;
+
+    worker->ret = worker->func(worker->arg, worker->idx, worker->nr);
+
+    return NULL;
+}
+
+/**
+ * Call func(arg, idx, nr) for every idx in [0, nr), each on its own thread, and wait for all
+ * of them. The calling thread takes idx 0. If a thread cannot be started, the calling thread
+ * does its share once its own is done.
+ *
+ * \return WAVL_ERR_OK if every call succeeded, otherwise the error of the lowest failing idx.
+ */
+static
+wavl_result_t _wavl_parallel_run(_wavl_parallel_func_t func,
+                                 void *arg,
+                                 size_t nr)
+{
+    struct _wavl_parallel_worker workers[WAVL_PARALLEL_MAX_THREADS];
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT(0 < nr && nr <= WAVL_PARALLEL_MAX_THREADS);
+
+    for (size_t i = 0; i < nr; i++) {
+        workers[i].func = func;
+        workers[i].arg = arg;
+        workers[i].idx = i;
+        workers[i].nr = nr;
+        workers[i].started = false;
+        workers[i].ret = WAVL_ERR_OK;
+    }
+
+    for (size_t i = 1; i < nr; i++) {
+        workers[i].started = 0 == pthread_create(&workers[i].thread, NULL,
+                                                 _wavl_parallel_worker_main, &workers[i]);
+    }
+
+    workers[0].ret = func(arg, 0, nr);
+
+    for (size_t i = 1; i < nr; i++) {
+        if (true == workers[i].started) {
+            pthread_join(workers[i].thread, NULL);
+        } else {
+            workers[i].ret = func(arg, i, nr);
+        }
+    }
+
+    for (size_t i = 0; i < nr; i++) {
+        if (WAVL_FAILED(workers[i].ret)) {
+            ret = workers[i].ret;
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Get the start of slice idx, when n items are split as evenly as possible into nr slices.
+ */
+static inline
+size_t __wavl_parallel_slice(size_t n, size_t idx, size_t nr)
+{
+    return idx * (n / nr) + (idx < n % nr ? idx : n % nr);
+}
+
+/**
+ * Get the number of threads worth using for n items, given the number asked for.
+ */
+static inline
+size_t __wavl_parallel_nr_threads(size_t n, size_t nthreads)
+{
+    size_t nr = n / WAVL_PARALLEL_MIN_PER_THREAD;
+
+    if (nr > nthreads) {
+        nr = nthreads;
+    }
+
+    if (nr > WAVL_PARALLEL_MAX_THREADS) {
+        nr = WAVL_PARALLEL_MAX_THREADS;
+    }
+
+    return 0 == nr ? 1 : nr;
+}
+
+/**
+ * Get the depth at which to hand out subtrees, so there are WAVL_PARALLEL_TASKS_PER_THREAD
+ * subtrees per thread in a complete tree.
+ */
+static inline
+size_t __wavl_parallel_split_depth(size_t nr_threads)
+{
+    size_t depth = 0;
+
+    while (((size_t)1 << depth) < nr_threads * WAVL_PARALLEL_TASKS_PER_THREAD) {
+        depth++;
+    }
+
+    return depth;
+}
+
+/**
+ * A subtree to be linked by one of the threads of a bulk build.
+ */
+struct _wavl_build_task {
+    struct wavl_tree_node **sorted;     /**< The nodes of the subtree, in order */
+    size_t nr_nodes;                    /**< Number of nodes in the subtree */
+    struct wavl_tree_node *parent;      /**< Parent of the root of the subtree */
+    struct wavl_tree_node **plink;      /**< Where to store the root of the subtree */
+};
+
+/**
+ * State shared between the threads of a bulk build.
+ */
+struct _wavl_build_state {
+    struct wavl_tree *tree;             /**< The tree being built */
+    struct wavl_tree_node **nodes;      /**< The caller's array */
+    struct wavl_tree_node **scratch;    /**< Scratch array, as large as the caller's */
+    struct wavl_tree_node **src;        /**< Sorted runs, as input to the current merge round */
+    struct wavl_tree_node **dst;        /**< Output of the current merge round */
+    size_t nr_nodes;                    /**< Number of nodes */
+    size_t run;                         /**< Length of each sorted run in src */
+    size_t split_depth;                 /**< Depth at which subtrees are handed out */
+    size_t nr_tasks;                    /**< Number of subtrees handed out */
+    size_t next_task;                   /**< Next subtree to be taken by a thread */
+    struct _wavl_build_task tasks[WAVL_PARALLEL_MAX_THREADS * WAVL_PARALLEL_TASKS_PER_THREAD];
+};
+
+/**
+ * Merge the sorted runs a and b into out. On equal keys the node from a comes first, so the
+ * merge is stable.
+ */
+static
+wavl_result_t _wavl_parallel_merge(struct wavl_tree *tree,
+                                   struct wavl_tree_node **a,
+                                   size_t nr_a,
+                                   struct wavl_tree_node **b,
+                                   size_t nr_b,
+                                   struct wavl_tree_node **out)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+    size_t i = 0,
+           j = 0;
+
+    while (i < nr_a && j < nr_b) {
+        int dir = 0;
+
+        if (WAVL_FAILED(ret = tree->node_cmp(tree, a[i], b[j], &dir))) {
+            goto done;
+        }
+
+        *out++ = dir <= 0 ? a[i++] : b[j++];
+    }
+
+    memcpy(out, a + i, (nr_a - i) * sizeof(*a));
+    memcpy(out + (nr_a - i), b + j, (nr_b - j) * sizeof(*b));
+
+done:
+    return ret;
+}
+
+/**
+ * Find how many of the first k nodes of the stable merge of a and b come from a. This lets
+ * several threads each produce a part of one merge, without looking at the rest of it.
+ */
+static
+wavl_result_t _wavl_parallel_corank(struct wavl_tree *tree,
+                                    struct wavl_tree_node **a,
+                                    size_t nr_a,
+                                    struct wavl_tree_node **b,
+                                    size_t nr_b,
+                                    size_t k,
+                                    size_t *pi)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+    size_t lo = k > nr_b ? k - nr_b : 0,
+           hi = k < nr_a ? k : nr_a;
+
+    while (lo < hi) {
+        size_t i = lo + (hi - lo) / 2;
+        int dir = 0;
+
+        /* If a[i] does not follow b[k - i - 1], it is among the first k */
+        if (WAVL_FAILED(ret = tree->node_cmp(tree, a[i], b[k - i - 1], &dir))) {
+            goto done;
+        }
+
+        if (dir <= 0) {
+            lo = i + 1;
+        } else {
+            hi = i;
+        }
+    }
+
+    *pi = lo;
+
+done:
+    return ret;
+}
+
+/**
+ * Sort one slice of the caller's array, leaving the result in place. On failure, the slice
+ * still holds the same nodes.
+ */
+static
+wavl_result_t _wavl_build_sort_slice(void *arg, size_t idx, size_t nr __attribute__((unused)))
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+    struct _wavl_build_state *st = arg;
+    struct wavl_tree *tree = st->tree;
+    struct wavl_tree_node **src = NULL,
+                          **dst = NULL;
+    size_t lo = idx * st->run,
+           nr_nodes = 0;
+
+    if (lo >= st->nr_nodes) {
+        goto done;
+    }
+
+    nr_nodes = st->nr_nodes - lo < st->run ? st->nr_nodes - lo : st->run;
+    src = st->nodes + lo;
+    dst = st->scratch + lo;
+
+    for (size_t s = 0; s < nr_nodes; s += WAVL_PARALLEL_SORT_RUN) {
+        size_t e = s + WAVL_PARALLEL_SORT_RUN < nr_nodes ? s + WAVL_PARALLEL_SORT_RUN : nr_nodes;
+
+        for (size_t i = s + 1; i < e; i++) {
+            struct wavl_tree_node *node = src[i];
+            size_t j = i;
+
+            while (j > s) {
+                int dir = 0;
+
+                if (WAVL_FAILED(ret = tree->node_cmp(tree, src[j - 1], node, &dir))) {
+                    src[j] = node;
+                    goto done;
+                }
+
+                if (dir <= 0) {
+                    break;
+                }
+
+                src[j] = src[j - 1];
+                j--;
+            }
+
+            src[j] = node;
+        }
+    }
+
+    for (size_t w = WAVL_PARALLEL_SORT_RUN; w < nr_nodes; w *= 2) {
+        struct wavl_tree_node **tmp = NULL;
+
+        for (size_t s = 0; s < nr_nodes; s += 2 * w) {
+            size_t mid = s + w < nr_nodes ? s + w : nr_nodes,
+                   e = s + 2 * w < nr_nodes ? s + 2 * w : nr_nodes;
+
+            if (WAVL_FAILED(ret = _wavl_parallel_merge(tree, src + s, mid - s, src + mid, e - mid, dst + s))) {
+                goto done;
+            }
+        }
+
+        tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+done:
+    if (NULL != src && src != st->nodes + lo) {
+        memcpy(st->nodes + lo, src, nr_nodes * sizeof(*src));
+    }
+
+    return ret;
+}
+
+/**
+ * Produce one thread's share of the output of a merge round. Each pair of adjacent runs in
+ * src is merged into a run twice as long in dst.
+ */
+static
+wavl_result_t _wavl_build_merge_slice(void *arg, size_t idx, size_t nr)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+    struct _wavl_build_state *st = arg;
+    size_t k = __wavl_parallel_slice(st->nr_nodes, idx, nr),
+           end = __wavl_parallel_slice(st->nr_nodes, idx + 1, nr);
+
+    while (k < end) {
+        size_t base = k - k % (2 * st->run),
+               mid = st->nr_nodes - base < st->run ? st->nr_nodes : base + st->run,
+               pair_end = st->nr_nodes - base < 2 * st->run ? st->nr_nodes : base + 2 * st->run,
+               k_end = end < pair_end ? end : pair_end,
+               i_lo = 0,
+               i_hi = 0;
+
+        if (WAVL_FAILED(ret = _wavl_parallel_corank(st->tree, st->src + base, mid - base,
+                        st->src + mid, pair_end - mid, k - base, &i_lo)))
+        {
+            goto done;
+        }
+
+        if (WAVL_FAILED(ret = _wavl_parallel_corank(st->tree, st->src + base, mid - base,
+                        st->src + mid, pair_end - mid, k_end - base, &i_hi)))
+        {
+            goto done;
+        }
+
+        if (WAVL_FAILED(ret = _wavl_parallel_merge(st->tree,
+                        st->src + base + i_lo, i_hi - i_lo,
+                        st->src + mid + (k - base - i_lo), (k_end - k) - (i_hi - i_lo),
+                        st->dst + k)))
+        {
+            goto done;
+        }
+
+        k = k_end;
+    }
+
+done:
+    return ret;
+}
+
+/**
+ * Copy one thread's share of the sorted nodes back to the caller's array, then check it for
+ * adjacent nodes with equal keys.
+ */
+static
+wavl_result_t _wavl_build_check_slice(void *arg, size_t idx, size_t nr)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+    struct _wavl_build_state *st = arg;
+    struct wavl_tree *tree = st->tree;
+    size_t start = __wavl_parallel_slice(st->nr_nodes, idx, nr),
+           end = __wavl_parallel_slice(st->nr_nodes, idx + 1, nr);
+
+    if (st->src != st->nodes) {
+        memcpy(st->nodes + start, st->src + start, (end - start) * sizeof(*st->nodes));
+    }
+
+    if (0 != (tree->flags & WAVL_TREE_FLAG_MULTI)) {
+        goto done;
+    }
+
+    for (size_t i = 0 == start ? 1 : start; i < end; i++) {
+        int dir = 0;
+
+        if (WAVL_FAILED(ret = tree->node_cmp(tree, st->src[i - 1], st->src[i], &dir))) {
+            goto done;
+        }
+
+        if (0 == dir) {
+            ret = WAVL_ERR_TREE_DUPE;
+            goto done;
+        }
+    }
+
+done:
+    return ret;
+}
+
+/**
+ * Get the rank parity of the root of a subtree of nr_nodes nodes, as built by splitting at
+ * the middle. Giving every node the rank floor(log2(size of its subtree)) satisfies the rank
+ * rule: the larger side of a split has floor(nr_nodes / 2) nodes, and so a rank one lower,
+ * while the smaller side has at most one node fewer, and a rank one or two lower.
+ */
+static inline
+bool __wavl_build_rank_parity(size_t nr_nodes)
+{
+    return !!((63 - __builtin_clzll((unsigned long long)nr_nodes)) & 1);
+}
+
+/**
+ * Link a balanced subtree over the given sorted nodes, and return its root.
+ */
+static
+struct wavl_tree_node *_wavl_build_subtree(struct wavl_tree_node **sorted,
+                                           size_t nr_nodes,
+                                           struct wavl_tree_node *parent)
+{
+    struct wavl_tree_node *node = NULL;
+    size_t mid = 0;
+
+    if (0 == nr_nodes) {
+        return NULL;
+    }
+
+    mid = (nr_nodes - 1) / 2;
+    node = sorted[mid];
+
+    node->parent = parent;
+    node->rp = __wavl_build_rank_parity(nr_nodes);
+    node->pending = false;
+    node->left = _wavl_build_subtree(sorted, mid, node);
+    node->right = _wavl_build_subtree(sorted + mid + 1, nr_nodes - mid - 1, node);
+
+    return node;
+}
+
+/**
+ * Link the top levels of the tree, down to the split depth, and queue a task for each
+ * subtree below it.
+ */
+static
+void _wavl_build_top(struct _wavl_build_state *st,
+                     struct wavl_tree_node **sorted,
+                     size_t nr_nodes,
+                     struct wavl_tree_node *parent,
+                     struct wavl_tree_node **plink,
+                     size_t depth)
+{
+    struct wavl_tree_node *node = NULL;
+    size_t mid = 0;
+
+    if (0 == nr_nodes) {
+        *plink = NULL;
+        return;
+    }
+
+    if (depth == st->split_depth) {
+        struct _wavl_build_task *task = &st->tasks[st->nr_tasks++];
+
+        task->sorted = sorted;
+        task->nr_nodes = nr_nodes;
+        task->parent = parent;
+        task->plink = plink;
+        return;
+    }
+
+    mid = (nr_nodes - 1) / 2;
+    node = sorted[mid];
+
+    node->parent = parent;
+    node->rp = __wavl_build_rank_parity(nr_nodes);
+    node->pending = false;
+    *plink = node;
+
+    _wavl_build_top(st, sorted, mid, node, &node->left, depth + 1);
+    _wavl_build_top(st, sorted + mid + 1, nr_nodes - mid - 1, node, &node->right, depth + 1);
+}
+
+/**
+ * Take queued subtrees and link them, until none are left.
+ */
+static
+wavl_result_t _wavl_build_link_subtrees(void *arg, size_t idx __attribute__((unused)), size_t nr __attribute__((unused)))
+{
+    struct _wavl_build_state *st = arg;
+    size_t next = 0;
+
+    while ((next = __atomic_fetch_add(&st->next_task, 1, __ATOMIC_RELAXED)) < st->nr_tasks) {
+        struct _wavl_build_task *task = &st->tasks[next];
+
+        *task->plink = _wavl_build_subtree(task->sorted, task->nr_nodes, task->parent);
+    }
+
+    return WAVL_ERR_OK;
+}
+
+wavl_result_t wavl_tree_build_parallel(struct wavl_tree *tree,
+                                       struct wavl_tree_node **nodes,
+                                       size_t n,
+                                       size_t nthreads)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+    struct _wavl_build_state *st = NULL;
+    size_t nr_threads = 0;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != nodes || 0 == n);
+    WAVL_ASSERT_ARG(0 < nthreads);
+    WAVL_ASSERT_ARG(NULL == tree->root);
+    WAVL_ASSERT_ARG(0 == tree->nr_pending);
+
+    if (0 == n) {
+        goto done;
+    }
+
+    if (NULL == (st = calloc(1, sizeof(*st)))) {
+        ret = WAVL_ERR_NO_SPACE;
+        goto done;
+    }
+
+    if (n > SIZE_MAX / sizeof(*nodes) || NULL == (st->scratch = malloc(n * sizeof(*nodes)))) {
+        ret = WAVL_ERR_NO_SPACE;
+        goto done;
+    }
+
+    nr_threads = __wavl_parallel_nr_threads(n, nthreads);
+
+    st->tree = tree;
+    st->nodes = nodes;
+    st->nr_nodes = n;
+
+    /* Each thread sorts a slice of the array, in place */
+    st->run = (n + nr_threads - 1) / nr_threads;
+
+    if (WAVL_FAILED(ret = _wavl_parallel_run(_wavl_build_sort_slice, st, nr_threads))) {
+        goto done;
+    }
+
+    /* Then pairs of slices are merged, alternating between the array and the scratch array */
+    st->src = nodes;
+    st->dst = st->scratch;
+
+    for (; st->run < n; st->run *= 2) {
+        struct wavl_tree_node **tmp = NULL;
+
+        if (WAVL_FAILED(ret = _wavl_parallel_run(_wavl_build_merge_slice, st, nr_threads))) {
+            /* The input of the failed round is intact */
+            if (st->src != nodes) {
+                memcpy(nodes, st->src, n * sizeof(*nodes));
+            }
+            goto done;
+        }
+
+        tmp = st->src;
+        st->src = st->dst;
+        st->dst = tmp;
+    }
+
+    if (WAVL_FAILED(ret = _wavl_parallel_run(_wavl_build_check_slice, st, nr_threads))) {
+        goto done;
+    }
+
+    /* Link the top of the tree here, and the subtrees below it on all the threads */
+    st->split_depth = __wavl_parallel_split_depth(nr_threads);
+
+    _wavl_build_top(st, nodes, n, NULL, &tree->root, 0);
+    _wavl_parallel_run(_wavl_build_link_subtrees, st, nr_threads);
+
+    tree->leftmost = nodes[0];
+    tree->rightmost = nodes[n - 1];
+
+#ifdef WAVL_TREE_STATS
+    tree->stats.inserts += n;
+#endif
+
+done:
+    if (NULL != st) {
+        free(st->scratch);
+        free(st);
+    }
+
+    return ret;
+}
+
+/**
+ * A piece of the tree to be walked by one of the threads of a parallel walk: either a whole
+ * subtree, or a single node above the subtrees.
+ */
+struct _wavl_walk_task {
+    struct wavl_tree_node *root;        /**< The root of the subtree, or the node */
+    bool single;                        /**< Visit only the node itself */
+};
+
+/**
+ * State shared between the threads of a parallel walk.
+ */
+struct _wavl_walk_state {
+    struct wavl_tree *tree;             /**< The tree being walked */
+    wavl_node_visit_func_t visit;       /**< Function to call on each node, or NULL */
+    wavl_node_fold_func_t fold;         /**< Function to fold each node, or NULL */
+    void *arg;                          /**< Argument for visit or fold */
+    uint8_t *accs;                      /**< Accumulator of each task, when folding */
+    size_t acc_size;                    /**< Size of each accumulator, in bytes */
+    size_t split_depth;                 /**< Depth at which subtrees are handed out */
+    size_t nr_tasks;                    /**< Number of pieces */
+    size_t next_task;                   /**< Next piece to be taken by a thread */
+    bool failed;                        /**< Set when a thread fails, so the rest stop early */
+    struct _wavl_walk_task tasks[2 * WAVL_PARALLEL_MAX_THREADS * WAVL_PARALLEL_TASKS_PER_THREAD];
+};
+
+/**
+ * Cut the tree into pieces, queued in key order: the subtrees at the split depth, and the
+ * nodes above them.
+ */
+static
+void _wavl_walk_split(struct _wavl_walk_state *st,
+                      struct wavl_tree_node *node,
+                      size_t depth)
+{
+    if (NULL == node) {
+        return;
+    }
+
+    if (depth == st->split_depth) {
+        st->tasks[st->nr_tasks].root = node;
+        st->tasks[st->nr_tasks].single = false;
+        st->nr_tasks++;
+        return;
+    }
+
+    _wavl_walk_split(st, node->left, depth + 1);
+
+    st->tasks[st->nr_tasks].root = node;
+    st->tasks[st->nr_tasks].single = true;
+    st->nr_tasks++;
+
+    _wavl_walk_split(st, node->right, depth + 1);
+}
+
+/**
+ * Visit or fold one node.
+ */
+static inline
+wavl_result_t __wavl_walk_node(struct _wavl_walk_state *st,
+                               struct wavl_tree_node *node,
+                               void *acc)
+{
+    if (NULL != st->visit) {
+        return st->visit(st->tree, node, st->arg);
+    }
+
+    return st->fold(st->tree, node, acc, st->arg);
+}
+
+/**
+ * Walk a piece of the tree in order. Subtrees are walked through the parent links, without
+ * leaving the subtree.
+ */
+static
+wavl_result_t _wavl_walk_task(struct _wavl_walk_state *st,
+                              struct _wavl_walk_task *task,
+                              void *acc)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+    struct wavl_tree_node *root = task->root,
+                          *cur = root;
+
+    if (true == task->single) {
+        ret = __wavl_walk_node(st, root, acc);
+        goto done;
+    }
+
+    while (NULL != cur->left) {
+        cur = cur->left;
+    }
+
+    while (NULL != cur) {
+        if (WAVL_FAILED(ret = __wavl_walk_node(st, cur, acc))) {
+            goto done;
+        }
+
+        if (NULL != cur->right) {
+            cur = cur->right;
+            while (NULL != cur->left) {
+                cur = cur->left;
+            }
+        } else {
+            while (cur != root && cur == cur->parent->right) {
+                cur = cur->parent;
+            }
+            cur = cur == root ? NULL : cur->parent;
+        }
+    }
+
+done:
+    return ret;
+}
+
+/**
+ * Take pieces of the tree and walk them, until none are left or a thread has failed.
+ */
+static
+wavl_result_t _wavl_walk_tasks(void *arg, size_t idx __attribute__((unused)), size_t nr __attribute__((unused)))
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+    struct _wavl_walk_state *st = arg;
+    size_t next = 0;
+
+    while ((next = __atomic_fetch_add(&st->next_task, 1, __ATOMIC_RELAXED)) < st->nr_tasks) {
+        void *acc = NULL == st->accs ? NULL : st->accs + next * st->acc_size;
+
+        if (true == __atomic_load_n(&st->failed, __ATOMIC_RELAXED)) {
+            break;
+        }
+
+        if (WAVL_FAILED(ret = _wavl_walk_task(st, &st->tasks[next], acc))) {
+            __atomic_store_n(&st->failed, true, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+
+    return ret;
+}
+
+wavl_result_t wavl_tree_parallel_for_each(struct wavl_tree *tree,
+                                          wavl_node_visit_func_t fn,
+                                          void *arg,
+                                          size_t nthreads)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+    struct _wavl_walk_state *st = NULL;
+    size_t nr_threads = nthreads < WAVL_PARALLEL_MAX_THREADS ? nthreads : WAVL_PARALLEL_MAX_THREADS;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != fn);
+    WAVL_ASSERT_ARG(0 < nthreads);
+
+    /* The walk follows the tree's links, so items staged in relaxed-balance mode go in first */
+    if (WAVL_FAILED(ret = wavl_tree_rebalance_step(tree, SIZE_MAX))) {
+        goto done;
+    }
+
+    if (NULL == tree->root) {
+        goto done;
+    }
+
+    if (NULL == (st = calloc(1, sizeof(*st)))) {
+        ret = WAVL_ERR_NO_SPACE;
+        goto done;
+    }
+
+    st->tree = tree;
+    st->visit = fn;
+    st->arg = arg;
+    st->split_depth = __wavl_parallel_split_depth(nr_threads);
+
+    _wavl_walk_split(st, tree->root, 0);
+
+    ret = _wavl_parallel_run(_wavl_walk_tasks, st, nr_threads);
+
+done:
+    free(st);
+    return ret;
+}
+
+wavl_result_t wavl_tree_parallel_reduce(struct wavl_tree *tree,
+                                        wavl_node_fold_func_t fold,
+                                        wavl_acc_combine_func_t combine,
+                                        void *acc,
+                                        size_t acc_size,
+                                        void *arg,
+                                        size_t nthreads)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+    struct _wavl_walk_state *st = NULL;
+    size_t nr_threads = nthreads < WAVL_PARALLEL_MAX_THREADS ? nthreads : WAVL_PARALLEL_MAX_THREADS;
+
+    WAVL_ASSERT_ARG(NULL != tree);
+    WAVL_ASSERT_ARG(NULL != fold);
+    WAVL_ASSERT_ARG(NULL != combine);
+    WAVL_ASSERT_ARG(NULL != acc);
+    WAVL_ASSERT_ARG(0 < acc_size);
+    WAVL_ASSERT_ARG(0 < nthreads);
+
+    /* The walk follows the tree's links, so items staged in relaxed-balance mode go in first */
+    if (WAVL_FAILED(ret = wavl_tree_rebalance_step(tree, SIZE_MAX))) {
+        goto done;
+    }
+
+    if (NULL == tree->root) {
+        goto done;
+    }
+
+    if (NULL == (st = calloc(1, sizeof(*st)))) {
+        ret = WAVL_ERR_NO_SPACE;
+        goto done;
+    }
+
+    st->tree = tree;
+    st->fold = fold;
+    st->arg = arg;
+    st->acc_size = acc_size;
+    st->split_depth = __wavl_parallel_split_depth(nr_threads);
+
+    _wavl_walk_split(st, tree->root, 0);
+
+    if (st->nr_tasks > SIZE_MAX / acc_size || NULL == (st->accs = malloc(st->nr_tasks * acc_size))) {
+        ret = WAVL_ERR_NO_SPACE;
+        goto done;
+    }
+
+    /* Every piece starts from the identity */
+    for (size_t i = 0; i < st->nr_tasks; i++) {
+        memcpy(st->accs + i * acc_size, acc, acc_size);
+    }
+
+    if (WAVL_FAILED(ret = _wavl_parallel_run(_wavl_walk_tasks, st, nr_threads))) {
+        goto done;
+    }
+
+    /* The pieces were queued in key order, so combine them in the same order */
+    for (size_t i = 0; i < st->nr_tasks; i++) {
+        if (WAVL_FAILED(ret = combine(acc, st->accs + i * acc_size, arg))) {
+            goto done;
+        }
+    }
+
+done:
+    if (NULL != st) {
+        free(st->accs);
+        free(st);
+    }
+
+    return ret;
+}
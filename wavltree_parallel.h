@@ -0,0 +1,125 @@
+#pragma once
+
+/** \file wavltree_parallel.h
+ * Operations that spread the work on a single WAVL tree across several threads. These use
+ * POSIX threads, and allocate their scratch memory with `malloc`, unlike the core library.
+ */
+
+#include "wavltree.h"
+
+#include <stddef.h>
+
+/**
+ * Largest number of threads a parallel operation will use. Requests for more are clamped.
+ */
+#define WAVL_PARALLEL_MAX_THREADS       64
+
+/**
+ * Fewest nodes worth handing to a thread of its own. Smaller inputs use fewer threads.
+ */
+#define WAVL_PARALLEL_MIN_PER_THREAD    1024
+
+/**
+ * Build a tree from an unsorted array of nodes, using several threads.
+ *
+ * The nodes are sorted with the tree's node comparison function: each thread merge-sorts a
+ * slice of the array, and the slices are then merged in rounds, with every thread producing
+ * an equal share of the output of each round. Adjacent nodes of the sorted array are checked
+ * for duplicate keys, and the balanced tree is then linked top-down, with the subtrees below
+ * the first few levels handed out to the threads. In that shape, the rank of every subtree is
+ * just floor(log2(size)), so no rebalancing takes place.
+ *
+ * \param tree Pointer to the tree state structure. The tree must be empty.
+ * \param nodes Array of n nodes to put in the tree. On success, the array is sorted in key
+ *              order. Nodes with equal keys keep the order they had in the array.
+ * \param n Number of nodes in the array.
+ * \param nthreads Number of threads to use, including the calling thread. At least 1.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_TREE_DUPE if two nodes have equal keys (in a tree
+ *         without `WAVL_TREE_FLAG_MULTI`), WAVL_ERR_NO_SPACE if the scratch array could not
+ *         be allocated, or the error returned by the comparison function. On failure, the tree
+ *         is left empty, and the array holds the same nodes, in an unspecified order.
+ *
+ * \note The comparison function is called from several threads at once. The inline keys used
+ *       by `wavl_tree_insert_u64` are not set, so do not mix this with the u64 functions.
+ */
+wavl_result_t wavl_tree_build_parallel(struct wavl_tree *tree,
+                                       struct wavl_tree_node **nodes,
+                                       size_t n,
+                                       size_t nthreads);
+
+/**
+ * Function called on each node by `wavl_tree_parallel_for_each`.
+ */
+typedef wavl_result_t (*wavl_node_visit_func_t)(struct wavl_tree *tree,
+                                                struct wavl_tree_node *node,
+                                                void *arg);
+
+/**
+ * Function that folds a node into an accumulator, for `wavl_tree_parallel_reduce`.
+ */
+typedef wavl_result_t (*wavl_node_fold_func_t)(struct wavl_tree *tree,
+                                               struct wavl_tree_node *node,
+                                               void *acc,
+                                               void *arg);
+
+/**
+ * Function that merges the accumulator of a later run of nodes, other, into acc, for
+ * `wavl_tree_parallel_reduce`.
+ */
+typedef wavl_result_t (*wavl_acc_combine_func_t)(void *acc,
+                                                 const void *other,
+                                                 void *arg);
+
+/**
+ * Call a function on every node of the tree, using several threads.
+ *
+ * The tree is cut into subtrees a few levels below the root, several per thread, and the
+ * nodes above the cut are taken singly. The rank rule keeps the tree within twice the height
+ * of a perfectly balanced one, but sibling subtrees may still differ a lot in size, so each
+ * thread takes the next piece from a shared counter as soon as it is done with the last:
+ * threads that draw small subtrees go on to take the rest. Each subtree is walked in order,
+ * but the pieces run in no particular order.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param fn The function to call on each node. It must not modify the shape of the tree.
+ * \param arg Argument passed through to fn.
+ * \param nthreads Number of threads to use, including the calling thread. At least 1.
+ *
+ * \return WAVL_ERR_OK if every call to fn succeeded. Otherwise, one of the errors returned
+ *         by fn. After an error, the threads stop taking new pieces, so some nodes may not be
+ *         visited.
+ */
+wavl_result_t wavl_tree_parallel_for_each(struct wavl_tree *tree,
+                                          wavl_node_visit_func_t fn,
+                                          void *arg,
+                                          size_t nthreads);
+
+/**
+ * Reduce every node of the tree to a single value, using several threads. The tree is split
+ * up as for `wavl_tree_parallel_for_each`. Each piece is folded, in order, into its own copy
+ * of the initial accumulator, and the copies are then combined into acc in key order. The
+ * result is the same as folding every node in order, as long as combine is associative; it
+ * need not be commutative.
+ *
+ * \param tree Pointer to the tree state structure.
+ * \param fold Function that folds a node into an accumulator.
+ * \param combine Function that merges one accumulator into another.
+ * \param acc The accumulator. On entry, it must hold the identity of combine (such as zero
+ *            for a sum). On success, it holds the result.
+ * \param acc_size Size of the accumulator, in bytes. Accumulators are copied with `memcpy`.
+ * \param arg Argument passed through to fold and combine.
+ * \param nthreads Number of threads to use, including the calling thread. At least 1.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_NO_SPACE if the accumulators could not be
+ *         allocated, or one of the errors returned by fold or combine. On failure, the
+ *         contents of acc are undefined.
+ */
+wavl_result_t wavl_tree_parallel_reduce(struct wavl_tree *tree,
+                                        wavl_node_fold_func_t fold,
+                                        wavl_acc_combine_func_t combine,
+                                        void *acc,
+                                        size_t acc_size,
+                                        void *arg,
+                                        size_t nthreads);
+
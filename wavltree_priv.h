@@ -21,6 +21,7 @@ typedef uint32_t wavl_result_t;
 
 #define WAVL_SYS_CORE                   1 /**< Error in some core part of the system, or state */
 #define WAVL_SYS_TREE                   2 /**< Error in the tree handling code */
+#define WAVL_SYS_IMAGE                  3 /**< Error reading or writing an on-disk tree image */
 
 #define WAVL_RESULT(_err, _sys, _code)  ((_err) | WAVL_ERROR_SYS(_sys) | WAVL_ERROR_CODE(_code))
 #define WAVL_ERROR(_sys, _code)         WAVL_RESULT(WAVL_ERROR_FLAG, (_sys), (_code))
@@ -28,9 +29,16 @@ typedef uint32_t wavl_result_t;
 
 #define WAVL_ERR_OK                     0
 #define WAVL_ERR_BAD_ARG                WAVL_ERROR(WAVL_SYS_CORE, 0) /**< Bad argument, i.e. unexpected NULL */
+#define WAVL_ERR_NOT_SUPPORTED          WAVL_ERROR(WAVL_SYS_CORE, 1) /**< Feature was not compiled in */
+#define WAVL_ERR_NO_SPACE               WAVL_ERROR(WAVL_SYS_CORE, 2) /**< Caller-supplied buffer is too small */
+#define WAVL_ERR_IO                     WAVL_ERROR(WAVL_SYS_CORE, 3) /**< A system call failed; see errno */
 
 #define WAVL_ERR_TREE_DUPE              WAVL_ERROR(WAVL_SYS_TREE, 0)    /**< Item to be inserted is a duplicate */
 #define WAVL_ERR_TREE_NOT_FOUND         WAVL_ERROR(WAVL_SYS_TREE, 1)    /**< Item not found in the tree */
+#define WAVL_ERR_TREE_CORRUPT           WAVL_ERROR(WAVL_SYS_TREE, 2)    /**< Tree structure is inconsistent */
+
+#define WAVL_ERR_IMAGE_IO               WAVL_ERROR(WAVL_SYS_IMAGE, 0)   /**< A system call on the image file failed; see errno */
+#define WAVL_ERR_IMAGE_FORMAT           WAVL_ERROR(WAVL_SYS_IMAGE, 1)   /**< The file is not a valid tree image */
 
 /**
  * Predicate to check if result code is OK
@@ -106,6 +114,42 @@ typedef wavl_result_t (*wavl_key_to_node_compare_func_t)(struct wavl_tree *tree,
                                                          struct wavl_tree_node *rhs,
                                                          int *pdir);
 
+/**
+ * Function to extract an unsigned integer key from a node. Used to build frozen images of a
+ * tree, so the order of the integer keys must match the order of the tree.
+ */
+typedef uint64_t (*wavl_node_to_u64_func_t)(struct wavl_tree_node *node);
+
+/**
+ * A variable-length byte-string key. Keys are ordered as by `memcmp`, with a key that is a
+ * prefix of another ordered first.
+ */
+struct wavl_bytes {
+    const void *ptr;                /**< The bytes of the key */
+    size_t len;                     /**< Length of the key, in bytes */
+};
+
+typedef struct wavl_bytes (*wavl_node_to_bytes_func_t)(struct wavl_tree_node *node);
+
+/**
+ * Function to hash the key of a node. Nodes with equal keys must have equal hashes.
+ */
+typedef uint64_t (*wavl_node_hash_func_t)(struct wavl_tree_node *node);
+
+/**
+ * Function to hash a key, as passed to the lookup functions. Must agree with the node hash
+ * function.
+ */
+typedef uint64_t (*wavl_key_hash_func_t)(void *key);
+
+/**
+ * Function that takes back an item staged in relaxed-balance mode, when the step that moves
+ * it into the tree finds an item with the same key there. The item is in neither.
+ */
+typedef void (*wavl_node_dupe_func_t)(struct wavl_tree *tree,
+                                      struct wavl_tree_node *node,
+                                      void *arg);
+
 /**
  * A WAVL-tree node. Embed this in your own structure. All members of this structure
  * are private.
@@ -114,18 +158,93 @@ struct wavl_tree_node {
     struct wavl_tree_node *left,    /**< Left-hand child; NULL if not present */
                           *right;   /**< Right-hand child; NULL if not present */
     struct wavl_tree_node *parent;  /**< The parent of this node */
+#ifdef WAVL_TREE_INLINE_KEY
+    uint64_t key;                   /**< Inline integer key, or ordered key prefix */
+#endif
     bool rp;                         /**< Rank parity */
+    bool pending;                    /**< Staged in relaxed-balance mode, not yet in the tree */
 };
 
 /**
  * Create an empty node, through assignment
  */
-#define WAVL_TREE_NODE_EMPTY    (struct wavl_tree_node){ .left = NULL, .right = NULL, .parent = NULL, .rp = false}
+#define WAVL_TREE_NODE_EMPTY    (struct wavl_tree_node){ .left = NULL, .right = NULL, .parent = NULL, .rp = false, .pending = false}
 
 /**
  * Clear a newly allocated WAVL tree node.
  */
-#define WAVL_TREE_NODE_CLEAR(_n) do { (_n)->left = (_n)->right = (_n)->parent = NULL; (_n)->rp = false; } while (0)
+#define WAVL_TREE_NODE_CLEAR(_n) do { (_n)->left = (_n)->right = (_n)->parent = NULL; (_n)->rp = false; (_n)->pending = false; } while (0)
+
+/**
+ * Counters describing how much work a tree has done. These are only maintained if
+ * the library is built with `WAVL_TREE_STATS` defined. Use `wavl_tree_get_stats` to
+ * read them.
+ */
+struct wavl_tree_stats {
+    uint64_t inserts;               /**< Successful insertions */
+    uint64_t removes;               /**< Removals */
+    uint64_t compares;              /**< Calls to the key comparison function */
+    uint64_t single_rotations;      /**< Single rotations performed while rebalancing */
+    uint64_t double_rotations;      /**< Double rotations performed while rebalancing */
+    uint64_t promotions;            /**< Rank promotions (a double promotion counts twice) */
+    uint64_t demotions;             /**< Rank demotions (a double demotion counts twice) */
+    uint64_t max_path_len;          /**< Longest search path walked, in nodes */
+    uint64_t cache_hits;            /**< Lookups answered by the lookup cache */
+    uint64_t cache_misses;          /**< Lookups the lookup cache could not answer */
+};
+
+/**
+ * Number of buckets in the depth and rank histograms of a `struct wavl_tree_report`. The
+ * height of a WAVL tree with n nodes is at most 2 * log2(n), so this covers any tree that
+ * fits in memory. Deeper nodes (only possible in a corrupted tree) land in the last bucket.
+ */
+#define WAVL_TREE_REPORT_BUCKETS        128
+
+/**
+ * A report on the shape of a WAVL tree, as produced by `wavl_tree_inspect`.
+ */
+struct wavl_tree_report {
+    size_t nr_nodes;                /**< Number of nodes in the tree */
+    size_t height;                  /**< Number of levels in the tree; 0 if the tree is empty */
+    size_t max_depth;               /**< Depth of the deepest node; the root is at depth 0 */
+    double mean_depth;              /**< Mean depth over all nodes */
+    size_t height_bound;            /**< Levels permitted for nr_nodes by the rank bound of 2 * log2(n).
+                                         height_bound - height is the remaining headroom. */
+    size_t root_rank;               /**< Rank of the root, reconstructed from the rank parities */
+    size_t rank_violations;         /**< External (NULL) positions whose reconstructed rank is not -1 */
+    size_t link_violations;         /**< Children whose parent pointer does not point back at their parent */
+    size_t nr_pending;              /**< Items staged in relaxed-balance mode, not counted above */
+    size_t depth_hist[WAVL_TREE_REPORT_BUCKETS];    /**< Number of nodes at each depth */
+    size_t rank_hist[WAVL_TREE_REPORT_BUCKETS];     /**< Number of nodes with each reconstructed rank */
+};
+
+/**
+ * A frozen, read-only image of a WAVL tree, produced by `wavl_tree_freeze`. The integer keys
+ * are stored in an array in Eytzinger (BFS) order, so a search is a branch-free walk down an
+ * implicit tree, where the next few levels of keys can be prefetched in one go. The node
+ * pointers are held in a parallel array. All members of this structure are private.
+ */
+struct wavl_frozen {
+    uint64_t *keys;                 /**< Keys, in Eytzinger order */
+    struct wavl_tree_node **nodes;  /**< Nodes, in the same order as the keys */
+    size_t nr_nodes;                /**< Number of nodes in the image */
+    size_t capacity;                /**< Number of entries the key and node arrays can hold */
+};
+
+/**
+ * Number of slots in each set of a tree's lookup cache.
+ */
+#define WAVL_TREE_CACHE_WAYS            2
+
+/**
+ * A slot of a tree's lookup cache. All members are private.
+ */
+struct wavl_tree_cache_slot {
+    uint64_t hash;                  /**< Hash of the key of the node */
+    struct wavl_tree_node *node;    /**< The node; NULL if the slot is empty */
+};
+
+#define WAVL_TREE_FLAG_MULTI            (1u << 0)   /**< Permit duplicate keys */
 
 /**
  * A WAVL tree. This structure contains all the state needed to maintain a wavl
@@ -134,8 +253,28 @@ struct wavl_tree_node {
  */
 struct wavl_tree {
     struct wavl_tree_node *root;                /**< Root of the tree */
+    struct wavl_tree_node *leftmost;            /**< Minimum node of the tree; NULL if empty */
+    struct wavl_tree_node *rightmost;           /**< Maximum node of the tree; NULL if empty */
     wavl_node_to_node_compare_func_t node_cmp;  /**< Function pointer to compare a node to a node */
     wavl_key_to_node_compare_func_t key_cmp;    /**< Function pointer to compare a key to a node */
+    wavl_node_to_bytes_func_t node_bytes;       /**< Gets the key of a node, in byte-string key mode */
+    uint32_t flags;                             /**< WAVL_TREE_FLAG_* */
+    struct wavl_tree_cache_slot *cache;         /**< Lookup cache; NULL if there is none */
+    size_t cache_mask;                          /**< Number of sets in the lookup cache, less one */
+    wavl_key_hash_func_t cache_key_hash;        /**< Hashes keys, to look them up in the cache */
+    wavl_node_hash_func_t cache_node_hash;      /**< Hashes nodes, to drop them from the cache */
+    struct wavl_tree_node *staged_first;        /**< Oldest item staged in relaxed mode, not yet in the tree */
+    struct wavl_tree_node *staged_last;         /**< Newest staged item */
+    size_t nr_pending;                          /**< Number of staged items */
+    wavl_node_dupe_func_t on_dupe;              /**< Takes back staged duplicates; NULL unless in relaxed mode */
+    void *on_dupe_arg;                          /**< Argument passed to on_dupe */
+#ifdef WAVL_TREE_STATS
+    struct wavl_tree_stats stats;               /**< Rebalancing statistics */
+#endif
+};
+
+struct wavl_pq {
+    struct wavl_tree tree;                      /**< The tree holding the queued items */
 };
 
 #ifndef __WAVL_INCLUDING_WAVL_PRIV_H__
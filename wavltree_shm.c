@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2021, Phil Vachon <phil@security-embedded.com>>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "wavltree_shm.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+/**
+ * The first block starts after the header, aligned to the smallest block size.
+ */
+#define WAVL_SHM_FIRST_BLOCK \
+    ((sizeof(struct wavl_shm_header) + WAVL_SHM_MIN_ALLOC - 1) & ~(size_t)(WAVL_SHM_MIN_ALLOC - 1))
+
+wavl_result_t wavl_shm_format(struct wavl_shm *shm,
+                              void *base,
+                              size_t size,
+                              wavl_ckey_to_node_compare_func_t key_cmp)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_shm_header *hdr = base;
+
+    WAVL_ASSERT_ARG(NULL != shm);
+    WAVL_ASSERT_ARG(NULL != base);
+    WAVL_ASSERT_ARG(0 == ((uintptr_t)base & (WAVL_SHM_MIN_ALLOC - 1)));
+    WAVL_ASSERT_ARG(NULL != key_cmp);
+
+    if (size < WAVL_SHM_FIRST_BLOCK) {
+        ret = WAVL_ERR_NO_SPACE;
+        goto done;
+    }
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->size = size;
+    hdr->root = 0;
+    hdr->brk = WAVL_SHM_FIRST_BLOCK;
+    hdr->nr_allocated = 0;
+
+    /* Only mark the region as formatted once the rest of the header is in place */
+    __atomic_store_n(&hdr->magic, WAVL_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    ret = wavl_shm_attach(shm, base, size, key_cmp);
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_shm_attach(struct wavl_shm *shm,
+                              void *base,
+                              size_t size,
+                              wavl_ckey_to_node_compare_func_t key_cmp)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_shm_header *hdr = base;
+
+    WAVL_ASSERT_ARG(NULL != shm);
+    WAVL_ASSERT_ARG(NULL != base);
+    WAVL_ASSERT_ARG(0 == ((uintptr_t)base & (WAVL_SHM_MIN_ALLOC - 1)));
+    WAVL_ASSERT_ARG(NULL != key_cmp);
+
+    if (size < WAVL_SHM_FIRST_BLOCK ||
+            WAVL_SHM_MAGIC != __atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) ||
+            hdr->size > size ||
+            hdr->brk > hdr->size)
+    {
+        ret = WAVL_ERR_TREE_CORRUPT;
+        goto done;
+    }
+
+    shm->hdr = hdr;
+
+    ret = wavl_ctree_init_based(&shm->tree, key_cmp, base, &hdr->root);
+
+done:
+    return ret;
+}
+
+/**
+ * Get the size class for an allocation of the given size.
+ */
+static inline
+unsigned _wavl_shm_size_class(size_t size)
+{
+    unsigned cls = 0;
+
+    while (((size_t)WAVL_SHM_MIN_ALLOC << cls) < size) {
+        cls++;
+    }
+
+    return cls;
+}
+
+wavl_result_t wavl_shm_alloc(struct wavl_shm *shm,
+                             size_t size,
+                             void **pptr)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_shm_header *hdr = NULL;
+    unsigned cls = 0;
+    uint64_t off = 0,
+             cls_size = 0;
+
+    WAVL_ASSERT_ARG(NULL != shm);
+    WAVL_ASSERT_ARG(NULL != pptr);
+    WAVL_ASSERT_ARG(0 < size && size <= WAVL_SHM_MAX_ALLOC);
+
+    hdr = shm->hdr;
+    cls = _wavl_shm_size_class(size);
+    cls_size = (uint64_t)WAVL_SHM_MIN_ALLOC << cls;
+
+    *pptr = NULL;
+
+    if (0 != (off = hdr->free_list[cls])) {
+        /* A free block holds the offset of the next free block of its class */
+        WAVL_ASSERT(off + cls_size <= hdr->brk);
+        memcpy(&hdr->free_list[cls], wavl_shm_offset_to_ptr(shm, off), sizeof(uint64_t));
+    } else {
+        if (cls_size > hdr->size - hdr->brk) {
+            ret = WAVL_ERR_NO_SPACE;
+            goto done;
+        }
+
+        off = hdr->brk;
+        hdr->brk += cls_size;
+    }
+
+    hdr->nr_allocated++;
+    *pptr = wavl_shm_offset_to_ptr(shm, off);
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_shm_free(struct wavl_shm *shm,
+                            void *ptr,
+                            size_t size)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_shm_header *hdr = NULL;
+    unsigned cls = 0;
+    uint64_t off = 0;
+
+    WAVL_ASSERT_ARG(NULL != shm);
+    WAVL_ASSERT_ARG(NULL != ptr);
+    WAVL_ASSERT_ARG(0 < size && size <= WAVL_SHM_MAX_ALLOC);
+
+    hdr = shm->hdr;
+    off = wavl_shm_ptr_to_offset(shm, ptr);
+    cls = _wavl_shm_size_class(size);
+
+    WAVL_ASSERT_ARG(WAVL_SHM_FIRST_BLOCK <= off && off < hdr->brk);
+    WAVL_ASSERT_ARG(0 == (off & (WAVL_SHM_MIN_ALLOC - 1)));
+    WAVL_ASSERT(0 != hdr->nr_allocated);
+
+    memcpy(ptr, &hdr->free_list[cls], sizeof(uint64_t));
+    hdr->free_list[cls] = off;
+    hdr->nr_allocated--;
+
+    return ret;
+}
+
@@ -0,0 +1,143 @@
+#pragma once
+
+/** \file wavltree_shm.h
+ * A compact WAVL tree in a shared memory region, such as a `shm_open` object or a file
+ * mapped with `MAP_SHARED`. The region starts with a small header holding the link to the
+ * root of the tree and the state of a simple allocator for the nodes. All links are offsets
+ * from the start of the region, so each process may map it at a different address.
+ *
+ * The allocator hands out blocks from power-of-two size classes, carved from the region in
+ * order and recycled through a free list per class. Freed blocks are never merged or given
+ * back to the region.
+ *
+ * Nothing here takes a lock. Callers must serialize all access to a region between processes
+ * (and threads), for example with a process-shared mutex or `flock`.
+ */
+
+#include "wavltree_compact.h"
+
+#include <stdint.h>
+
+/**
+ * Number of allocator size classes. The smallest class is WAVL_SHM_MIN_ALLOC bytes, and each
+ * class is twice the size of the previous.
+ */
+#define WAVL_SHM_NR_CLASSES             20
+
+/**
+ * The smallest block the allocator hands out, in bytes. This is also the alignment of every
+ * block.
+ */
+#define WAVL_SHM_MIN_ALLOC              16
+
+/**
+ * The largest block the allocator hands out, in bytes.
+ */
+#define WAVL_SHM_MAX_ALLOC              ((size_t)WAVL_SHM_MIN_ALLOC << (WAVL_SHM_NR_CLASSES - 1))
+
+/**
+ * The header at the start of a shared region. All members are private.
+ */
+struct wavl_shm_header {
+    uint64_t magic;                 /**< WAVL_SHM_MAGIC, once the region is formatted */
+    uint64_t size;                  /**< Size of the region, in bytes */
+    uintptr_t root;                 /**< Link to the root of the tree */
+    uint64_t brk;                   /**< Offset of the first byte never allocated */
+    uint64_t nr_allocated;          /**< Number of blocks currently allocated */
+    uint64_t free_list[WAVL_SHM_NR_CLASSES]; /**< Offset of the first free block of each class */
+};
+
+#define WAVL_SHM_MAGIC                  0x315248534c564157ull
+
+/**
+ * A process's handle on a shared region, and the tree within it. All members are private.
+ */
+struct wavl_shm {
+    struct wavl_shm_header *hdr;    /**< The region, as mapped in this process */
+    struct wavl_ctree tree;         /**< Handle on the tree in the region */
+};
+
+/**
+ * Format a new shared region, with an empty tree, and attach to it.
+ *
+ * \param shm The handle to initialize.
+ * \param base The region, as mapped in this process. Must be 16-byte aligned.
+ * \param size The size of the region, in bytes.
+ * \param key_cmp Pointer to function that performs key-to-node comparisons.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_NO_SPACE if the region is too small for the header.
+ */
+wavl_result_t wavl_shm_format(struct wavl_shm *shm,
+                              void *base,
+                              size_t size,
+                              wavl_ckey_to_node_compare_func_t key_cmp);
+
+/**
+ * Attach to a shared region formatted by `wavl_shm_format`, possibly in another process.
+ *
+ * \param shm The handle to initialize.
+ * \param base The region, as mapped in this process. Must be 16-byte aligned.
+ * \param size The size of the region, in bytes, as mapped in this process.
+ * \param key_cmp Pointer to function that performs key-to-node comparisons.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_TREE_CORRUPT if the region is not formatted, or
+ *         is larger than the mapping.
+ */
+wavl_result_t wavl_shm_attach(struct wavl_shm *shm,
+                              void *base,
+                              size_t size,
+                              wavl_ckey_to_node_compare_func_t key_cmp);
+
+/**
+ * Get the tree held in a shared region. Use the `wavl_ctree_*` functions on it.
+ */
+static inline
+struct wavl_ctree *wavl_shm_tree(struct wavl_shm *shm)
+{
+    return &shm->tree;
+}
+
+/**
+ * Allocate a block from a shared region.
+ *
+ * \param shm The region.
+ * \param size The size of the block, in bytes. At most WAVL_SHM_MAX_ALLOC.
+ * \param pptr The block, returned by reference. Set to NULL on failure.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_NO_SPACE if the region is full.
+ */
+wavl_result_t wavl_shm_alloc(struct wavl_shm *shm,
+                             size_t size,
+                             void **pptr);
+
+/**
+ * Return a block to a shared region.
+ *
+ * \param shm The region.
+ * \param ptr The block, as returned by `wavl_shm_alloc`.
+ * \param size The size the block was allocated with.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ */
+wavl_result_t wavl_shm_free(struct wavl_shm *shm,
+                            void *ptr,
+                            size_t size);
+
+/**
+ * Convert a pointer into a shared region to an offset, to store in the region.
+ */
+static inline
+uint64_t wavl_shm_ptr_to_offset(struct wavl_shm *shm, const void *ptr)
+{
+    return NULL == ptr ? 0 : (uint64_t)((uintptr_t)ptr - (uintptr_t)shm->hdr);
+}
+
+/**
+ * Convert an offset stored in a shared region back to a pointer, in this process.
+ */
+static inline
+void *wavl_shm_offset_to_ptr(struct wavl_shm *shm, uint64_t offset)
+{
+    return 0 == offset ? NULL : (void *)((uintptr_t)shm->hdr + (uintptr_t)offset);
+}
+
@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2021, Phil Vachon <phil@security-embedded.com>>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define _GNU_SOURCE
+
+#include "wavltree_slab.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/**
+ * Free objects are chained through their first word.
+ */
+static inline
+void *__wavl_slab_obj_next(void *obj)
+{
+    return *(void **)obj;
+}
+
+static inline
+void __wavl_slab_obj_set_next(void *obj, void *next)
+{
+    *(void **)obj = next;
+}
+
+/**
+ * Round an object size up to its size class.
+ */
+static inline
+size_t _wavl_slab_size_class(size_t obj_size)
+{
+    if (obj_size <= 128) {
+        return (obj_size + 15) & ~(size_t)15;
+    }
+
+    return (obj_size + 63) & ~(size_t)63;
+}
+
+wavl_result_t wavl_slab_init(struct wavl_slab *slab,
+                             size_t obj_size,
+                             uint32_t flags)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    WAVL_ASSERT_ARG(NULL != slab);
+    WAVL_ASSERT_ARG(0 < obj_size && obj_size <= WAVL_SLAB_MAX_OBJ);
+    WAVL_ASSERT_ARG(0 == (flags & ~(WAVL_SLAB_FLAG_HUGETLB | WAVL_SLAB_FLAG_THP)));
+
+    memset(slab, 0, sizeof(*slab));
+
+    if (0 != pthread_mutex_init(&slab->lock, NULL)) {
+        ret = WAVL_ERR_NO_SPACE;
+        goto done;
+    }
+
+    slab->obj_size = _wavl_slab_size_class(obj_size);
+    slab->flags = flags;
+    slab->stats.obj_size = slab->obj_size;
+
+done:
+    return ret;
+}
+
+wavl_result_t wavl_slab_destroy(struct wavl_slab *slab)
+{
+    struct wavl_slab_chunk *chunk = NULL;
+
+    WAVL_ASSERT_ARG(NULL != slab);
+
+    chunk = slab->chunks;
+
+    while (NULL != chunk) {
+        struct wavl_slab_chunk *next = chunk->next;
+        munmap(chunk, chunk->len);
+        chunk = next;
+    }
+
+    pthread_mutex_destroy(&slab->lock);
+    memset(slab, 0, sizeof(*slab));
+
+    return WAVL_ERR_OK;
+}
+
+wavl_result_t wavl_slab_get_stats(struct wavl_slab *slab,
+                                  struct wavl_slab_stats *stats)
+{
+    WAVL_ASSERT_ARG(NULL != slab);
+    WAVL_ASSERT_ARG(NULL != stats);
+
+    pthread_mutex_lock(&slab->lock);
+    *stats = slab->stats;
+    stats->nr_pool_free = slab->nr_free;
+    pthread_mutex_unlock(&slab->lock);
+
+    return WAVL_ERR_OK;
+}
+
+/**
+ * Map a chunk, aligned to its own size so that it can be backed by huge pages. Returns NULL
+ * if no memory is available. Called with the slab lock held.
+ */
+static
+struct wavl_slab_chunk *_wavl_slab_map_chunk(struct wavl_slab *slab)
+{
+    struct wavl_slab_chunk *chunk = NULL;
+    uint8_t *map = MAP_FAILED,
+            *aligned = NULL;
+    size_t len = WAVL_SLAB_CHUNK_SIZE;
+
+#ifdef MAP_HUGETLB
+    if (0 != (slab->flags & WAVL_SLAB_FLAG_HUGETLB)) {
+        /* Reserved huge pages are always aligned to their size */
+        map = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (MAP_FAILED != map) {
+            slab->stats.nr_hugetlb_chunks++;
+            chunk = (struct wavl_slab_chunk *)map;
+            goto done;
+        }
+    }
+#endif
+
+    /* Over-allocate, then trim the ends so the chunk is aligned */
+    map = mmap(NULL, 2 * len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == map) {
+        goto done;
+    }
+
+    aligned = (uint8_t *)(((uintptr_t)map + len - 1) & ~(uintptr_t)(len - 1));
+
+    if (aligned != map) {
+        munmap(map, (size_t)(aligned - map));
+    }
+
+    if (aligned + len != map + 2 * len) {
+        munmap(aligned + len, (size_t)(map + 2 * len - (aligned + len)));
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (0 != (slab->flags & (WAVL_SLAB_FLAG_HUGETLB | WAVL_SLAB_FLAG_THP))) {
+        /* Advisory only: carry on with small pages if THP is disabled */
+        madvise(aligned, len, MADV_HUGEPAGE);
+    }
+#endif
+
+    chunk = (struct wavl_slab_chunk *)aligned;
+
+done:
+    if (NULL != chunk) {
+        chunk->len = len;
+        chunk->next = slab->chunks;
+        slab->chunks = chunk;
+        slab->stats.nr_chunks++;
+
+        /* Objects start on a cache line after the chunk header */
+        slab->bump = (uint8_t *)chunk + 64;
+        slab->bump_end = (uint8_t *)chunk + len;
+    }
+
+    return chunk;
+}
+
+/**
+ * Move up to a batch of free objects from the global pool into a cache, carving new objects
+ * from the current chunk once the pool runs dry.
+ */
+static
+wavl_result_t _wavl_slab_cache_refill(struct wavl_slab_cache *cache)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_slab *slab = cache->slab;
+    size_t nr_moved = 0;
+
+    pthread_mutex_lock(&slab->lock);
+
+    while (nr_moved < WAVL_SLAB_BATCH && NULL != slab->free_list) {
+        void *obj = slab->free_list;
+
+        slab->free_list = __wavl_slab_obj_next(obj);
+        slab->nr_free--;
+
+        __wavl_slab_obj_set_next(obj, cache->free_list);
+        cache->free_list = obj;
+        nr_moved++;
+    }
+
+    while (nr_moved < WAVL_SLAB_BATCH) {
+        void *obj = NULL;
+
+        if ((size_t)(slab->bump_end - slab->bump) < slab->obj_size &&
+                NULL == _wavl_slab_map_chunk(slab))
+        {
+            break;
+        }
+
+        obj = slab->bump;
+        slab->bump += slab->obj_size;
+
+        __wavl_slab_obj_set_next(obj, cache->free_list);
+        cache->free_list = obj;
+        nr_moved++;
+    }
+
+    slab->stats.nr_refills++;
+
+    pthread_mutex_unlock(&slab->lock);
+
+    cache->nr_free += nr_moved;
+
+    if (0 == nr_moved) {
+        ret = WAVL_ERR_NO_SPACE;
+    }
+
+    return ret;
+}
+
+/**
+ * Hand the first nr_objs free objects of a cache back to the global pool. The chain is
+ * spliced onto the pool in one step, so the lock is held only briefly.
+ */
+static
+void _wavl_slab_cache_drain(struct wavl_slab_cache *cache, size_t nr_objs)
+{
+    struct wavl_slab *slab = cache->slab;
+    void *head = cache->free_list,
+         *tail = head;
+
+    WAVL_ASSERT(0 < nr_objs && nr_objs <= cache->nr_free);
+
+    for (size_t i = 1; i < nr_objs; i++) {
+        tail = __wavl_slab_obj_next(tail);
+    }
+
+    cache->free_list = __wavl_slab_obj_next(tail);
+    cache->nr_free -= nr_objs;
+
+    pthread_mutex_lock(&slab->lock);
+    __wavl_slab_obj_set_next(tail, slab->free_list);
+    slab->free_list = head;
+    slab->nr_free += nr_objs;
+    slab->stats.nr_drains++;
+    pthread_mutex_unlock(&slab->lock);
+}
+
+wavl_result_t wavl_slab_cache_init(struct wavl_slab_cache *cache,
+                                   struct wavl_slab *slab)
+{
+    WAVL_ASSERT_ARG(NULL != cache);
+    WAVL_ASSERT_ARG(NULL != slab);
+
+    cache->slab = slab;
+    cache->free_list = NULL;
+    cache->nr_free = 0;
+
+    return WAVL_ERR_OK;
+}
+
+wavl_result_t wavl_slab_cache_flush(struct wavl_slab_cache *cache)
+{
+    WAVL_ASSERT_ARG(NULL != cache);
+
+    if (0 != cache->nr_free) {
+        _wavl_slab_cache_drain(cache, cache->nr_free);
+    }
+
+    return WAVL_ERR_OK;
+}
+
+wavl_result_t wavl_slab_alloc(struct wavl_slab_cache *cache,
+                              void **pobj)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    void *obj = NULL;
+
+    WAVL_ASSERT_ARG(NULL != cache);
+    WAVL_ASSERT_ARG(NULL != pobj);
+
+    if (WAVL_UNLIKELY(NULL == cache->free_list) &&
+            WAVL_FAILED(ret = _wavl_slab_cache_refill(cache)))
+    {
+        goto done;
+    }
+
+    obj = cache->free_list;
+    cache->free_list = __wavl_slab_obj_next(obj);
+    cache->nr_free--;
+
+done:
+    *pobj = obj;
+    return ret;
+}
+
+wavl_result_t wavl_slab_free(struct wavl_slab_cache *cache,
+                             void *obj)
+{
+    WAVL_ASSERT_ARG(NULL != cache);
+    WAVL_ASSERT_ARG(NULL != obj);
+
+    __wavl_slab_obj_set_next(obj, cache->free_list);
+    cache->free_list = obj;
+    cache->nr_free++;
+
+    if (WAVL_UNLIKELY(cache->nr_free > WAVL_SLAB_CACHE_MAX)) {
+        _wavl_slab_cache_drain(cache, WAVL_SLAB_BATCH);
+    }
+
+    return WAVL_ERR_OK;
+}
+
@@ -0,0 +1,166 @@
+#pragma once
+
+/** \file wavltree_slab.h
+ * A slab allocator for containers that embed a `struct wavl_tree_node`. Objects are carved
+ * from large, aligned chunks, optionally backed by huge pages, so that the nodes of a tree
+ * share as few pages (and TLB entries) as possible.
+ *
+ * Each thread allocates and frees through its own `struct wavl_slab_cache`, which holds a
+ * short free list and needs no locking. A cache moves objects to and from the slab's global
+ * pool in batches of WAVL_SLAB_BATCH, so the pool lock is taken once per batch, not once per
+ * object. An object may be freed through a different cache than the one it came from.
+ */
+
+#include "wavltree.h"
+
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * Size of the chunks objects are carved from. This is the size of a huge page on x86-64 and
+ * on most arm64 configurations.
+ */
+#define WAVL_SLAB_CHUNK_SIZE            (2ul << 20)
+
+/**
+ * Number of objects moved between a per-thread cache and the global pool at a time.
+ */
+#define WAVL_SLAB_BATCH                 32
+
+/**
+ * A per-thread cache returns a batch to the global pool when it holds more than this many
+ * free objects.
+ */
+#define WAVL_SLAB_CACHE_MAX             (2 * WAVL_SLAB_BATCH)
+
+/**
+ * Largest object a slab can hold, in bytes.
+ */
+#define WAVL_SLAB_MAX_OBJ               4096
+
+#define WAVL_SLAB_FLAG_HUGETLB          (1u << 0)   /**< Back chunks with reserved huge pages (MAP_HUGETLB) */
+#define WAVL_SLAB_FLAG_THP              (1u << 1)   /**< Ask for transparent huge pages (MADV_HUGEPAGE) */
+
+/**
+ * Counters describing a slab, as returned by `wavl_slab_get_stats`.
+ */
+struct wavl_slab_stats {
+    size_t obj_size;                /**< Size class objects are allocated from, in bytes */
+    size_t nr_chunks;               /**< Chunks mapped */
+    size_t nr_hugetlb_chunks;       /**< Chunks backed by reserved huge pages */
+    size_t nr_pool_free;            /**< Free objects in the global pool, not counting caches */
+    uint64_t nr_refills;            /**< Batches handed from the global pool to caches */
+    uint64_t nr_drains;             /**< Batches handed back from caches to the global pool */
+};
+
+/**
+ * A chunk of memory objects are carved from. The header sits at the start of the chunk.
+ */
+struct wavl_slab_chunk {
+    struct wavl_slab_chunk *next;   /**< Next chunk of the slab */
+    size_t len;                     /**< Length of the mapping, in bytes */
+};
+
+/**
+ * A slab, holding objects of one size class. All members of this structure are private.
+ */
+struct wavl_slab {
+    pthread_mutex_t lock;           /**< Protects everything below */
+    size_t obj_size;                /**< Size class of the objects */
+    uint32_t flags;                 /**< WAVL_SLAB_FLAG_* */
+    void *free_list;                /**< Free objects in the global pool */
+    size_t nr_free;                 /**< Number of objects in free_list */
+    struct wavl_slab_chunk *chunks; /**< All chunks mapped for this slab */
+    uint8_t *bump;                  /**< Next unused byte in the newest chunk */
+    uint8_t *bump_end;              /**< End of the newest chunk */
+    struct wavl_slab_stats stats;   /**< Counters */
+};
+
+/**
+ * A per-thread cache of free objects from a slab. All members of this structure are private.
+ */
+struct wavl_slab_cache {
+    struct wavl_slab *slab;         /**< The slab this cache draws from */
+    void *free_list;                /**< Free objects held by this cache */
+    size_t nr_free;                 /**< Number of objects in free_list */
+};
+
+/**
+ * Initialize a slab.
+ *
+ * \param slab The slab to initialize.
+ * \param obj_size The size of each object, in bytes. This is rounded up to a size class: a
+ *                 multiple of 16 bytes up to 128, and of 64 bytes (a cache line) above that.
+ * \param flags WAVL_SLAB_FLAG_* to choose the page size backing the slab. If reserved huge
+ *              pages are requested but none are available, the slab falls back to transparent
+ *              huge pages.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ */
+wavl_result_t wavl_slab_init(struct wavl_slab *slab,
+                             size_t obj_size,
+                             uint32_t flags);
+
+/**
+ * Release all the memory of a slab. Every object allocated from the slab becomes invalid,
+ * and all caches of the slab must be discarded.
+ *
+ * \param slab The slab.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ */
+wavl_result_t wavl_slab_destroy(struct wavl_slab *slab);
+
+/**
+ * Get the counters of a slab.
+ *
+ * \param slab The slab.
+ * \param stats The counters, returned by reference.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ */
+wavl_result_t wavl_slab_get_stats(struct wavl_slab *slab,
+                                  struct wavl_slab_stats *stats);
+
+/**
+ * Initialize a per-thread cache for a slab. A cache must only be used by one thread at a time.
+ *
+ * \param cache The cache to initialize.
+ * \param slab The slab the cache draws objects from.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ */
+wavl_result_t wavl_slab_cache_init(struct wavl_slab_cache *cache,
+                                   struct wavl_slab *slab);
+
+/**
+ * Return every free object held by a cache to the global pool, such as when a thread exits.
+ *
+ * \param cache The cache.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ */
+wavl_result_t wavl_slab_cache_flush(struct wavl_slab_cache *cache);
+
+/**
+ * Allocate an object. The contents of the object are undefined.
+ *
+ * \param cache The calling thread's cache.
+ * \param pobj The object, returned by reference. Set to NULL on failure.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_NO_SPACE if a new chunk could not be mapped.
+ */
+wavl_result_t wavl_slab_alloc(struct wavl_slab_cache *cache,
+                              void **pobj);
+
+/**
+ * Free an object.
+ *
+ * \param cache The calling thread's cache. Must be a cache of the slab the object came from.
+ * \param obj The object.
+ *
+ * \return WAVL_ERR_OK on success, an error code otherwise.
+ */
+wavl_result_t wavl_slab_free(struct wavl_slab_cache *cache,
+                             void *obj);
+
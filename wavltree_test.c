@@ -26,12 +26,25 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "wavltree.h"
+#include "wavltree_compact.h"
+#include "wavltree_image.h"
+#include "wavltree_shm.h"
+#include "wavltree_slab.h"
+#include "wavltree_trace.h"
+#include "wavltree_parallel.h"
+#include "wavltree_htree.h"
 
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #define WAVL_TEST_ASSERT(_x) \
     do {                                \
@@ -56,58 +69,6 @@ struct test_node {
  */
 struct test_node nodes[256];
 
-static
-size_t _binary_tree_log_2(size_t count)
-{
-    return 63U - __builtin_clzll(count);
-}
-
-static
-struct wavl_tree_node *_binary_tree_find_minimum(struct wavl_tree_node *root)
-{
-    assert(NULL != root);
-
-    struct wavl_tree_node *cur = root;
-
-    while (NULL != cur->left) {
-        cur = cur->left;
-    }
-
-    return cur;
-}
-
-static
-struct wavl_tree_node *_binary_tree_find_successor(struct wavl_tree_node *node)
-{
-    assert(NULL != node);
-
-    struct wavl_tree_node *cur = node;
-
-    /* If this node has a right-hand tree, then the successor is the minimum of that tree */
-    if (NULL == node->right) {
-        return _binary_tree_find_minimum(cur);
-    }
-
-    return cur;
-}
-
-static
-bool binary_tree_assert(struct wavl_tree *tree, size_t nr_nodes)
-{
-    ptrdiff_t ids[nr_nodes];    /* The list of values, in-order, held by the tree */
-    struct wavl_tree_node *visit_stack[_binary_tree_log_2(nr_nodes) * 2];
-    size_t next_id = 0,
-           stack_top = 0;
-
-    struct wavl_tree_node *cur_node = tree->root;
-
-    while (true) {
-
-    }
-
-    return true;
-}
-
 static
 void wavl_test_dump_tree(struct test_node *start, size_t nr_nodes)
 {
@@ -151,6 +112,50 @@ void wavl_test_dump_tree(struct test_node *start, size_t nr_nodes)
     fprintf(stderr, "}\n");
 }
 
+/**
+ * Check the shape of the tree: the node count must match, the rank rule must hold
+ * everywhere and the height must be within the WAVL bound. Dumps the tree on failure.
+ */
+static
+bool wavl_test_check_tree(struct wavl_tree *tree, size_t nr_nodes)
+{
+    struct wavl_tree_report report;
+    struct wavl_tree_node *min = tree->root,
+                          *max = tree->root,
+                          *cached = NULL;
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_inspect(tree, &report));
+
+    /* The cached minimum and maximum must match the ends of the tree */
+    while (NULL != min && NULL != min->left) {
+        min = min->left;
+    }
+
+    while (NULL != max && NULL != max->right) {
+        max = max->right;
+    }
+
+    cached = tree->leftmost;
+    WAVL_TEST_ASSERT(min == cached);
+    cached = tree->rightmost;
+    WAVL_TEST_ASSERT(max == cached);
+
+    if (report.nr_nodes != nr_nodes ||
+            0 != report.rank_violations ||
+            0 != report.link_violations ||
+            report.height > report.height_bound)
+    {
+        wavl_test_dump_tree(nodes, sizeof(nodes)/sizeof(struct test_node));
+    }
+
+    WAVL_TEST_ASSERT(report.nr_nodes == nr_nodes);
+    WAVL_TEST_ASSERT(0 == report.rank_violations);
+    WAVL_TEST_ASSERT(0 == report.link_violations);
+    WAVL_TEST_ASSERT(report.height <= report.height_bound);
+
+    return true;
+}
+
 static
 wavl_result_t _test_node_compare_func(ptrdiff_t lhs,
                                       ptrdiff_t rhs,
@@ -248,7 +253,7 @@ bool wavl_test_sign_invert_insert(void)
         sign = -sign;
     }
 
-    //wavl_test_dump_tree(nodes, sizeof(nodes)/sizeof(struct test_node));
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, sizeof(nodes)/sizeof(struct test_node)));
 
     return true;
 }
@@ -275,7 +280,7 @@ bool wavl_test_delete_leaf_unary_sibling(void)
     /* Remove node 9 from the tree. Node 9 is a 2-child of node 11. */
     WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(&tree, &nodes[9].node));
 
-    //wavl_test_dump_tree(nodes, 16);
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, 15));
 
     return true;
 }
@@ -307,7 +312,7 @@ bool wavl_test_delete_leaf_leaf_sibling(void)
     /* Remove node -10 */
     WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(&tree, &nodes[10].node));
 
-    //wavl_test_dump_tree(nodes, 16);
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, 14));
 
     return true;
 
@@ -335,7 +340,7 @@ bool wavl_test_delete_inner_1(void)
     /* Remove node -8 from the tree. Node -8 is a 2-child of node 0. */
     WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(&tree, &nodes[8].node));
 
-    //wavl_test_dump_tree(nodes, 16);
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, 15));
 
     return true;
 }
@@ -364,7 +369,7 @@ bool wavl_test_delete_every_third(void)
         WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(&tree, &nodes[i].node));
     }
 
-    //wavl_test_dump_tree(nodes, nr_nodes);
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes - nr_nodes / 3));
 
     return true;
 }
@@ -399,7 +404,7 @@ bool wavl_test_delete_every_third_then_reinsert(void)
         WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)nodes[i].id, &nodes[i].node));
     }
 
-    // wavl_test_dump_tree(nodes, nr_nodes);
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes));
 
     return true;
 }
@@ -442,103 +447,2208 @@ bool wavl_test_find(void)
     return true;
 }
 
-#define LFSR_POLY_6B_1 0x36
-#define LFSR_POLY_6B_2 0x30
+static
+bool wavl_test_stats(void)
+{
+    struct wavl_tree tree;
+    struct wavl_tree_stats stats;
+    const size_t nr_nodes = 64;
+
+    printf("WAVL: Testing rebalance statistics.\n");
+
+    wavl_test_clear();
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &stats));
+    WAVL_TEST_ASSERT(0 == stats.inserts);
+    WAVL_TEST_ASSERT(0 == stats.compares);
+
+    /* Sequential insertion forces rotations */
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[i].id = (ptrdiff_t)i + 1;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)nodes[i].id, &nodes[i].node));
+    }
+
+    /* Duplicates are not counted as insertions */
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_DUPE == wavl_tree_insert(&tree, (void *)nodes[0].id, &nodes[nr_nodes].node));
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &stats));
+    WAVL_TEST_ASSERT(nr_nodes == stats.inserts);
+    WAVL_TEST_ASSERT(0 == stats.removes);
+    WAVL_TEST_ASSERT(0 != stats.single_rotations);
+    WAVL_TEST_ASSERT(0 != stats.promotions);
+    WAVL_TEST_ASSERT(stats.compares >= nr_nodes);
+    /* Height of a WAVL tree is bounded by 2 * log2(n) */
+    WAVL_TEST_ASSERT(stats.max_path_len > 0 && stats.max_path_len <= 2 * 6);
+
+    for (size_t i = 0; i < nr_nodes; i += 2) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(&tree, &nodes[i].node));
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &stats));
+    WAVL_TEST_ASSERT(nr_nodes / 2 == stats.removes);
+    WAVL_TEST_ASSERT(0 != stats.demotions);
+
+    return true;
+}
 
 static
-uint32_t lfsr_next(uint32_t lfsr, uint32_t poly)
+bool wavl_test_inspect(void)
 {
-    bool fb = !!(lfsr & 1);
+    struct wavl_tree tree;
+    struct wavl_tree_report report;
 
-    lfsr >>= 1;
-    lfsr = !fb ? lfsr : (lfsr ^ poly);
+    printf("WAVL: Testing tree inspection.\n");
 
-    return lfsr;
+    wavl_test_clear();
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_inspect(&tree, &report));
+    WAVL_TEST_ASSERT(0 == report.nr_nodes);
+    WAVL_TEST_ASSERT(0 == report.height);
+
+    /* Sequential insertion of 7 nodes yields a perfect tree */
+    for (size_t i = 0; i < 7; i++) {
+        nodes[i].id = (ptrdiff_t)i + 1;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)nodes[i].id, &nodes[i].node));
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_inspect(&tree, &report));
+    WAVL_TEST_ASSERT(7 == report.nr_nodes);
+    WAVL_TEST_ASSERT(3 == report.height);
+    WAVL_TEST_ASSERT(2 == report.max_depth);
+    WAVL_TEST_ASSERT(1 == report.depth_hist[0]);
+    WAVL_TEST_ASSERT(2 == report.depth_hist[1]);
+    WAVL_TEST_ASSERT(4 == report.depth_hist[2]);
+    WAVL_TEST_ASSERT(2 == report.root_rank);
+    WAVL_TEST_ASSERT(4 == report.rank_hist[0]);
+    WAVL_TEST_ASSERT(2 == report.rank_hist[1]);
+    WAVL_TEST_ASSERT(1 == report.rank_hist[2]);
+    WAVL_TEST_ASSERT(10.0 / 7.0 == report.mean_depth);
+    WAVL_TEST_ASSERT(6 == report.height_bound);
+    WAVL_TEST_ASSERT(0 == report.rank_violations);
+    WAVL_TEST_ASSERT(0 == report.link_violations);
+
+    /* Corrupt the rank of a leaf, and check that it is caught */
+    nodes[0].node.rp = !nodes[0].node.rp;
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_inspect(&tree, &report));
+    WAVL_TEST_ASSERT(0 != report.rank_violations);
+    nodes[0].node.rp = !nodes[0].node.rp;
+
+    return true;
 }
 
 static
-bool wavl_test_pseudorandom_1(void)
+bool wavl_test_relayout(void)
 {
-    uint32_t lfsr = LFSR_POLY_6B_1;
     struct wavl_tree tree;
+    struct wavl_tree_report before, after;
+    static struct test_node arena[64];
+    const size_t nr_nodes = 48;
+    struct wavl_tree_node *found = NULL;
+
+    printf("WAVL: Testing van Emde Boas relayout.\n");
 
     wavl_test_clear();
 
-    WAVL_TEST_ASSERT(WAVL_ERR_OK ==
-            wavl_tree_init(
-                &tree,
-                _test_node_to_node_compare_func,
-                _test_node_to_value_compare_func));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
 
-    printf("Inserting: ");
-    for (size_t i = 0; i < 63; i++) {
-        printf(" %02x ", (unsigned int)lfsr);
-        fflush(stdout);
-        nodes[i].id = lfsr;
-        WAVL_TEST_ASSERT(WAVL_ERR_OK ==
-                wavl_tree_insert(&tree,
-                    (void *)nodes[i].id,
-                    &nodes[i].node));
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[i].id = (ptrdiff_t)((i * 37) % nr_nodes) + 1;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)nodes[i].id, &nodes[i].node));
+    }
 
-        lfsr = lfsr_next(lfsr, LFSR_POLY_6B_1);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_inspect(&tree, &before));
+
+    /* An arena that is too small leaves the tree untouched */
+    WAVL_TEST_ASSERT(WAVL_ERR_NO_SPACE == wavl_tree_relayout(&tree, arena, sizeof(struct test_node) * (nr_nodes - 1),
+                sizeof(struct test_node), offsetof(struct test_node, node)));
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes));
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_relayout(&tree, arena, sizeof(arena),
+                sizeof(struct test_node), offsetof(struct test_node, node)));
+
+    /* The root goes first, and the shape and ranks are unchanged */
+    WAVL_TEST_ASSERT(tree.root == &arena[0].node);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_inspect(&tree, &after));
+    WAVL_TEST_ASSERT(0 == after.rank_violations);
+    WAVL_TEST_ASSERT(0 == after.link_violations);
+    WAVL_TEST_ASSERT(0 == memcmp(before.depth_hist, after.depth_hist, sizeof(before.depth_hist)));
+    WAVL_TEST_ASSERT(0 == memcmp(before.rank_hist, after.rank_hist, sizeof(before.rank_hist)));
+
+    /* Every key is found, in the arena */
+    for (size_t i = 0; i < nr_nodes; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)(i + 1), &found));
+        WAVL_TEST_ASSERT(TEST_NODE(found) >= &arena[0] && TEST_NODE(found) < &arena[nr_nodes]);
+        WAVL_TEST_ASSERT(TEST_NODE(found)->id == (ptrdiff_t)(i + 1));
     }
 
-    printf("\n");
+    /* The relocated tree can still be modified */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)7, &found));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(&tree, found));
+    nodes[0].id = 1000;
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)nodes[0].id, &nodes[0].node));
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes));
 
-    printf("Removing: ");
-    for (size_t i = 0; i < 63; i++) {
-        struct wavl_tree_node *nd = NULL;
-        struct test_node *tn = NULL;
-        printf(" %02x (%u) ", (unsigned int)lfsr, (unsigned int)lfsr);
-        fflush(stdout);
+    return true;
+}
+
+static
+bool wavl_test_find_batch(void)
+{
+    struct wavl_tree tree;
+    const size_t nr_nodes = 100;
+    void *keys[150];
+    struct wavl_tree_node *results[150];
+
+    printf("WAVL: Testing batched search.\n");
+
+    wavl_test_clear();
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+
+    /* Nothing can be found in an empty tree */
+    keys[0] = (void *)(ptrdiff_t)2;
+    results[0] = &nodes[0].node;
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find_batch(&tree, keys, 1, results));
+    WAVL_TEST_ASSERT(NULL == results[0]);
+
+    /* Insert the even keys */
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[i].id = (ptrdiff_t)(2 * i + 2);
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)nodes[i].id, &nodes[i].node));
+    }
+
+    /* Search for a mix of present and absent keys, more than fit in one batch */
+    for (size_t i = 0; i < 150; i++) {
+        keys[i] = (void *)(ptrdiff_t)((i * 7) % 211 + 1);
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find_batch(&tree, keys, 150, results));
 
-        if (0x15 == lfsr) {
-            printf("\n");
-            wavl_test_dump_tree(nodes, 63);
-            printf("\n");
+    for (size_t i = 0; i < 150; i++) {
+        struct wavl_tree_node *found = NULL;
+        wavl_tree_find(&tree, keys[i], &found);
+        WAVL_TEST_ASSERT(found == results[i]);
+        if (NULL != found) {
+            WAVL_TEST_ASSERT(TEST_NODE(found)->id == (ptrdiff_t)keys[i]);
         }
+    }
 
-        WAVL_TEST_ASSERT(WAVL_ERR_OK ==
-                wavl_tree_find(&tree,
-                    (void *)(ptrdiff_t)lfsr,
-                    &nd));
-        WAVL_TEST_ASSERT(NULL != nd);
-        tn = TEST_NODE(nd);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find_batch(&tree, keys, 0, results));
 
-        WAVL_TEST_ASSERT(tn->id == lfsr);
+    return true;
+}
 
-        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(
-                    &tree,
-                    nd));
+static
+uint64_t _test_node_to_u64_func(struct wavl_tree_node *node)
+{
+    return (uint64_t)TEST_NODE(node)->id;
+}
 
-        lfsr = lfsr_next(lfsr, LFSR_POLY_6B_2);
+static
+bool wavl_test_freeze(void)
+{
+    struct wavl_tree tree;
+    struct wavl_frozen frozen;
+    uint64_t frozen_keys[100];
+    struct wavl_tree_node *frozen_nodes[100];
+    struct wavl_tree_node *found = NULL;
+    const size_t nr_nodes = 100;
+
+    printf("WAVL: Testing frozen tree images.\n");
+
+    wavl_test_clear();
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_frozen_init(&frozen, frozen_keys, frozen_nodes, nr_nodes));
+
+    /* An empty image finds nothing */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_freeze(&tree, _test_node_to_u64_func, &frozen));
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_frozen_find(&frozen, 1, &found));
+    WAVL_TEST_ASSERT(NULL == found);
+
+    /* Insert the keys 10, 20, ... 1000 */
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[i].id = (ptrdiff_t)(((i * 37) % nr_nodes) + 1) * 10;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)nodes[i].id, &nodes[i].node));
     }
 
-    printf("\n");
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_freeze(&tree, _test_node_to_u64_func, &frozen));
 
-    wavl_test_dump_tree(nodes, 63);
+    for (uint64_t key = 0; key <= 1010; key++) {
+        wavl_result_t ret = wavl_frozen_find(&frozen, key, &found);
 
-    WAVL_TEST_ASSERT(tree.root == NULL);
+        if (0 != key && 0 == key % 10 && key <= 1000) {
+            WAVL_TEST_ASSERT(WAVL_ERR_OK == ret);
+            WAVL_TEST_ASSERT((uint64_t)TEST_NODE(found)->id == key);
+        } else {
+            WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == ret);
+        }
+
+        ret = wavl_frozen_lower_bound(&frozen, key, &found);
+        if (key <= 1000) {
+            WAVL_TEST_ASSERT(WAVL_ERR_OK == ret);
+            WAVL_TEST_ASSERT((uint64_t)TEST_NODE(found)->id == (0 == key ? 10 : (key + 9) / 10 * 10));
+        } else {
+            WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == ret);
+            WAVL_TEST_ASSERT(NULL == found);
+        }
+    }
+
+    /* Too many nodes for the image */
+    nodes[nr_nodes].id = 5;
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)nodes[nr_nodes].id, &nodes[nr_nodes].node));
+    WAVL_TEST_ASSERT(WAVL_ERR_NO_SPACE == wavl_tree_freeze(&tree, _test_node_to_u64_func, &frozen));
 
     return true;
 }
 
-int main(int argc __attribute__((unused)), const char *argv[])
+static
+bool wavl_test_find_from(void)
 {
-    int ret = EXIT_FAILURE;
+    struct wavl_tree tree;
+    struct wavl_tree_node *found = NULL,
+                          *expected = NULL;
+    struct wavl_tree_stats stats;
+    uint64_t root_compares = 0,
+             finger_compares = 0;
+    const size_t nr_nodes = 200;
 
-    fprintf(stdout, "%s: tester\n", argv[0]);
+    printf("WAVL: Testing finger search.\n");
 
-    wavl_test_init();
-    wavl_test_simple_insert();
-    wavl_test_sign_invert_insert();
-    wavl_test_delete_leaf_leaf_sibling();
-    wavl_test_delete_leaf_unary_sibling();
-    wavl_test_delete_inner_1();
-    wavl_test_delete_every_third();
-    wavl_test_delete_every_third_then_reinsert();
+    wavl_test_clear();
 
-    wavl_test_find();
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+
+    /* Clustered inserts: each key is next to the previous one, using it as the finger. Keys
+     * are 2, 4, ... 400, so there are gaps to search for.
+     */
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[i].id = (ptrdiff_t)(i + 1) * 2;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert_from(&tree, 0 == i ? NULL : &nodes[i - 1].node,
+                    (void *)nodes[i].id, &nodes[i].node));
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_DUPE == wavl_tree_insert_from(&tree, &nodes[0].node, (void *)nodes[150].id, &nodes[nr_nodes].node));
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes));
+
+    /* Every finger must agree with a search from the root, for keys near and far */
+    for (size_t i = 0; i < nr_nodes; i++) {
+        for (ptrdiff_t key = 1; key <= (ptrdiff_t)nr_nodes * 2 + 1; key++) {
+            wavl_result_t ret = wavl_tree_find(&tree, (void *)key, &expected);
+
+            WAVL_TEST_ASSERT(ret == wavl_tree_find_from(&tree, &nodes[i].node, (void *)key, &found));
+            WAVL_TEST_ASSERT(expected == found);
+        }
+    }
+
+    /* Searching for a neighbour of the finger is cheaper than searching from the root */
+    for (size_t i = 0; i + 1 < nr_nodes; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &stats));
+        root_compares -= stats.compares;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)nodes[i + 1].id, &found));
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &stats));
+        root_compares += stats.compares;
+
+        finger_compares -= stats.compares;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find_from(&tree, &nodes[i].node, (void *)nodes[i + 1].id, &found));
+        WAVL_TEST_ASSERT(&nodes[i + 1].node == found);
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &stats));
+        finger_compares += stats.compares;
+    }
+
+    WAVL_TEST_ASSERT(finger_compares < root_compares);
+
+    /* Fill in some of the gaps, using a finger that is close, but not adjacent */
+    for (size_t i = 0; i < 50; i++) {
+        struct wavl_tree_node *finger = &nodes[(i * 4 + 5) % nr_nodes].node;
+
+        nodes[nr_nodes + i].id = (ptrdiff_t)(i * 8) + 1;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert_from(&tree, finger, (void *)nodes[nr_nodes + i].id, &nodes[nr_nodes + i].node));
+    }
+
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes + 50));
+
+    for (size_t i = 0; i < nr_nodes + 50; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find_from(&tree, &nodes[nr_nodes - 1].node, (void *)nodes[i].id, &found));
+        WAVL_TEST_ASSERT(&nodes[i].node == found);
+    }
+
+    return true;
+}
+
+static
+bool wavl_test_remove_and_next(void)
+{
+    struct wavl_tree tree;
+    struct wavl_tree_node *cur = NULL;
+    const size_t nr_nodes = 200;
+    size_t nr_left = nr_nodes;
+    ptrdiff_t expected = 1;
+
+    printf("WAVL: Testing removal while walking in order.\n");
+
+    wavl_test_clear();
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[i].id = (ptrdiff_t)((i * 37) % nr_nodes) + 1;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)nodes[i].id, &nodes[i].node));
+    }
+
+    /* Sweep the tree, keeping only the multiples of 3 */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)1, &cur));
+
+    while (NULL != cur) {
+        WAVL_TEST_ASSERT(TEST_NODE(cur)->id == expected);
+
+        if (0 == expected % 3) {
+            WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_next(&tree, cur, &cur));
+        } else {
+            WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove_and_next(&tree, cur, &cur));
+            nr_left--;
+            WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_left));
+        }
+
+        expected++;
+    }
+
+    WAVL_TEST_ASSERT(expected == (ptrdiff_t)nr_nodes + 1);
+    WAVL_TEST_ASSERT(nr_left == nr_nodes / 3);
+
+    /* Then sweep away everything that is left */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)3, &cur));
+
+    for (expected = 3; NULL != cur; expected += 3) {
+        WAVL_TEST_ASSERT(TEST_NODE(cur)->id == expected);
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove_and_next(&tree, cur, &cur));
+    }
+
+    WAVL_TEST_ASSERT(NULL == tree.root);
+
+    return true;
+}
+
+static
+bool wavl_test_min_max(void)
+{
+    struct wavl_tree tree;
+    struct wavl_tree_node *found = NULL;
+    const size_t nr_nodes = 200;
+
+    printf("WAVL: Testing the cached minimum and maximum.\n");
+
+    wavl_test_clear();
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_tree_min(&tree, &found));
+    WAVL_TEST_ASSERT(NULL == found);
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_tree_max(&tree, &found));
+    WAVL_TEST_ASSERT(NULL == found);
+
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[i].id = (ptrdiff_t)((i * 37) % nr_nodes) + 1;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)nodes[i].id, &nodes[i].node));
+        WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, i + 1));
+    }
+
+    /* Drain the tree from both ends, and from the middle */
+    for (size_t i = 0; i < nr_nodes / 4; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_min(&tree, &found));
+        WAVL_TEST_ASSERT(TEST_NODE(found)->id == (ptrdiff_t)i + 1);
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(&tree, found));
+
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_max(&tree, &found));
+        WAVL_TEST_ASSERT(TEST_NODE(found)->id == (ptrdiff_t)(nr_nodes - i));
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(&tree, found));
+
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)(nr_nodes / 2 - i), &found));
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(&tree, found));
+
+        WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes - (i + 1) * 3));
+    }
+
+    return true;
+}
+
+static
+bool wavl_test_pq(void)
+{
+    struct wavl_pq pq;
+    struct wavl_tree_node *found = NULL;
+    const size_t nr_nodes = 200;
+    ptrdiff_t last = 0;
+
+    printf("WAVL: Testing priority queues.\n");
+
+    wavl_test_clear();
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_pq_init(&pq, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_pq_pop_min(&pq, &found));
+    WAVL_TEST_ASSERT(NULL == found);
+
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[i].id = (ptrdiff_t)((i * 37) % nr_nodes) + 1;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_pq_push(&pq, (void *)nodes[i].id, &nodes[i].node));
+    }
+
+    /* Cancel a few */
+    for (size_t i = 0; i < nr_nodes; i += 10) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_pq_remove(&pq, &nodes[i].node));
+    }
+
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&pq.tree, nr_nodes - nr_nodes / 10));
+
+    /* Pop, pushing each back with a later deadline, then drain */
+    for (size_t i = 0; i < nr_nodes; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_pq_peek_min(&pq, &found));
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_pq_pop_min(&pq, &found));
+        WAVL_TEST_ASSERT(TEST_NODE(found)->id > last);
+        last = TEST_NODE(found)->id;
+
+        TEST_NODE(found)->id += nr_nodes;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_pq_push(&pq, (void *)TEST_NODE(found)->id, found));
+        WAVL_TEST_ASSERT(true == wavl_test_check_tree(&pq.tree, nr_nodes - nr_nodes / 10));
+    }
+
+    for (size_t i = 0; i < nr_nodes - nr_nodes / 10; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_pq_pop_min(&pq, &found));
+        WAVL_TEST_ASSERT(TEST_NODE(found)->id > last);
+        last = TEST_NODE(found)->id;
+        WAVL_TEST_ASSERT(true == wavl_test_check_tree(&pq.tree, nr_nodes - nr_nodes / 10 - i - 1));
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_pq_peek_min(&pq, &found));
+    WAVL_TEST_ASSERT(NULL == pq.tree.root);
+
+    return true;
+}
+
+static
+bool wavl_test_multi(void)
+{
+    struct wavl_tree tree;
+    struct wavl_tree_node *first = NULL,
+                          *last = NULL;
+    const size_t nr_nodes = 200,
+                 nr_keys = 20;
+    size_t count = 0;
+
+    printf("WAVL: Testing duplicate keys.\n");
+
+    wavl_test_clear();
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init_flags(&tree, _test_node_to_node_compare_func,
+                _test_node_to_value_compare_func, WAVL_TREE_FLAG_MULTI));
+
+    /* Each key is inserted nr_nodes / nr_keys times, interleaved with the other keys */
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[i].id = (ptrdiff_t)((i * 7) % nr_keys) + 1;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)nodes[i].id, &nodes[i].node));
+    }
+
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes));
+
+    /* Equal items come out in insertion order */
+    for (ptrdiff_t key = 1; key <= (ptrdiff_t)nr_keys; key++) {
+        struct wavl_tree_node *cur = NULL,
+                              *prev = NULL;
+
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_count(&tree, (void *)key, &count));
+        WAVL_TEST_ASSERT(nr_nodes / nr_keys == count);
+
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_equal_range(&tree, (void *)key, &first, &last));
+
+        for (cur = first, count = 0; NULL != cur; prev = cur, wavl_tree_next(&tree, cur, &cur)) {
+            WAVL_TEST_ASSERT(TEST_NODE(cur)->id == key);
+            WAVL_TEST_ASSERT(NULL == prev || TEST_NODE(prev) < TEST_NODE(cur));
+            count++;
+
+            if (cur == last) {
+                break;
+            }
+        }
+
+        WAVL_TEST_ASSERT(nr_nodes / nr_keys == count);
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_tree_equal_range(&tree, (void *)(nr_keys + 1), &first, &last));
+    WAVL_TEST_ASSERT(NULL == first && NULL == last);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_count(&tree, (void *)(nr_keys + 1), &count));
+    WAVL_TEST_ASSERT(0 == count);
+
+    /* Remove the first half of the items with each key */
+    for (size_t i = 0; i < nr_nodes / 2; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(&tree, &nodes[i].node));
+    }
+
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes / 2));
+
+    for (ptrdiff_t key = 1; key <= (ptrdiff_t)nr_keys; key++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_count(&tree, (void *)key, &count));
+        WAVL_TEST_ASSERT(nr_nodes / nr_keys / 2 == count);
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_equal_range(&tree, (void *)key, &first, &last));
+        WAVL_TEST_ASSERT(TEST_NODE(first) >= &nodes[nr_nodes / 2]);
+    }
+
+    /* Without the flag, duplicates are still refused */
+    wavl_test_clear();
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+
+    nodes[0].id = nodes[1].id = 1;
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)nodes[0].id, &nodes[0].node));
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_DUPE == wavl_tree_insert(&tree, (void *)nodes[1].id, &nodes[1].node));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_equal_range(&tree, (void *)1, &first, &last));
+    WAVL_TEST_ASSERT(&nodes[0].node == first && first == last);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_count(&tree, (void *)1, &count));
+    WAVL_TEST_ASSERT(1 == count);
+
+    return true;
+}
+
+static
+bool wavl_test_replace(void)
+{
+    struct wavl_tree tree;
+    struct wavl_tree_node *found = NULL;
+    struct wavl_tree_stats before,
+                           after;
+    const size_t nr_nodes = 100;
+
+    printf("WAVL: Testing replacing nodes in place.\n");
+
+    wavl_test_clear();
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[i].id = (ptrdiff_t)((i * 37) % nr_nodes) + 1;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)nodes[i].id, &nodes[i].node));
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &before));
+
+    /* Replace every node with a copy in the other half of the array, including the ends */
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[nr_nodes + i].id = nodes[i].id;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_replace(&tree, &nodes[i].node, &nodes[nr_nodes + i].node));
+        WAVL_TEST_ASSERT(NULL == nodes[i].node.parent && NULL == nodes[i].node.left && NULL == nodes[i].node.right);
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &after));
+    WAVL_TEST_ASSERT(before.compares == after.compares);
+    WAVL_TEST_ASSERT(before.promotions == after.promotions && before.demotions == after.demotions);
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes));
+
+    for (size_t i = 0; i < nr_nodes; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)nodes[i].id, &found));
+        WAVL_TEST_ASSERT(&nodes[nr_nodes + i].node == found);
+    }
+
+    return true;
+}
+
+/**
+ * Check that an in-order walk of the tree visits the keys in (non-strictly) ascending order
+ */
+static
+bool wavl_test_check_order(struct wavl_tree *tree)
+{
+    struct wavl_tree_node *cur = NULL,
+                          *next = NULL;
+
+    if (WAVL_ERR_TREE_NOT_FOUND == wavl_tree_min(tree, &cur)) {
+        return true;
+    }
+
+    for (; NULL != cur; cur = next) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_next(tree, cur, &next));
+        WAVL_TEST_ASSERT(NULL == next || TEST_NODE(cur)->id <= TEST_NODE(next)->id);
+    }
+
+    return true;
+}
+
+static
+bool wavl_test_update_key(void)
+{
+    struct wavl_tree tree;
+    struct wavl_tree_node *found = NULL,
+                          *root = NULL;
+    struct wavl_tree_stats before,
+                           after;
+    const size_t nr_nodes = 100;
+    ptrdiff_t old_id = 0;
+
+    printf("WAVL: Testing key updates.\n");
+
+    wavl_test_clear();
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+
+    /* Keys 10, 20, ... 1000 */
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[i].id = (ptrdiff_t)(((i * 37) % nr_nodes) + 1) * 10;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)nodes[i].id, &nodes[i].node));
+    }
+
+    /* Small moves keep the order: at most two comparisons, and no change to the tree */
+    root = tree.root;
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &before));
+
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[i].id += 3;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_update_key(&tree, &nodes[i].node, (void *)nodes[i].id));
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &after));
+    WAVL_TEST_ASSERT(after.compares - before.compares <= 2 * nr_nodes);
+    WAVL_TEST_ASSERT(after.removes == before.removes && after.inserts == before.inserts);
+    WAVL_TEST_ASSERT(root == tree.root);
+
+    /* Larger moves, both ways, past neighbours. The new keys are all distinct. */
+    for (size_t i = 0; i < nr_nodes; i++) {
+        if (0 == (i & 1)) {
+            nodes[i].id += 25;
+        } else {
+            nodes[i].id = (ptrdiff_t)(nr_nodes - i) * 10 + 9;
+        }
+
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_update_key(&tree, &nodes[i].node, (void *)nodes[i].id));
+        WAVL_TEST_ASSERT(true == wavl_test_check_order(&tree));
+    }
+
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes));
+
+    for (size_t i = 0; i < nr_nodes; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)nodes[i].id, &found));
+        WAVL_TEST_ASSERT(&nodes[i].node == found);
+    }
+
+    /* Moving onto another key fails, and leaves the item where it was */
+    root = found = NULL;
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_next(&tree, &nodes[0].node, &found));
+    old_id = nodes[0].id;
+    nodes[0].id = nodes[1].id;
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_DUPE == wavl_tree_update_key(&tree, &nodes[0].node, (void *)nodes[0].id));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_next(&tree, &nodes[0].node, &root));
+    WAVL_TEST_ASSERT(found == root);
+    nodes[0].id = old_id;
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes));
+    WAVL_TEST_ASSERT(true == wavl_test_check_order(&tree));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)nodes[0].id, &found));
+    WAVL_TEST_ASSERT(&nodes[0].node == found);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)nodes[1].id, &found));
+    WAVL_TEST_ASSERT(&nodes[1].node == found);
+
+    /* Unless duplicates are permitted: then the item goes after the existing equal items */
+    wavl_test_clear();
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init_flags(&tree, _test_node_to_node_compare_func,
+                _test_node_to_value_compare_func, WAVL_TREE_FLAG_MULTI));
+
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[i].id = (ptrdiff_t)(i / 4);
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert_from(&tree, 0 == i ? NULL : &nodes[i / 2].node,
+                    (void *)nodes[i].id, &nodes[i].node));
+    }
+
+    nodes[0].id = 10;
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_update_key(&tree, &nodes[0].node, (void *)nodes[0].id));
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes));
+    WAVL_TEST_ASSERT(true == wavl_test_check_order(&tree));
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_equal_range(&tree, (void *)10, &found, &root));
+    WAVL_TEST_ASSERT(&nodes[0].node == root);
+    WAVL_TEST_ASSERT(&nodes[40].node == found);
+
+    return true;
+}
+
+static
+bool wavl_test_inline_key(void)
+{
+    struct wavl_tree tree;
+    struct wavl_tree_stats stats;
+    struct wavl_tree_node *found = NULL,
+                          *root = NULL;
+    const size_t nr_nodes = 64;
+
+    printf("WAVL: Testing inline integer keys.\n");
+
+    wavl_test_clear();
+
+    /* The prefix is the entire key: the comparison function is never called */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[i].id = (ptrdiff_t)((i * 37) % nr_nodes);
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert_u64(&tree, (uint64_t)nodes[i].id, NULL, &nodes[i].node));
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_DUPE == wavl_tree_insert_u64(&tree, 12, NULL, &nodes[nr_nodes].node));
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes));
+
+    for (size_t i = 0; i < nr_nodes; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find_u64(&tree, i, NULL, &found));
+        WAVL_TEST_ASSERT(TEST_NODE(found)->id == (ptrdiff_t)i);
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_tree_find_u64(&tree, nr_nodes, NULL, &found));
+    WAVL_TEST_ASSERT(NULL == found);
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &stats));
+    WAVL_TEST_ASSERT(0 == stats.compares);
+
+    /* Only the upper bits of the key are inline: ties go to the comparison function */
+    wavl_test_clear();
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[i].id = (ptrdiff_t)((i * 37) % nr_nodes) + 1;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert_u64(&tree, (uint64_t)nodes[i].id >> 3,
+                    (void *)nodes[i].id, &nodes[i].node));
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_DUPE == wavl_tree_insert_u64(&tree, 12 >> 3, (void *)12, &nodes[nr_nodes].node));
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes));
+
+    for (size_t i = 1; i <= nr_nodes; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find_u64(&tree, i >> 3, (void *)i, &found));
+        WAVL_TEST_ASSERT(TEST_NODE(found)->id == (ptrdiff_t)i);
+    }
+
+    /* Key updates store the new prefix, whether or not the node moves */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find_u64(&tree, 40 >> 3, (void *)40, &found));
+    TEST_NODE(found)->id = 1000;
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_update_key_u64(&tree, found, 1000 >> 3, (void *)1000));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find_u64(&tree, 1000 >> 3, (void *)1000, &found));
+    WAVL_TEST_ASSERT(1000 == TEST_NODE(found)->id);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_max(&tree, &root));
+    WAVL_TEST_ASSERT(found == root);
+
+    TEST_NODE(found)->id = 1001;
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_update_key_u64(&tree, found, 1001 >> 3, (void *)1001));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find_u64(&tree, 1001 >> 3, (void *)1001, &found));
+
+    /* A duplicate leaves the node and its prefix as they were */
+    TEST_NODE(found)->id = 12;
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_DUPE == wavl_tree_update_key_u64(&tree, found, 12 >> 3, (void *)12));
+    TEST_NODE(found)->id = 1001;
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes));
+    WAVL_TEST_ASSERT(true == wavl_test_check_order(&tree));
+
+    for (size_t i = 1; i <= nr_nodes; i++) {
+        ptrdiff_t id = 40 == i ? 1001 : (ptrdiff_t)i;
+
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find_u64(&tree, (uint64_t)id >> 3, (void *)id, &found));
+        WAVL_TEST_ASSERT(TEST_NODE(found)->id == id);
+    }
+
+    /* Removal does not care how the node was inserted */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(&tree, found));
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_tree_find_u64(&tree, nr_nodes >> 3,
+                (void *)nr_nodes, &found));
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &stats));
+    WAVL_TEST_ASSERT(0 != stats.compares);
+
+    return true;
+}
+
+/**
+ * Byte-string keys for the test nodes, indexed by node ID
+ */
+static
+char test_keys[256][80];
+
+static
+struct wavl_bytes _test_node_to_bytes_func(struct wavl_tree_node *node)
+{
+    const char *key = test_keys[TEST_NODE(node)->id];
+
+    return (struct wavl_bytes){ .ptr = key, .len = strlen(key) };
+}
+
+static
+bool wavl_test_bytes(void)
+{
+    struct wavl_tree tree;
+    struct wavl_tree_node *found = NULL;
+    struct wavl_bytes key;
+    const size_t nr_nodes = 200;
+    char missing[96];
+
+    printf("WAVL: Testing byte-string keys.\n");
+
+    wavl_test_clear();
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init_bytes(&tree, _test_node_to_bytes_func));
+
+    /* Long shared prefixes, and keys that are prefixes of other keys */
+    for (size_t i = 0; i < nr_nodes; i++) {
+        snprintf(test_keys[i], sizeof(test_keys[i]),
+                "https://www.example.com/some/rather/long/shared/path/%zu", (i * 37) % nr_nodes);
+    }
+
+    test_keys[0][0] = '\0';
+
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[i].id = (ptrdiff_t)i;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert_bytes(&tree, test_keys[i], strlen(test_keys[i]), &nodes[i].node));
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_DUPE == wavl_tree_insert_bytes(&tree, test_keys[12], strlen(test_keys[12]), &nodes[nr_nodes].node));
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes));
+
+    for (size_t i = 0; i < nr_nodes; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find_bytes(&tree, test_keys[i], strlen(test_keys[i]), &found));
+        WAVL_TEST_ASSERT(TEST_NODE(found)->id == (ptrdiff_t)i);
+
+        /* The plain interface compares the whole key every time, and must agree */
+        key = (struct wavl_bytes){ .ptr = test_keys[i], .len = strlen(test_keys[i]) };
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, &key, &found));
+        WAVL_TEST_ASSERT(TEST_NODE(found)->id == (ptrdiff_t)i);
+
+        /* A key with a node's key as a prefix does not match */
+        snprintf(missing, sizeof(missing), "%s/", test_keys[i]);
+        WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_tree_find_bytes(&tree, missing, strlen(missing), &found));
+        WAVL_TEST_ASSERT(NULL == found);
+    }
+
+    /* Nor does a prefix of the keys */
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_tree_find_bytes(&tree, test_keys[1], 40, &found));
+
+    /* Removal does not care how the node was inserted */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(&tree, &nodes[0].node));
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_tree_find_bytes(&tree, NULL, 0, &found));
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes - 1));
+
+    /* Only trees initialized for byte-string keys support the byte-string interface */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+    WAVL_TEST_ASSERT(WAVL_ERR_BAD_ARG == wavl_tree_find_bytes(&tree, test_keys[1], strlen(test_keys[1]), &found));
+
+    return true;
+}
+
+/**
+ * Node for testing the compact WAVL tree
+ */
+struct test_cnode {
+    ptrdiff_t id;
+    struct wavl_ctree_node node;
+};
+
+#define TEST_CNODE(_x) WAVL_CONTAINER_OF((_x), struct test_cnode, node)
+
+static
+wavl_result_t _test_key_to_cnode_compare_func(struct wavl_ctree *tree, void *key, struct wavl_ctree_node *rhs, int *pdir)
+{
+    ptrdiff_t lhs_id = (ptrdiff_t)key;
+
+    (void)tree;
+
+    *pdir = lhs_id < TEST_CNODE(rhs)->id ? -1 : (lhs_id > TEST_CNODE(rhs)->id ? 1 : 0);
+
+    return WAVL_ERR_OK;
+}
+
+/**
+ * Check a compact subtree: keys must be in order, every external position must have the same
+ * rank (reconstructed from the parities), and there must be no 2,2 leaves. Returns the number
+ * of nodes in the subtree, or -1 on failure.
+ */
+static
+ptrdiff_t wavl_test_check_csubtree(struct wavl_ctree *tree, struct wavl_ctree_node *node, ptrdiff_t rank,
+                                   ptrdiff_t *pnull_rank, ptrdiff_t lo, ptrdiff_t hi)
+{
+    struct wavl_ctree_node *left = NULL,
+                           *right = NULL;
+    ptrdiff_t nr_left = 0,
+              nr_right = 0;
+
+    if (NULL == node) {
+        if (INT32_MIN == *pnull_rank) {
+            *pnull_rank = rank;
+        }
+
+        return rank == *pnull_rank ? 0 : -1;
+    }
+
+    left = wavl_ctree_node_left(tree, node);
+    right = wavl_ctree_node_right(tree, node);
+
+    if (TEST_CNODE(node)->id <= lo || TEST_CNODE(node)->id >= hi ||
+            (NULL == left && NULL == right && true == wavl_ctree_node_parity(node)))
+    {
+        return -1;
+    }
+
+    nr_left = wavl_test_check_csubtree(tree, left, rank - (wavl_ctree_node_parity(left) == wavl_ctree_node_parity(node) ? 2 : 1),
+            pnull_rank, lo, TEST_CNODE(node)->id);
+    nr_right = wavl_test_check_csubtree(tree, right, rank - (wavl_ctree_node_parity(right) == wavl_ctree_node_parity(node) ? 2 : 1),
+            pnull_rank, TEST_CNODE(node)->id, hi);
+
+    if (0 > nr_left || 0 > nr_right) {
+        return -1;
+    }
+
+    return nr_left + nr_right + 1;
+}
+
+static
+bool wavl_test_compact(void)
+{
+    struct wavl_ctree tree;
+    struct wavl_ctree_node *found = NULL;
+    struct test_cnode cnodes[200];
+    const size_t nr_nodes = sizeof(cnodes)/sizeof(cnodes[0]);
+    ptrdiff_t null_rank = INT32_MIN;
+
+    printf("WAVL: Testing compact trees.\n");
+
+    WAVL_TEST_ASSERT(2 * sizeof(void *) == sizeof(struct wavl_ctree_node));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_ctree_init(&tree, _test_key_to_cnode_compare_func));
+
+    for (size_t i = 0; i < nr_nodes; i++) {
+        cnodes[i].id = (ptrdiff_t)((i * 37) % nr_nodes) + 1;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_ctree_insert(&tree, (void *)cnodes[i].id, &cnodes[i].node));
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_DUPE == wavl_ctree_insert(&tree, (void *)12, &cnodes[0].node));
+    WAVL_TEST_ASSERT((ptrdiff_t)nr_nodes == wavl_test_check_csubtree(&tree, wavl_ctree_root(&tree), 0, &null_rank, 0, PTRDIFF_MAX));
+
+    for (size_t i = 0; i < nr_nodes; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_ctree_find(&tree, (void *)(ptrdiff_t)(i + 1), &found));
+        WAVL_TEST_ASSERT(TEST_CNODE(found)->id == (ptrdiff_t)(i + 1));
+    }
+
+    /* Remove every other node, then the rest, checking the tree along the way */
+    for (size_t pass = 0; pass < 2; pass++) {
+        for (size_t i = pass; i < nr_nodes; i += 2) {
+            size_t remain = nr_nodes - (pass * nr_nodes / 2) - (i - pass) / 2 - 1;
+
+            WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_ctree_remove(&tree, (void *)cnodes[i].id, &found));
+            WAVL_TEST_ASSERT(&cnodes[i].node == found);
+            WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_ctree_find(&tree, (void *)cnodes[i].id, &found));
+            WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_ctree_remove(&tree, (void *)cnodes[i].id, &found));
+
+            null_rank = INT32_MIN;
+            WAVL_TEST_ASSERT((ptrdiff_t)remain == wavl_test_check_csubtree(&tree, wavl_ctree_root(&tree), 0, &null_rank, 0, PTRDIFF_MAX));
+        }
+    }
+
+    WAVL_TEST_ASSERT(NULL == wavl_ctree_root(&tree));
+
+    return true;
+}
+
+static
+void _test_put_be64(uint8_t *buf, uint64_t v)
+{
+    for (size_t i = 0; i < 8; i++) {
+        buf[i] = (uint8_t)(v >> (56 - 8 * i));
+    }
+}
+
+static
+wavl_result_t _test_node_serialize_func(struct wavl_tree_node *node, void *key, void *value)
+{
+    uint64_t id = (uint64_t)TEST_NODE(node)->id;
+
+    /* Big-endian keys sort with memcmp in the same order as the integers */
+    _test_put_be64(key, id);
+    memcpy(value, &id, sizeof(id));
+
+    return WAVL_ERR_OK;
+}
+
+static
+wavl_result_t _test_node_serialize_const_func(struct wavl_tree_node *node, void *key, void *value)
+{
+    (void)node;
+    (void)value;
+    memset(key, 0x5a, 8);
+    return WAVL_ERR_OK;
+}
+
+static
+bool wavl_test_image(void)
+{
+    struct wavl_tree tree;
+    struct wavl_image image;
+    const size_t nr_nodes = 150;
+    uint8_t key[8];
+    const void *kp = NULL,
+               *vp = NULL;
+    size_t pos = 0,
+           nr_seen = 0;
+    uint64_t v = 0,
+             expect = 0;
+    FILE *fp = NULL;
+
+    printf("WAVL: Testing on-disk tree images.\n");
+
+    wavl_test_clear();
+
+    WAVL_TEST_ASSERT(NULL != (fp = tmpfile()));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+
+    /* An empty tree makes an empty image */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_write_image(&tree, fileno(fp), 8, 8, _test_node_serialize_func));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_image_open(&image, fileno(fp)));
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_image_first(&image, &pos));
+    WAVL_TEST_ASSERT(WAVL_IMAGE_END == pos);
+    _test_put_be64(key, 1);
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_image_find(&image, key, &vp));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_image_close(&image));
+
+    /* Insert 1 .. nr_nodes, leaving out the multiples of 5 */
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[i].id = (ptrdiff_t)((i * 37) % nr_nodes) + 1;
+        if (0 != nodes[i].id % 5) {
+            WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)nodes[i].id, &nodes[i].node));
+        }
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_write_image(&tree, fileno(fp), 8, 8, _test_node_serialize_func));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_image_open(&image, fileno(fp)));
+
+    for (uint64_t id = 0; id <= nr_nodes + 1; id++) {
+        _test_put_be64(key, id);
+        if (0 == id % 5 || id > nr_nodes) {
+            WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_image_find(&image, key, &vp));
+            WAVL_TEST_ASSERT(NULL == vp);
+        } else {
+            WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_image_find(&image, key, &vp));
+            memcpy(&v, vp, sizeof(v));
+            WAVL_TEST_ASSERT(id == v);
+        }
+    }
+
+    /* Walk the whole image in order */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_image_first(&image, &pos));
+    for (expect = 1; WAVL_IMAGE_END != pos; expect++) {
+        if (0 == expect % 5) {
+            expect++;
+        }
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_image_record(&image, pos, &kp, &vp));
+        _test_put_be64(key, expect);
+        WAVL_TEST_ASSERT(0 == memcmp(kp, key, sizeof(key)));
+        nr_seen++;
+        wavl_image_next(&image, pos, &pos);
+    }
+    WAVL_TEST_ASSERT(nr_seen == nr_nodes - nr_nodes / 5);
+
+    /* A range query starting on a missing key */
+    _test_put_be64(key, 100);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_image_lower_bound(&image, key, &pos));
+    for (expect = 101; expect < 105; expect++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_image_record(&image, pos, NULL, &vp));
+        memcpy(&v, vp, sizeof(v));
+        WAVL_TEST_ASSERT(expect == v);
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_image_next(&image, pos, &pos));
+    }
+
+    _test_put_be64(key, nr_nodes);
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_image_lower_bound(&image, key, &pos));
+    WAVL_TEST_ASSERT(WAVL_IMAGE_END == pos);
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_image_close(&image));
+
+    /* Keys that do not follow the order of the tree are rejected */
+    WAVL_TEST_ASSERT(WAVL_ERR_BAD_ARG == wavl_tree_write_image(&tree, fileno(fp), 8, 0, _test_node_serialize_const_func));
+    WAVL_TEST_ASSERT(WAVL_ERR_IMAGE_FORMAT == wavl_image_open(&image, fileno(fp)));
+
+    fclose(fp);
+
+    return true;
+}
+
+static
+bool wavl_test_shm(void)
+{
+    struct wavl_shm shm_a,
+                    shm_b;
+    struct wavl_ctree_node *found = NULL;
+    struct test_cnode *cnode = NULL;
+    const size_t region_size = 64 * 1024,
+                 nr_nodes = 200;
+    void *map_a = MAP_FAILED,
+         *map_b = MAP_FAILED,
+         *block = NULL;
+    ptrdiff_t null_rank = INT32_MIN;
+    FILE *fp = NULL;
+
+    printf("WAVL: Testing compact trees in a shared region.\n");
+
+    /* Map the same file twice, so the region is seen at two different addresses */
+    WAVL_TEST_ASSERT(NULL != (fp = tmpfile()));
+    WAVL_TEST_ASSERT(0 == ftruncate(fileno(fp), region_size));
+    map_a = mmap(NULL, region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(fp), 0);
+    map_b = mmap(NULL, region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(fp), 0);
+    WAVL_TEST_ASSERT(MAP_FAILED != map_a && MAP_FAILED != map_b && map_a != map_b);
+
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_CORRUPT == wavl_shm_attach(&shm_b, map_b, region_size, _test_key_to_cnode_compare_func));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_shm_format(&shm_a, map_a, region_size, _test_key_to_cnode_compare_func));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_shm_attach(&shm_b, map_b, region_size, _test_key_to_cnode_compare_func));
+
+    /* Insert through one mapping */
+    for (size_t i = 0; i < nr_nodes; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_shm_alloc(&shm_a, sizeof(*cnode), &block));
+        cnode = block;
+        cnode->id = (ptrdiff_t)((i * 37) % nr_nodes) + 1;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_ctree_insert(wavl_shm_tree(&shm_a), (void *)cnode->id, &cnode->node));
+    }
+
+    /* Find everything through the other, and check the node is where the first put it */
+    for (size_t i = 0; i < nr_nodes; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_ctree_find(wavl_shm_tree(&shm_b), (void *)(ptrdiff_t)(i + 1), &found));
+        WAVL_TEST_ASSERT(TEST_CNODE(found)->id == (ptrdiff_t)(i + 1));
+        WAVL_TEST_ASSERT((uintptr_t)found - (uintptr_t)map_b < region_size);
+        cnode = wavl_shm_offset_to_ptr(&shm_a, wavl_shm_ptr_to_offset(&shm_b, TEST_CNODE(found)));
+        WAVL_TEST_ASSERT(cnode->id == (ptrdiff_t)(i + 1));
+    }
+
+    /* Remove the odd keys through the second mapping, recycling their blocks */
+    for (size_t i = 1; i <= nr_nodes; i += 2) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_ctree_remove(wavl_shm_tree(&shm_b), (void *)(ptrdiff_t)i, &found));
+        cnode = TEST_CNODE(found);
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_shm_free(&shm_b, cnode, sizeof(*cnode)));
+    }
+
+    WAVL_TEST_ASSERT((ptrdiff_t)nr_nodes / 2 == wavl_test_check_csubtree(wavl_shm_tree(&shm_a), wavl_ctree_root(wavl_shm_tree(&shm_a)),
+                0, &null_rank, 0, PTRDIFF_MAX));
+
+    for (size_t i = 1; i <= nr_nodes; i++) {
+        wavl_result_t expect = 0 == i % 2 ? WAVL_ERR_OK : WAVL_ERR_TREE_NOT_FOUND;
+        WAVL_TEST_ASSERT(expect == wavl_ctree_find(wavl_shm_tree(&shm_a), (void *)(ptrdiff_t)i, &found));
+    }
+
+    /* The last block freed is the first reused; then fill the region up */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_shm_alloc(&shm_a, sizeof(*cnode), &block));
+    WAVL_TEST_ASSERT(wavl_shm_ptr_to_offset(&shm_a, block) == wavl_shm_ptr_to_offset(&shm_b, cnode));
+
+    while (WAVL_ERR_OK == wavl_shm_alloc(&shm_a, 4096, &block)) {
+        WAVL_TEST_ASSERT((uintptr_t)block - (uintptr_t)map_a + 4096 <= region_size);
+    }
+    WAVL_TEST_ASSERT(NULL == block);
+
+    munmap(map_a, region_size);
+    munmap(map_b, region_size);
+    fclose(fp);
+
+    return true;
+}
+
+static
+bool wavl_test_slab(void)
+{
+    struct wavl_slab slab;
+    struct wavl_slab_cache cache_a,
+                           cache_b;
+    struct wavl_slab_stats stats;
+    struct wavl_tree tree;
+    struct test_node *objs[1000];
+    struct wavl_tree_node *found = NULL;
+    const size_t nr_objs = sizeof(objs)/sizeof(objs[0]);
+    void *obj = NULL;
+
+    printf("WAVL: Testing the slab allocator.\n");
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_slab_init(&slab, sizeof(struct test_node), WAVL_SLAB_FLAG_THP));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_slab_cache_init(&cache_a, &slab));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_slab_cache_init(&cache_b, &slab));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_slab_get_stats(&slab, &stats));
+    WAVL_TEST_ASSERT(stats.obj_size >= sizeof(struct test_node) && 0 == (stats.obj_size & 15));
+
+    for (size_t i = 0; i < nr_objs; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_slab_alloc(&cache_a, &obj));
+        WAVL_TEST_ASSERT(0 == ((uintptr_t)obj & 15));
+        objs[i] = obj;
+        objs[i]->id = (ptrdiff_t)((i * 37) % nr_objs) + 1;
+        WAVL_TREE_NODE_CLEAR(&objs[i]->node);
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)objs[i]->id, &objs[i]->node));
+    }
+
+    /* Objects are all distinct, so the tree holds every one */
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_objs));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_slab_get_stats(&slab, &stats));
+    WAVL_TEST_ASSERT(1 == stats.nr_chunks);
+    WAVL_TEST_ASSERT((nr_objs + WAVL_SLAB_BATCH - 1) / WAVL_SLAB_BATCH == stats.nr_refills);
+
+    /* Free half the objects through another thread's cache: it hands batches to the pool */
+    for (size_t i = 0; i < nr_objs; i += 2) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(&tree, &objs[i]->node));
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_slab_free(&cache_b, objs[i]));
+    }
+
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_objs / 2));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_slab_cache_flush(&cache_b));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_slab_get_stats(&slab, &stats));
+    WAVL_TEST_ASSERT(0 < stats.nr_drains);
+    WAVL_TEST_ASSERT(nr_objs / 2 <= stats.nr_pool_free + cache_a.nr_free);
+
+    /* Allocating them again reuses the freed objects, without a new chunk */
+    for (size_t i = 0; i < nr_objs; i += 2) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_slab_alloc(&cache_a, &obj));
+        objs[i] = obj;
+        objs[i]->id = (ptrdiff_t)((i * 37) % nr_objs) + 1;
+        WAVL_TREE_NODE_CLEAR(&objs[i]->node);
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)objs[i]->id, &objs[i]->node));
+    }
+
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_objs));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_slab_get_stats(&slab, &stats));
+    WAVL_TEST_ASSERT(1 == stats.nr_chunks);
+
+    for (size_t i = 0; i < nr_objs; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)(i + 1), &found));
+        WAVL_TEST_ASSERT(TEST_NODE(found)->id == (ptrdiff_t)(i + 1));
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_slab_destroy(&slab));
+
+    return true;
+}
+
+#ifdef WAVL_TRACE
+/**
+ * Fill the calling thread's trace ring several times over, and return the ring's index.
+ */
+static
+void *_test_trace_thread(void *arg)
+{
+    struct wavl_tree tree;
+    struct test_node *objs = arg;
+
+    wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func);
+
+    for (size_t i = 0; i < 4 * WAVL_TRACE_RING_SIZE; i++) {
+        objs[i].id = (ptrdiff_t)i + 1;
+        WAVL_TREE_NODE_CLEAR(&objs[i].node);
+        wavl_tree_insert(&tree, (void *)objs[i].id, &objs[i].node);
+    }
+
+    return (void *)(ptrdiff_t)wavl_trace_self();
+}
+
+static
+bool wavl_test_trace(void)
+{
+    struct wavl_tree tree;
+    struct wavl_tree_stats stats;
+    static struct wavl_trace_event events[WAVL_TRACE_RING_SIZE];
+    struct wavl_trace_dump_header hdr;
+    const size_t nr_nodes = 40;
+    size_t nr_events = 0;
+    uint64_t rotations = 0,
+             promotions = 0,
+             demotions = 0;
+    FILE *fp = NULL;
+    struct test_node *objs = NULL;
+    pthread_t thread;
+    void *ring = NULL;
+
+    printf("WAVL: Testing the rebalance trace.\n");
+
+    wavl_test_clear();
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+
+    for (size_t i = 0; i < nr_nodes; i++) {
+        nodes[i].id = (ptrdiff_t)i + 1;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)nodes[i].id, &nodes[i].node));
+    }
+
+    for (size_t i = 0; i < nr_nodes; i += 3) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(&tree, &nodes[i].node));
+    }
+
+    /* Every counted rank change and rotation on this tree must be in our ring */
+    WAVL_TEST_ASSERT(0 <= wavl_trace_self());
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_trace_read(wavl_trace_self(), events, WAVL_TRACE_RING_SIZE, &nr_events));
+    WAVL_TEST_ASSERT(0 < nr_events);
+
+    for (size_t i = 0; i < nr_events; i++) {
+        struct wavl_trace_event *ev = &events[i];
+
+        if (0 != i) {
+            WAVL_TEST_ASSERT(ev->seq == events[i - 1].seq + 1);
+            WAVL_TEST_ASSERT(ev->tsc >= events[i - 1].tsc);
+        }
+
+        if ((uint64_t)(uintptr_t)&tree != ev->tree) {
+            continue;
+        }
+
+        switch (ev->op) {
+        case WAVL_TRACE_OP_ROTATE_LEFT:
+        case WAVL_TRACE_OP_ROTATE_RIGHT:
+            rotations++;
+            break;
+        case WAVL_TRACE_OP_PROMOTE:
+            WAVL_TEST_ASSERT(ev->rp_before != ev->rp_after);
+            promotions++;
+            break;
+        case WAVL_TRACE_OP_DOUBLE_PROMOTE:
+            promotions += 2;
+            break;
+        case WAVL_TRACE_OP_DEMOTE:
+            WAVL_TEST_ASSERT(ev->rp_before != ev->rp_after);
+            demotions++;
+            break;
+        case WAVL_TRACE_OP_DOUBLE_DEMOTE:
+            demotions += 2;
+            break;
+        default:
+            break;
+        }
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &stats));
+    WAVL_TEST_ASSERT(stats.single_rotations == rotations);
+    WAVL_TEST_ASSERT(stats.promotions == promotions);
+    WAVL_TEST_ASSERT(stats.demotions == demotions);
+
+    /* Another thread's full ring is read without its oldest slot, which could be mid-write */
+    WAVL_TEST_ASSERT(NULL != (objs = calloc(4 * WAVL_TRACE_RING_SIZE, sizeof(*objs))));
+    WAVL_TEST_ASSERT(0 == pthread_create(&thread, NULL, _test_trace_thread, objs));
+    WAVL_TEST_ASSERT(0 == pthread_join(thread, &ring));
+    WAVL_TEST_ASSERT(0 <= (ptrdiff_t)ring);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_trace_read((int)(ptrdiff_t)ring, events, WAVL_TRACE_RING_SIZE, &nr_events));
+    WAVL_TEST_ASSERT(WAVL_TRACE_RING_SIZE - 1 == nr_events);
+
+    for (size_t i = 1; i < nr_events; i++) {
+        WAVL_TEST_ASSERT(events[i].seq == events[i - 1].seq + 1);
+    }
+
+    free(objs);
+
+    /* A dump starts with a header the decoder can check */
+    WAVL_TEST_ASSERT(NULL != (fp = tmpfile()));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_trace_dump(fileno(fp)));
+    rewind(fp);
+    WAVL_TEST_ASSERT(1 == fread(&hdr, sizeof(hdr), 1, fp));
+    WAVL_TEST_ASSERT(0 == memcmp(hdr.magic, WAVL_TRACE_MAGIC, sizeof(WAVL_TRACE_MAGIC)));
+    WAVL_TEST_ASSERT(WAVL_TRACE_RING_SIZE == hdr.ring_size);
+    WAVL_TEST_ASSERT((uint32_t)wavl_trace_self() < hdr.nr_rings);
+    fclose(fp);
+
+    return true;
+}
+#endif /* defined(WAVL_TRACE) */
+
+static
+bool wavl_test_build_parallel(void)
+{
+    struct wavl_tree tree;
+    struct wavl_tree_node *found = NULL;
+    struct test_node *objs = NULL;
+    struct wavl_tree_node **order = NULL;
+    size_t *pos = NULL;
+    const size_t nr_objs = 20000;
+    ptrdiff_t sum = 0;
+
+    printf("WAVL: Testing parallel bulk builds.\n");
+
+    WAVL_TEST_ASSERT(NULL != (objs = calloc(nr_objs, sizeof(*objs))));
+    WAVL_TEST_ASSERT(NULL != (order = calloc(nr_objs, sizeof(*order))));
+    WAVL_TEST_ASSERT(NULL != (pos = calloc(nr_objs, sizeof(*pos))));
+
+    /* Every size up to a few levels deep, on one thread */
+    for (size_t n = 1; n <= 70; n++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+
+        for (size_t i = 0; i < n; i++) {
+            objs[i].id = (ptrdiff_t)((i * 71) % n) + 1;
+            order[i] = &objs[i].node;
+        }
+
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_build_parallel(&tree, order, n, 3));
+        WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, n));
+        WAVL_TEST_ASSERT(true == wavl_test_check_order(&tree));
+    }
+
+    /* A large shuffled input, split across threads */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+
+    for (size_t i = 0; i < nr_objs; i++) {
+        objs[i].id = (ptrdiff_t)((i * 7919) % nr_objs) + 1;
+        order[i] = &objs[i].node;
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_build_parallel(&tree, order, nr_objs, 4));
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_objs));
+    WAVL_TEST_ASSERT(true == wavl_test_check_order(&tree));
+
+    for (size_t i = 0; i < nr_objs; i++) {
+        WAVL_TEST_ASSERT(TEST_NODE(order[i])->id == (ptrdiff_t)(i + 1));
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)(i + 1), &found));
+        WAVL_TEST_ASSERT(order[i] == found);
+    }
+
+    /* The tree is an ordinary tree afterwards */
+    for (size_t i = 0; i < nr_objs; i += 3) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(&tree, &objs[i].node));
+    }
+
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_objs - (nr_objs + 2) / 3));
+
+    /* A duplicate fails the build, and leaves the input intact */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+
+    for (size_t i = 0; i < nr_objs; i++) {
+        objs[i].id = (ptrdiff_t)((i * 7919) % nr_objs) + 1;
+        order[i] = &objs[i].node;
+    }
+    objs[nr_objs / 2].id = objs[nr_objs / 3].id;
+
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_DUPE == wavl_tree_build_parallel(&tree, order, nr_objs, 4));
+    WAVL_TEST_ASSERT(NULL == tree.root);
+
+    for (size_t i = 0; i < nr_objs; i++) {
+        sum += TEST_NODE(order[i]) - objs;
+    }
+    WAVL_TEST_ASSERT((ptrdiff_t)(nr_objs * (nr_objs - 1) / 2) == sum);
+
+    /* With duplicates permitted, equal keys keep the order they had in the input */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init_flags(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func, WAVL_TREE_FLAG_MULTI));
+
+    for (size_t i = 0; i < nr_objs; i++) {
+        size_t idx = (i * 7919) % nr_objs;
+
+        objs[idx].id = (ptrdiff_t)(idx / 5);
+        order[i] = &objs[idx].node;
+        pos[idx] = i;
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_build_parallel(&tree, order, nr_objs, 4));
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_objs));
+    WAVL_TEST_ASSERT(true == wavl_test_check_order(&tree));
+
+    for (size_t i = 1; i < nr_objs; i++) {
+        struct test_node *prev = TEST_NODE(order[i - 1]),
+                         *cur = TEST_NODE(order[i]);
+
+        WAVL_TEST_ASSERT(prev->id < cur->id || pos[prev - objs] < pos[cur - objs]);
+    }
+
+    free(pos);
+    free(order);
+    free(objs);
+
+    return true;
+}
+
+/**
+ * Visitor (for testing) that counts the visits to each node
+ */
+static
+wavl_result_t _test_count_visit_func(struct wavl_tree *tree __attribute__((unused)),
+                                     struct wavl_tree_node *node,
+                                     void *arg)
+{
+    uint32_t *visits = arg;
+
+    __atomic_fetch_add(&visits[TEST_NODE(node)->id], 1, __ATOMIC_RELAXED);
+
+    return TEST_NODE(node)->id < 0 ? WAVL_ERR_TREE_CORRUPT : WAVL_ERR_OK;
+}
+
+/**
+ * Accumulator (for testing) that sums the keys, and checks that they come in order
+ */
+struct test_acc {
+    ptrdiff_t first;
+    ptrdiff_t last;
+    ptrdiff_t sum;
+    size_t count;
+    bool ordered;
+};
+
+static
+wavl_result_t _test_fold_func(struct wavl_tree *tree __attribute__((unused)),
+                              struct wavl_tree_node *node,
+                              void *acc,
+                              void *arg __attribute__((unused)))
+{
+    struct test_acc *tacc = acc;
+    ptrdiff_t id = TEST_NODE(node)->id;
+
+    if (0 == tacc->count) {
+        tacc->first = id;
+    } else if (id <= tacc->last) {
+        tacc->ordered = false;
+    }
+
+    tacc->last = id;
+    tacc->sum += id;
+    tacc->count++;
+
+    return WAVL_ERR_OK;
+}
+
+static
+wavl_result_t _test_combine_func(void *acc,
+                                 const void *other,
+                                 void *arg __attribute__((unused)))
+{
+    struct test_acc *tacc = acc;
+    const struct test_acc *tother = other;
+
+    if (0 == tother->count) {
+        return WAVL_ERR_OK;
+    }
+
+    if (0 == tacc->count) {
+        *tacc = *tother;
+        return WAVL_ERR_OK;
+    }
+
+    tacc->ordered = tacc->ordered && tother->ordered && tacc->last < tother->first;
+    tacc->last = tother->last;
+    tacc->sum += tother->sum;
+    tacc->count += tother->count;
+
+    return WAVL_ERR_OK;
+}
+
+static
+bool wavl_test_parallel_walk(void)
+{
+    struct wavl_tree tree;
+    struct test_node *objs = NULL;
+    struct wavl_tree_node **order = NULL;
+    uint32_t *visits = NULL;
+    struct test_acc acc;
+    const size_t nr_objs = 20000;
+    size_t nr_left = 0;
+    ptrdiff_t sum = 0;
+
+    printf("WAVL: Testing parallel walks.\n");
+
+    WAVL_TEST_ASSERT(NULL != (objs = calloc(nr_objs, sizeof(*objs))));
+    WAVL_TEST_ASSERT(NULL != (order = calloc(nr_objs, sizeof(*order))));
+    WAVL_TEST_ASSERT(NULL != (visits = calloc(2 * nr_objs + 1, sizeof(*visits))));
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+
+    /* An empty tree has nothing to visit, and reduces to the identity */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_parallel_for_each(&tree, _test_count_visit_func, visits, 4));
+    acc = (struct test_acc){ .ordered = true };
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_parallel_reduce(&tree, _test_fold_func, _test_combine_func, &acc, sizeof(acc), NULL, 4));
+    WAVL_TEST_ASSERT(0 == acc.count);
+
+    /* Build a tree, then thin it out unevenly, so the subtrees differ in size */
+    for (size_t i = 0; i < nr_objs; i++) {
+        objs[i].id = (ptrdiff_t)((i * 7919) % nr_objs) + 1;
+        order[i] = &objs[i].node;
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_build_parallel(&tree, order, nr_objs, 4));
+
+    for (size_t i = 0; i < nr_objs; i++) {
+        ptrdiff_t id = TEST_NODE(order[i])->id;
+
+        if (id < (ptrdiff_t)nr_objs / 2 && 0 != id % 5) {
+            WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(&tree, order[i]));
+        } else {
+            sum += id;
+            nr_left++;
+        }
+    }
+
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_left));
+
+    for (size_t nthreads = 1; nthreads <= 8; nthreads *= 2) {
+        memset(visits, 0, (nr_objs + 1) * sizeof(*visits));
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_parallel_for_each(&tree, _test_count_visit_func, visits, nthreads));
+
+        for (size_t i = 0; i < nr_objs; i++) {
+            ptrdiff_t id = TEST_NODE(order[i])->id;
+            bool in_tree = !(id < (ptrdiff_t)nr_objs / 2 && 0 != id % 5);
+
+            WAVL_TEST_ASSERT((in_tree ? 1 : 0) == visits[id]);
+        }
+
+        acc = (struct test_acc){ .ordered = true };
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_parallel_reduce(&tree, _test_fold_func, _test_combine_func, &acc, sizeof(acc), NULL, nthreads));
+        WAVL_TEST_ASSERT(nr_left == acc.count);
+        WAVL_TEST_ASSERT(sum == acc.sum);
+        WAVL_TEST_ASSERT(true == acc.ordered);
+    }
+
+    /* An error from the visitor is passed back */
+    TEST_NODE(tree.rightmost)->id = -TEST_NODE(tree.rightmost)->id;
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_CORRUPT == wavl_tree_parallel_for_each(&tree, _test_count_visit_func, visits + nr_objs, 4));
+    TEST_NODE(tree.rightmost)->id = -TEST_NODE(tree.rightmost)->id;
+
+    free(visits);
+    free(order);
+    free(objs);
+
+    return true;
+}
+
+/**
+ * Hash functions (for testing). Every four consecutive keys share a hash, so that probe
+ * sequences collide, and removals have to move entries back.
+ */
+static
+uint64_t _test_node_hash_func(struct wavl_tree_node *node)
+{
+    return (uint64_t)TEST_NODE(node)->id >> 2;
+}
+
+static
+uint64_t _test_key_hash_func(void *key)
+{
+    return (uint64_t)(ptrdiff_t)key >> 2;
+}
+
+static
+bool wavl_test_htree(void)
+{
+    struct wavl_htree htree;
+    struct wavl_htree_slot slots[1024];
+    struct test_node *objs = NULL;
+    struct wavl_tree_node *found = NULL;
+    struct wavl_tree_stats before,
+                           after;
+    const size_t nr_slots = sizeof(slots)/sizeof(slots[0]),
+                 nr_objs = WAVL_HTREE_CAPACITY(sizeof(slots)/sizeof(slots[0]));
+
+    printf("WAVL: Testing hashed trees.\n");
+
+    WAVL_TEST_ASSERT(NULL != (objs = calloc(nr_objs + 1, sizeof(*objs))));
+
+    WAVL_TEST_ASSERT(WAVL_ERR_BAD_ARG == wavl_htree_init(&htree, _test_node_to_node_compare_func, _test_node_to_value_compare_func,
+                _test_node_hash_func, _test_key_hash_func, slots, 1000));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_htree_init(&htree, _test_node_to_node_compare_func, _test_node_to_value_compare_func,
+                _test_node_hash_func, _test_key_hash_func, slots, nr_slots));
+
+    /* Fill the table to capacity */
+    for (size_t i = 0; i < nr_objs; i++) {
+        objs[i].id = (ptrdiff_t)((i * 5) % nr_objs) + 1;
+        WAVL_TREE_NODE_CLEAR(&objs[i].node);
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_htree_insert(&htree, (void *)objs[i].id, &objs[i].node));
+    }
+
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(wavl_htree_tree(&htree), nr_objs));
+
+    /* One more does not fit, and is not put in the tree either */
+    objs[nr_objs].id = (ptrdiff_t)nr_objs + 1;
+    WAVL_TREE_NODE_CLEAR(&objs[nr_objs].node);
+    WAVL_TEST_ASSERT(WAVL_ERR_NO_SPACE == wavl_htree_insert(&htree, (void *)objs[nr_objs].id, &objs[nr_objs].node));
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_tree_find(wavl_htree_tree(&htree), (void *)objs[nr_objs].id, &found));
+
+    /* Duplicates are caught by the hash table */
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_DUPE == wavl_htree_insert(&htree, (void *)objs[1].id, &objs[nr_objs].node));
+
+    /* Exact lookups cost a comparison per colliding key, not one per level */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(wavl_htree_tree(&htree), &before));
+
+    for (size_t i = 0; i < nr_objs; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_htree_find(&htree, (void *)objs[i].id, &found));
+        WAVL_TEST_ASSERT(&objs[i].node == found);
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(wavl_htree_tree(&htree), &after));
+    WAVL_TEST_ASSERT(after.compares - before.compares <= 4 * nr_objs);
+
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_htree_find(&htree, (void *)(ptrdiff_t)(nr_objs + 1), &found));
+    WAVL_TEST_ASSERT(NULL == found);
+
+    /* Remove every third item; the rest must stay reachable through both */
+    for (size_t i = 0; i < nr_objs; i += 3) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_htree_remove(&htree, &objs[i].node));
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_htree_remove(&htree, &objs[0].node));
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(wavl_htree_tree(&htree), nr_objs - (nr_objs + 2) / 3));
+    WAVL_TEST_ASSERT(true == wavl_test_check_order(wavl_htree_tree(&htree)));
+
+    for (size_t i = 0; i < nr_objs; i++) {
+        wavl_result_t expect = 0 == i % 3 ? WAVL_ERR_TREE_NOT_FOUND : WAVL_ERR_OK;
+
+        WAVL_TEST_ASSERT(expect == wavl_htree_find(&htree, (void *)objs[i].id, &found));
+        WAVL_TEST_ASSERT(expect == wavl_tree_find(wavl_htree_tree(&htree), (void *)objs[i].id, &found));
+    }
+
+    /* The freed space can be used again */
+    for (size_t i = 0; i < nr_objs; i += 3) {
+        WAVL_TREE_NODE_CLEAR(&objs[i].node);
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_htree_insert(&htree, (void *)objs[i].id, &objs[i].node));
+    }
+
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(wavl_htree_tree(&htree), nr_objs));
+
+    for (size_t i = 0; i < nr_objs; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_htree_find(&htree, (void *)objs[i].id, &found));
+        WAVL_TEST_ASSERT(&objs[i].node == found);
+    }
+
+    free(objs);
+
+    return true;
+}
+
+/**
+ * Check that no slot of a lookup cache holds the given node
+ */
+static
+bool wavl_test_cache_lacks(struct wavl_tree_cache_slot *slots, size_t nr_slots, struct wavl_tree_node *node)
+{
+    for (size_t i = 0; i < nr_slots; i++) {
+        WAVL_TEST_ASSERT(node != slots[i].node);
+    }
+
+    return true;
+}
+
+static
+bool wavl_test_cache(void)
+{
+    struct wavl_tree tree;
+    struct wavl_tree_cache_slot slots[64];
+    struct wavl_tree_node *found = NULL;
+    struct wavl_tree_stats before,
+                           after;
+    const size_t nr_slots = sizeof(slots)/sizeof(slots[0]),
+                 nr_nodes = 200;
+    struct test_node *objs = NULL;
+    struct test_node spare;
+    uint32_t lfsr = 0xace1u;
+
+    printf("WAVL: Testing the lookup cache.\n");
+
+    WAVL_TEST_ASSERT(NULL != (objs = calloc(nr_nodes, sizeof(*objs))));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+
+    WAVL_TEST_ASSERT(WAVL_ERR_BAD_ARG == wavl_tree_set_cache(&tree, _test_key_hash_func, _test_node_hash_func, slots, 48));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_set_cache(&tree, _test_key_hash_func, _test_node_hash_func, slots, nr_slots));
+
+    for (size_t i = 0; i < nr_nodes; i++) {
+        objs[i].id = (ptrdiff_t)((i * 37) % nr_nodes) + 1;
+        WAVL_TREE_NODE_CLEAR(&objs[i].node);
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)objs[i].id, &objs[i].node));
+    }
+
+    /* The first lookup descends, and the second is answered by the cache, with one compare */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &before));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)77, &found));
+    WAVL_TEST_ASSERT(77 == TEST_NODE(found)->id);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &after));
+    WAVL_TEST_ASSERT(before.cache_misses + 1 == after.cache_misses);
+
+    before = after;
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)77, &found));
+    WAVL_TEST_ASSERT(77 == TEST_NODE(found)->id);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &after));
+    WAVL_TEST_ASSERT(before.cache_hits + 1 == after.cache_hits);
+    WAVL_TEST_ASSERT(before.compares + 1 == after.compares);
+
+    /* Keys not in the tree are never cached */
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_tree_find(&tree, (void *)(ptrdiff_t)1000, &found));
+
+    /* A skewed workload: most lookups go to a few keys */
+    for (size_t i = 0; i < 5000; i++) {
+        ptrdiff_t id = 0;
+
+        lfsr = (lfsr >> 1) ^ (-(lfsr & 1u) & 0xb400u);
+        id = 0 != (lfsr & 3) ? (ptrdiff_t)(lfsr % 8) + 1 : (ptrdiff_t)(lfsr % nr_nodes) + 1;
+
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)id, &found));
+        WAVL_TEST_ASSERT(id == TEST_NODE(found)->id);
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &after));
+    WAVL_TEST_ASSERT(after.cache_hits > after.cache_misses);
+
+    /* Removing a node drops it from the cache */
+    for (size_t i = 0; i < nr_nodes; i++) {
+        if (objs[i].id <= 8) {
+            found = &objs[i].node;
+            WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(&tree, found));
+            WAVL_TEST_ASSERT(true == wavl_test_cache_lacks(slots, nr_slots, found));
+            WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_tree_find(&tree, (void *)objs[i].id, &found));
+        }
+    }
+
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes - 8));
+
+    /* A replaced node is dropped too */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)77, &found));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)77, &found));
+    spare.id = 77;
+    WAVL_TREE_NODE_CLEAR(&spare.node);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_replace(&tree, found, &spare.node));
+    WAVL_TEST_ASSERT(true == wavl_test_cache_lacks(slots, nr_slots, found));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)77, &found));
+    WAVL_TEST_ASSERT(&spare.node == found);
+
+    /* Forgetting a node before changing its key drops only that node */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)100, &found));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)77, &found));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_cache_forget(&tree, found));
+    WAVL_TEST_ASSERT(true == wavl_test_cache_lacks(slots, nr_slots, found));
+    TEST_NODE(found)->id = 1000;
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_update_key(&tree, found, (void *)(ptrdiff_t)1000));
+    WAVL_TEST_ASSERT(true == wavl_test_cache_lacks(slots, nr_slots, found));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &before));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)100, &found));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &after));
+    WAVL_TEST_ASSERT(before.cache_hits + 1 == after.cache_hits);
+
+    /* The same goes for a key change that leaves the node in place (1 to 8 were removed) */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)9, &found));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_cache_forget(&tree, found));
+    TEST_NODE(found)->id = 1;
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_update_key(&tree, found, (void *)(ptrdiff_t)1));
+    WAVL_TEST_ASSERT(true == wavl_test_cache_lacks(slots, nr_slots, found));
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_tree_find(&tree, (void *)(ptrdiff_t)9, &found));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)1, &found));
+    WAVL_TEST_ASSERT(1 == TEST_NODE(found)->id);
+
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_tree_find(&tree, (void *)(ptrdiff_t)77, &found));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)1000, &found));
+    WAVL_TEST_ASSERT(&spare.node == found);
+    WAVL_TEST_ASSERT(true == wavl_test_check_order(&tree));
+
+    /* Without a cache, lookups still work */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_set_cache(&tree, NULL, NULL, NULL, 0));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &before));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)100, &found));
+    WAVL_TEST_ASSERT(100 == TEST_NODE(found)->id);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_stats(&tree, &after));
+    WAVL_TEST_ASSERT(before.cache_hits == after.cache_hits && before.cache_misses == after.cache_misses);
+
+    free(objs);
+
+    return true;
+}
+
+/**
+ * The staged duplicates handed back by the relaxed-balance step
+ */
+struct test_dupes {
+    struct wavl_tree_node *nodes[4];
+    size_t nr;
+};
+
+static
+void _test_dupe_func(struct wavl_tree *tree,
+                     struct wavl_tree_node *node,
+                     void *arg)
+{
+    struct test_dupes *dupes = arg;
+
+    (void)tree;
+
+    if (dupes->nr < sizeof(dupes->nodes) / sizeof(dupes->nodes[0])) {
+        dupes->nodes[dupes->nr] = node;
+    }
+
+    dupes->nr++;
+}
+
+static
+bool wavl_test_relaxed(void)
+{
+    struct wavl_tree tree;
+    struct wavl_tree_node *found = NULL;
+    struct wavl_tree_report report;
+    struct wavl_pq pq;
+    struct test_dupes dupes = { .nr = 0 };
+    const size_t nr_nodes = 300;
+    struct test_node *objs = NULL;
+    struct test_node spare[4];
+    size_t nr_pending = 0,
+           count = 0;
+
+    printf("WAVL: Testing relaxed-balance mode.\n");
+
+    WAVL_TEST_ASSERT(NULL != (objs = calloc(nr_nodes, sizeof(*objs))));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_set_relaxed(&tree, _test_dupe_func, &dupes));
+
+    /* Inserts are staged, and the tree itself is not touched */
+    for (size_t i = 0; i < nr_nodes; i++) {
+        objs[i].id = (ptrdiff_t)((i * 7) % nr_nodes) + 1;
+        WAVL_TREE_NODE_CLEAR(&objs[i].node);
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)objs[i].id, &objs[i].node));
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_pending(&tree, &nr_pending));
+    WAVL_TEST_ASSERT(nr_pending == nr_nodes);
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, 0));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_inspect(&tree, &report));
+    WAVL_TEST_ASSERT(report.nr_pending == nr_nodes);
+
+    /* Staged items can be removed, replaced and re-keyed without touching the tree */
+    WAVL_TEST_ASSERT(1 == objs[0].id && 8 == objs[1].id && 15 == objs[2].id);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(&tree, &objs[0].node));
+
+    spare[0].id = 8;
+    WAVL_TREE_NODE_CLEAR(&spare[0].node);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_replace(&tree, &objs[1].node, &spare[0].node));
+
+    objs[2].id = 1000;
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_update_key(&tree, &objs[2].node, (void *)objs[2].id));
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_pending(&tree, &nr_pending));
+    WAVL_TEST_ASSERT(nr_pending == nr_nodes - 1);
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, 0));
+
+    /* A duplicate is staged too; a finger is only a hint, and is not used */
+    spare[1].id = 5;
+    WAVL_TREE_NODE_CLEAR(&spare[1].node);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)spare[1].id, &spare[1].node));
+    spare[2].id = 2000;
+    WAVL_TREE_NODE_CLEAR(&spare[2].node);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert_from(&tree, &objs[3].node, (void *)spare[2].id, &spare[2].node));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_pending(&tree, &nr_pending));
+    WAVL_TEST_ASSERT(nr_pending == nr_nodes + 1);
+
+    /* Each step moves at most its budget of items, oldest first */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_rebalance_step(&tree, 100));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_pending(&tree, &nr_pending));
+    WAVL_TEST_ASSERT(nr_pending == nr_nodes - 99);
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, 100));
+    WAVL_TEST_ASSERT(false == spare[0].node.pending && false == objs[100].node.pending);
+    WAVL_TEST_ASSERT(true == objs[101].node.pending);
+    WAVL_TEST_ASSERT(0 == dupes.nr);
+
+    /* A query moves the rest in first. The duplicate is handed back, without holding up the
+     * item staged after it. */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_min(&tree, &found));
+    WAVL_TEST_ASSERT(2 == TEST_NODE(found)->id);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_pending(&tree, &nr_pending));
+    WAVL_TEST_ASSERT(0 == nr_pending);
+    WAVL_TEST_ASSERT(1 == dupes.nr && &spare[1].node == dupes.nodes[0]);
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes));
+    WAVL_TEST_ASSERT(true == wavl_test_check_order(&tree));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_max(&tree, &found));
+    WAVL_TEST_ASSERT(&spare[2].node == found);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)8, &found));
+    WAVL_TEST_ASSERT(&spare[0].node == found);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)(ptrdiff_t)1000, &found));
+    WAVL_TEST_ASSERT(&objs[2].node == found);
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_tree_find(&tree, (void *)(ptrdiff_t)1, &found));
+
+    /* Leaving relaxed mode moves everything over */
+    spare[3].id = 500;
+    WAVL_TREE_NODE_CLEAR(&spare[3].node);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)spare[3].id, &spare[3].node));
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_set_relaxed(&tree, NULL, NULL));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_get_pending(&tree, &nr_pending));
+    WAVL_TEST_ASSERT(0 == nr_pending);
+    WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, nr_nodes + 1));
+    WAVL_TEST_ASSERT(true == wavl_test_check_order(&tree));
+
+    for (size_t i = 2; i < nr_nodes; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_find(&tree, (void *)objs[i].id, &found));
+        WAVL_TEST_ASSERT(&objs[i].node == found);
+    }
+
+    /* The ends of a tree that only has staged items */
+    for (size_t i = 0; i < 2; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_set_relaxed(&tree, _test_dupe_func, &dupes));
+
+        for (size_t j = 0; j < 3; j++) {
+            spare[j].id = (ptrdiff_t)((j + 1) % 3) + 1;
+            WAVL_TREE_NODE_CLEAR(&spare[j].node);
+            WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)spare[j].id, &spare[j].node));
+        }
+
+        WAVL_TEST_ASSERT(NULL == tree.root);
+
+        if (0 == i) {
+            WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_min(&tree, &found));
+            WAVL_TEST_ASSERT(&spare[2].node == found);
+        } else {
+            WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_max(&tree, &found));
+            WAVL_TEST_ASSERT(&spare[1].node == found);
+        }
+
+        WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, 3));
+    }
+
+    /* Equal keys keep their insertion order across steps */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_init_flags(&tree, _test_node_to_node_compare_func, _test_node_to_value_compare_func, WAVL_TREE_FLAG_MULTI));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_set_relaxed(&tree, _test_dupe_func, &dupes));
+
+    for (size_t i = 0; i < 3; i++) {
+        spare[i].id = 7;
+        WAVL_TREE_NODE_CLEAR(&spare[i].node);
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_insert(&tree, (void *)spare[i].id, &spare[i].node));
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_rebalance_step(&tree, 0 == i ? 1 : 0));
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_count(&tree, (void *)(ptrdiff_t)7, &count));
+    WAVL_TEST_ASSERT(3 == count);
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_set_relaxed(&tree, NULL, NULL));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_min(&tree, &found));
+
+    for (size_t i = 0; i < 3; i++) {
+        WAVL_TEST_ASSERT(&spare[i].node == found);
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_next(&tree, found, &found) || 2 == i);
+    }
+
+    WAVL_TEST_ASSERT(1 == dupes.nr);
+
+    /* A queue pops staged items in order too */
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_pq_init(&pq, _test_node_to_node_compare_func, _test_node_to_value_compare_func));
+    WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_set_relaxed(&pq.tree, _test_dupe_func, &dupes));
+
+    for (size_t i = 0; i < 4; i++) {
+        spare[i].id = (ptrdiff_t)(3 - i);
+        WAVL_TREE_NODE_CLEAR(&spare[i].node);
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_pq_push(&pq, (void *)spare[i].id, &spare[i].node));
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_rebalance_step(&pq.tree, 1 == i ? 2 : 0));
+    }
+
+    for (size_t i = 0; i < 4; i++) {
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_pq_pop_min(&pq, &found));
+        WAVL_TEST_ASSERT(&spare[3 - i].node == found);
+    }
+
+    WAVL_TEST_ASSERT(WAVL_ERR_TREE_NOT_FOUND == wavl_pq_pop_min(&pq, &found));
+
+    free(objs);
+
+    return true;
+}
+
+#define LFSR_POLY_6B_1 0x36
+#define LFSR_POLY_6B_2 0x30
+
+static
+uint32_t lfsr_next(uint32_t lfsr, uint32_t poly)
+{
+    bool fb = !!(lfsr & 1);
+
+    lfsr >>= 1;
+    lfsr = !fb ? lfsr : (lfsr ^ poly);
+
+    return lfsr;
+}
+
+static
+bool wavl_test_pseudorandom_1(void)
+{
+    uint32_t lfsr = LFSR_POLY_6B_1;
+    struct wavl_tree tree;
+
+    wavl_test_clear();
+
+    WAVL_TEST_ASSERT(WAVL_ERR_OK ==
+            wavl_tree_init(
+                &tree,
+                _test_node_to_node_compare_func,
+                _test_node_to_value_compare_func));
+
+    printf("Inserting: ");
+    for (size_t i = 0; i < 63; i++) {
+        printf(" %02x ", (unsigned int)lfsr);
+        fflush(stdout);
+        nodes[i].id = lfsr;
+        WAVL_TEST_ASSERT(WAVL_ERR_OK ==
+                wavl_tree_insert(&tree,
+                    (void *)nodes[i].id,
+                    &nodes[i].node));
+
+        lfsr = lfsr_next(lfsr, LFSR_POLY_6B_1);
+    }
+
+    printf("\n");
+
+    printf("Removing: ");
+    for (size_t i = 0; i < 63; i++) {
+        struct wavl_tree_node *nd = NULL;
+        struct test_node *tn = NULL;
+        printf(" %02x (%u) ", (unsigned int)lfsr, (unsigned int)lfsr);
+        fflush(stdout);
+
+        WAVL_TEST_ASSERT(WAVL_ERR_OK ==
+                wavl_tree_find(&tree,
+                    (void *)(ptrdiff_t)lfsr,
+                    &nd));
+        WAVL_TEST_ASSERT(NULL != nd);
+        tn = TEST_NODE(nd);
+
+        WAVL_TEST_ASSERT(tn->id == lfsr);
+
+        WAVL_TEST_ASSERT(WAVL_ERR_OK == wavl_tree_remove(
+                    &tree,
+                    nd));
+
+        WAVL_TEST_ASSERT(true == wavl_test_check_tree(&tree, 62 - i));
+
+        lfsr = lfsr_next(lfsr, LFSR_POLY_6B_2);
+    }
+
+    printf("\n");
+
+    WAVL_TEST_ASSERT(tree.root == NULL);
+
+    return true;
+}
+
+int main(int argc __attribute__((unused)), const char *argv[])
+{
+    int ret = EXIT_FAILURE;
+
+    fprintf(stdout, "%s: tester\n", argv[0]);
+
+    wavl_test_init();
+    wavl_test_simple_insert();
+    wavl_test_sign_invert_insert();
+    wavl_test_delete_leaf_leaf_sibling();
+    wavl_test_delete_leaf_unary_sibling();
+    wavl_test_delete_inner_1();
+    wavl_test_delete_every_third();
+    wavl_test_delete_every_third_then_reinsert();
+
+    wavl_test_find();
+
+    wavl_test_stats();
+    wavl_test_inspect();
+    wavl_test_relayout();
+    wavl_test_find_batch();
+    wavl_test_freeze();
+    wavl_test_find_from();
+    wavl_test_remove_and_next();
+    wavl_test_min_max();
+    wavl_test_pq();
+    wavl_test_multi();
+    wavl_test_replace();
+    wavl_test_update_key();
+    wavl_test_inline_key();
+    wavl_test_bytes();
+    wavl_test_compact();
+    wavl_test_image();
+    wavl_test_shm();
+    wavl_test_slab();
+#ifdef WAVL_TRACE
+    wavl_test_trace();
+#endif
+    wavl_test_build_parallel();
+    wavl_test_parallel_walk();
+    wavl_test_htree();
+    wavl_test_cache();
+    wavl_test_relaxed();
 
     wavl_test_pseudorandom_1();
 
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2021, Phil Vachon <phil@security-embedded.com>>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "wavltree_trace.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+_Static_assert(32 == sizeof(struct wavl_trace_event), "trace events must be 32 bytes");
+_Static_assert(0 == (WAVL_TRACE_RING_SIZE & (WAVL_TRACE_RING_SIZE - 1)), "ring size must be a power of two");
+
+/**
+ * A per-thread ring of trace events. Only the owning thread writes to a ring.
+ */
+struct wavl_trace_ring {
+    uint64_t head;                  /**< Number of events ever written */
+    struct wavl_trace_event events[WAVL_TRACE_RING_SIZE]; /**< The events, indexed by head modulo the size */
+} __attribute__((aligned(64)));
+
+static
+struct wavl_trace_ring _wavl_trace_rings[WAVL_TRACE_MAX_RINGS];
+
+/**
+ * Number of rings claimed. May exceed WAVL_TRACE_MAX_RINGS, once they have all been taken.
+ */
+static
+uint32_t _wavl_trace_nr_claimed;
+
+static
+uint64_t _wavl_trace_dropped;
+
+static _Thread_local
+struct wavl_trace_ring *_wavl_trace_my_ring;
+
+static _Thread_local
+bool _wavl_trace_no_ring;
+
+static
+const char *_wavl_trace_op_names[] = {
+    [WAVL_TRACE_OP_ROTATE_LEFT] = "rotate-left",
+    [WAVL_TRACE_OP_ROTATE_RIGHT] = "rotate-right",
+    [WAVL_TRACE_OP_DOUBLE_ROTATE_LEFT] = "double-rotate-left",
+    [WAVL_TRACE_OP_DOUBLE_ROTATE_RIGHT] = "double-rotate-right",
+    [WAVL_TRACE_OP_PROMOTE] = "promote",
+    [WAVL_TRACE_OP_DOUBLE_PROMOTE] = "double-promote",
+    [WAVL_TRACE_OP_DEMOTE] = "demote",
+    [WAVL_TRACE_OP_DOUBLE_DEMOTE] = "double-demote",
+    [WAVL_TRACE_OP_REBALANCE_3_CHILD] = "rebalance-3-child",
+};
+
+const char *wavl_trace_op_name(uint16_t op)
+{
+    if (op >= sizeof(_wavl_trace_op_names)/sizeof(_wavl_trace_op_names[0]) ||
+            NULL == _wavl_trace_op_names[op])
+    {
+        return "unknown";
+    }
+
+    return _wavl_trace_op_names[op];
+}
+
+static inline
+uint64_t _wavl_trace_timestamp(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/**
+ * Claim a ring for the calling thread. Returns NULL if they have all been taken.
+ */
+static
+struct wavl_trace_ring *_wavl_trace_claim_ring(void)
+{
+    uint32_t idx = __atomic_fetch_add(&_wavl_trace_nr_claimed, 1, __ATOMIC_RELAXED);
+
+    if (idx >= WAVL_TRACE_MAX_RINGS) {
+        _wavl_trace_no_ring = true;
+        return NULL;
+    }
+
+    _wavl_trace_my_ring = &_wavl_trace_rings[idx];
+
+    return _wavl_trace_my_ring;
+}
+
+void wavl_trace_emit(enum wavl_trace_op op,
+                     const void *tree,
+                     const void *node,
+                     bool rp_before,
+                     bool rp_after)
+{
+    struct wavl_trace_ring *ring = _wavl_trace_my_ring;
+    struct wavl_trace_event *ev = NULL;
+    uint64_t head = 0;
+
+    if (WAVL_UNLIKELY(NULL == ring)) {
+        if (true == _wavl_trace_no_ring || NULL == (ring = _wavl_trace_claim_ring())) {
+            __atomic_fetch_add(&_wavl_trace_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    head = ring->head;
+    ev = &ring->events[head & (WAVL_TRACE_RING_SIZE - 1)];
+
+    ev->tsc = _wavl_trace_timestamp();
+    ev->tree = (uint64_t)(uintptr_t)tree;
+    ev->node = (uint64_t)(uintptr_t)node;
+    ev->seq = (uint32_t)head;
+    ev->op = (uint16_t)op;
+    ev->rp_before = rp_before;
+    ev->rp_after = rp_after;
+
+    /* Publish the event to readers on other threads */
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+int wavl_trace_self(void)
+{
+    return NULL == _wavl_trace_my_ring ? -1 : (int)(_wavl_trace_my_ring - _wavl_trace_rings);
+}
+
+static inline
+uint32_t _wavl_trace_nr_rings(void)
+{
+    uint32_t nr = __atomic_load_n(&_wavl_trace_nr_claimed, __ATOMIC_ACQUIRE);
+
+    return nr < WAVL_TRACE_MAX_RINGS ? nr : WAVL_TRACE_MAX_RINGS;
+}
+
+wavl_result_t wavl_trace_read(int ring,
+                              struct wavl_trace_event *events,
+                              size_t max_events,
+                              size_t *pnr_events)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_trace_ring *r = NULL;
+    uint64_t head = 0,
+             first = 0,
+             head_after = 0;
+    size_t nr = 0;
+
+    WAVL_ASSERT_ARG(0 <= ring && (uint32_t)ring < _wavl_trace_nr_rings());
+    WAVL_ASSERT_ARG(NULL != events || 0 == max_events);
+    WAVL_ASSERT_ARG(NULL != pnr_events);
+
+    r = &_wavl_trace_rings[ring];
+
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    first = head > WAVL_TRACE_RING_SIZE ? head - WAVL_TRACE_RING_SIZE : 0;
+
+    if (head - first > max_events) {
+        first = head - max_events;
+    }
+
+    for (uint64_t i = first; i < head; i++) {
+        events[nr++] = r->events[i & (WAVL_TRACE_RING_SIZE - 1)];
+    }
+
+    /*
+     * If the owner kept writing while we copied, the oldest events may have been overwritten.
+     * The owner fills slot head_after before it publishes head_after + 1, so that slot may be
+     * half-written too. Drop any event whose slot has been reused, or is being reused, since
+     * we read the head. The calling thread's own ring cannot change under it.
+     */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    head_after = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+    if (r != _wavl_trace_my_ring && head_after + 1 - first > WAVL_TRACE_RING_SIZE) {
+        size_t skip = (size_t)(head_after + 1 - first - WAVL_TRACE_RING_SIZE);
+
+        skip = skip < nr ? skip : nr;
+        memmove(events, events + skip, (nr - skip) * sizeof(*events));
+        nr -= skip;
+    }
+
+    *pnr_events = nr;
+
+    return ret;
+}
+
+/**
+ * Write all of a buffer, using nothing that is not async-signal-safe.
+ */
+static
+wavl_result_t _wavl_trace_write_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *ptr = buf;
+
+    while (len > 0) {
+        ssize_t written = write(fd, ptr, len);
+
+        if (written < 0) {
+            return WAVL_ERR_IO;
+        }
+
+        ptr += written;
+        len -= (size_t)written;
+    }
+
+    return WAVL_ERR_OK;
+}
+
+wavl_result_t wavl_trace_dump(int fd)
+{
+    wavl_result_t ret = WAVL_ERR_OK;
+
+    struct wavl_trace_dump_header hdr;
+    uint32_t nr_rings = _wavl_trace_nr_rings();
+
+    WAVL_ASSERT_ARG(0 <= fd);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, WAVL_TRACE_MAGIC, sizeof(WAVL_TRACE_MAGIC));
+    hdr.version = WAVL_TRACE_VERSION;
+    hdr.event_size = sizeof(struct wavl_trace_event);
+    hdr.ring_size = WAVL_TRACE_RING_SIZE;
+    hdr.nr_rings = nr_rings;
+    hdr.dropped = __atomic_load_n(&_wavl_trace_dropped, __ATOMIC_RELAXED);
+
+    if (WAVL_FAILED(ret = _wavl_trace_write_all(fd, &hdr, sizeof(hdr)))) {
+        goto done;
+    }
+
+    for (uint32_t i = 0; i < nr_rings; i++) {
+        struct wavl_trace_dump_ring rhdr = {
+            .head = __atomic_load_n(&_wavl_trace_rings[i].head, __ATOMIC_ACQUIRE),
+        };
+
+        if (WAVL_FAILED(ret = _wavl_trace_write_all(fd, &rhdr, sizeof(rhdr))) ||
+                WAVL_FAILED(ret = _wavl_trace_write_all(fd, _wavl_trace_rings[i].events,
+                        sizeof(_wavl_trace_rings[i].events))))
+        {
+            goto done;
+        }
+    }
+
+done:
+    return ret;
+}
+
@@ -0,0 +1,129 @@
+#pragma once
+
+/** \file wavltree_trace.h
+ * Binary trace of rebalancing events. When the library is built with `WAVL_TRACE` defined,
+ * every rotation, promotion, demotion and 3-child rebalance appends a fixed-size event to a
+ * ring buffer owned by the calling thread. Appending is a handful of stores and no locks, so
+ * tracing can be left enabled in production. The rings are static, and outlive the threads
+ * that wrote them, so the last events before an incident can be read back with
+ * `wavl_trace_read`, or written out with `wavl_trace_dump` and decoded with
+ * `wavl-trace-decode`.
+ */
+
+#include "wavltree.h"
+
+#include <stdint.h>
+
+/**
+ * Number of events kept per thread. Must be a power of two.
+ */
+#ifndef WAVL_TRACE_RING_SIZE
+#define WAVL_TRACE_RING_SIZE            512
+#endif
+
+/**
+ * Number of threads that can trace. Threads beyond this are not traced; their events are
+ * counted in the `dropped` field of the dump header.
+ */
+#ifndef WAVL_TRACE_MAX_RINGS
+#define WAVL_TRACE_MAX_RINGS            64
+#endif
+
+/**
+ * Trace event types
+ */
+enum wavl_trace_op {
+    WAVL_TRACE_OP_ROTATE_LEFT = 1,          /**< Single left rotation of node up into its parent */
+    WAVL_TRACE_OP_ROTATE_RIGHT = 2,         /**< Single right rotation of node up into its parent */
+    WAVL_TRACE_OP_DOUBLE_ROTATE_LEFT = 3,   /**< Double left rotation of node up into its grandparent */
+    WAVL_TRACE_OP_DOUBLE_ROTATE_RIGHT = 4,  /**< Double right rotation of node up into its grandparent */
+    WAVL_TRACE_OP_PROMOTE = 5,              /**< Rank of node promoted */
+    WAVL_TRACE_OP_DOUBLE_PROMOTE = 6,       /**< Rank of node promoted twice */
+    WAVL_TRACE_OP_DEMOTE = 7,               /**< Rank of node demoted */
+    WAVL_TRACE_OP_DOUBLE_DEMOTE = 8,        /**< Rank of node demoted twice */
+    WAVL_TRACE_OP_REBALANCE_3_CHILD = 9,    /**< Removal left a 3-child under node */
+};
+
+/**
+ * A trace event. This is also the on-disk format of events in a dump.
+ */
+struct wavl_trace_event {
+    uint64_t tsc;                   /**< Timestamp: the TSC on x86, otherwise monotonic nanoseconds */
+    uint64_t tree;                  /**< Address of the tree */
+    uint64_t node;                  /**< Address of the node the event applies to */
+    uint32_t seq;                   /**< Low 32 bits of the event's position in its ring */
+    uint16_t op;                    /**< enum wavl_trace_op */
+    uint8_t rp_before;              /**< Rank parity of node before the event */
+    uint8_t rp_after;               /**< Rank parity of node after the event */
+};
+
+/**
+ * Header of a trace dump, as written by `wavl_trace_dump`. Followed by nr_rings rings, each a
+ * `struct wavl_trace_dump_ring` and then ring_size events, in ring order.
+ */
+struct wavl_trace_dump_header {
+    char magic[8];                  /**< WAVL_TRACE_MAGIC */
+    uint32_t version;               /**< WAVL_TRACE_VERSION */
+    uint32_t event_size;            /**< sizeof(struct wavl_trace_event) */
+    uint32_t ring_size;             /**< Events per ring */
+    uint32_t nr_rings;              /**< Rings in the dump */
+    uint64_t dropped;               /**< Events dropped because every ring was taken */
+};
+
+struct wavl_trace_dump_ring {
+    uint64_t head;                  /**< Number of events ever written to this ring */
+};
+
+#define WAVL_TRACE_MAGIC                "WAVLTRC"
+#define WAVL_TRACE_VERSION              1
+
+/**
+ * Get the name of a trace event type.
+ */
+const char *wavl_trace_op_name(uint16_t op);
+
+/**
+ * Append an event to the calling thread's ring. Called by the library.
+ */
+void wavl_trace_emit(enum wavl_trace_op op,
+                     const void *tree,
+                     const void *node,
+                     bool rp_before,
+                     bool rp_after);
+
+/**
+ * Get the index of the calling thread's ring.
+ *
+ * \return The ring index, or -1 if this thread has not traced anything yet (or could not get
+ *         a ring).
+ */
+int wavl_trace_self(void);
+
+/**
+ * Copy the most recent events of a ring, oldest first. The copy of the calling thread's own
+ * ring is exact. For another thread's ring, events that may be being overwritten are skipped:
+ * when the ring is full, this always includes the oldest event, as the owner could be
+ * rewriting its slot.
+ *
+ * \param ring The ring index.
+ * \param events Array to copy events into.
+ * \param max_events Number of entries in events.
+ * \param pnr_events Number of events copied, returned by reference.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_BAD_ARG if ring does not exist.
+ */
+wavl_result_t wavl_trace_read(int ring,
+                              struct wavl_trace_event *events,
+                              size_t max_events,
+                              size_t *pnr_events);
+
+/**
+ * Write every ring in use to a file, for `wavl-trace-decode`. This only uses write(2), so it
+ * may be called from a signal handler.
+ *
+ * \param fd The file to write to.
+ *
+ * \return WAVL_ERR_OK on success, WAVL_ERR_IO if a write failed.
+ */
+wavl_result_t wavl_trace_dump(int fd);
+
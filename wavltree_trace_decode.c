@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2021, Phil Vachon <phil@security-embedded.com>>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/** \file wavltree_trace_decode.c
+ * Decode a trace dump written by `wavl_trace_dump`. Events from all rings are merged and
+ * printed in timestamp order, oldest first.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "wavltree_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * An event, with the ring it came from
+ */
+struct decode_event {
+    struct wavl_trace_event ev;     /**< The event */
+    uint32_t ring;                  /**< The ring (thread) that recorded it */
+};
+
+static
+int decode_event_cmp(const void *lhs, const void *rhs)
+{
+    const struct decode_event *l = lhs,
+                              *r = rhs;
+
+    if (l->ev.tsc != r->ev.tsc) {
+        return l->ev.tsc < r->ev.tsc ? -1 : 1;
+    }
+
+    if (l->ring != r->ring) {
+        return l->ring < r->ring ? -1 : 1;
+    }
+
+    return l->ev.seq < r->ev.seq ? -1 : (l->ev.seq > r->ev.seq ? 1 : 0);
+}
+
+static
+void decode_usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n events] dump-file\n", name);
+    fprintf(stderr, "  -n events  Only print the last events (default: all)\n");
+}
+
+int main(int argc, char *const argv[])
+{
+    int ret = EXIT_FAILURE,
+        opt = -1;
+    size_t max_events = SIZE_MAX,
+           nr_events = 0,
+           first = 0;
+    struct wavl_trace_dump_header hdr;
+    struct wavl_trace_event *ring_events = NULL;
+    struct decode_event *events = NULL;
+    FILE *fp = NULL;
+
+    while (-1 != (opt = getopt(argc, argv, "n:h"))) {
+        switch (opt) {
+        case 'n':
+            max_events = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            decode_usage(argv[0]);
+            goto done;
+        }
+    }
+
+    if (optind + 1 != argc) {
+        decode_usage(argv[0]);
+        goto done;
+    }
+
+    if (NULL == (fp = fopen(argv[optind], "rb"))) {
+        perror(argv[optind]);
+        goto done;
+    }
+
+    if (1 != fread(&hdr, sizeof(hdr), 1, fp) ||
+            0 != memcmp(hdr.magic, WAVL_TRACE_MAGIC, sizeof(WAVL_TRACE_MAGIC)) ||
+            WAVL_TRACE_VERSION != hdr.version ||
+            sizeof(struct wavl_trace_event) != hdr.event_size ||
+            0 == hdr.ring_size ||
+            0 != (hdr.ring_size & (hdr.ring_size - 1)))
+    {
+        fprintf(stderr, "%s: not a trace dump from this version\n", argv[optind]);
+        goto done;
+    }
+
+    if (NULL == (ring_events = calloc(hdr.ring_size, sizeof(*ring_events))) ||
+            NULL == (events = calloc((size_t)hdr.ring_size * (hdr.nr_rings + 1), sizeof(*events))))
+    {
+        fprintf(stderr, "Failed to allocate %" PRIu32 " rings\n", hdr.nr_rings);
+        goto done;
+    }
+
+    for (uint32_t r = 0; r < hdr.nr_rings; r++) {
+        struct wavl_trace_dump_ring rhdr;
+        uint64_t start = 0;
+
+        if (1 != fread(&rhdr, sizeof(rhdr), 1, fp) ||
+                hdr.ring_size != fread(ring_events, sizeof(*ring_events), hdr.ring_size, fp))
+        {
+            fprintf(stderr, "%s: truncated at ring %" PRIu32 "\n", argv[optind], r);
+            goto done;
+        }
+
+        start = rhdr.head > hdr.ring_size ? rhdr.head - hdr.ring_size : 0;
+
+        for (uint64_t i = start; i < rhdr.head; i++) {
+            struct wavl_trace_event *ev = &ring_events[i & (hdr.ring_size - 1)];
+
+            /* Skip a slot the owner was overwriting when the dump was taken */
+            if (ev->seq != (uint32_t)i) {
+                continue;
+            }
+
+            events[nr_events].ev = *ev;
+            events[nr_events].ring = r;
+            nr_events++;
+        }
+    }
+
+    qsort(events, nr_events, sizeof(*events), decode_event_cmp);
+
+    if (nr_events > max_events) {
+        first = nr_events - max_events;
+    }
+
+    printf("# %" PRIu32 " rings, %zu events, %" PRIu64 " dropped\n", hdr.nr_rings, nr_events, hdr.dropped);
+    printf("# %-18s %4s %10s %-20s %-18s %-18s %s\n", "tsc", "ring", "seq", "op", "tree", "node", "rp");
+
+    for (size_t i = first; i < nr_events; i++) {
+        struct wavl_trace_event *ev = &events[i].ev;
+
+        printf("%20" PRIu64 " %4" PRIu32 " %10" PRIu32 " %-20s 0x%016" PRIx64 " 0x%016" PRIx64 " %u->%u\n",
+                ev->tsc, events[i].ring, ev->seq, wavl_trace_op_name(ev->op),
+                ev->tree, ev->node, ev->rp_before, ev->rp_after);
+    }
+
+    ret = EXIT_SUCCESS;
+
+done:
+    if (NULL != fp) {
+        fclose(fp);
+    }
+    free(events);
+    free(ring_events);
+    return ret;
+}
+